@@ -0,0 +1,249 @@
+package tun2socket
+
+/*
+#cgo CFLAGS: -Inative
+
+#include "engine.h"
+*/
+import "C"
+
+import (
+	"errors"
+	"io"
+	"net"
+	"runtime"
+	"sync"
+	"time"
+	"unsafe"
+)
+
+var ErrWouldBlock = errors.New("would block")
+
+type StreamEvents int
+
+const (
+	StreamAccepted StreamEvents = C.TCP_STREAM_ACCEPTED
+	StreamReadable StreamEvents = C.TCP_STREAM_READABLE
+	StreamWritable StreamEvents = C.TCP_STREAM_WRITABLE
+	StreamError    StreamEvents = C.TCP_STREAM_ERROR
+)
+
+type EngineEvent struct {
+	Stream Stream
+	Events StreamEvents
+}
+
+// Engine accepts TCP connections through lwIP's raw callback API and reports
+// readiness of all of them through one queue, instead of a blocked thread per
+// connection. Only one of Engine and Stack.TCP can listen at a time, close the
+// stack's listener before ListenEngine.
+type Engine interface {
+	// Poll waits up to timeout for events, a negative timeout waits forever.
+	Poll(events []EngineEvent, timeout time.Duration) (int, error)
+	Close() error
+}
+
+// Stream is a connection accepted by an Engine. Read and Write never block,
+// they return ErrWouldBlock until the engine reports the stream ready again.
+type Stream interface {
+	Read(b []byte) (int, error)
+	Write(b []byte) (int, error)
+	CloseRead() error
+	CloseWrite() error
+	LocalAddr() net.Addr
+	RemoteAddr() net.Addr
+	Close() error
+}
+
+type engine struct {
+	context *C.tcp_engine_t
+	streams *streamSet
+}
+
+// streamSet maps native streams to open ones. Streams point here rather than
+// at the engine, so an engine with open streams can still be finalized.
+type streamSet struct {
+	lock    sync.Mutex
+	streams map[*C.tcp_stream_t]*stream
+}
+
+func (e *engine) Poll(events []EngineEvent, timeout time.Duration) (int, error) {
+	if len(events) == 0 {
+		return 0, nil
+	}
+
+	native := make([]C.tcp_engine_event_t, len(events))
+
+	n := int(C.tcp_engine_poll(e.context, &native[0], C.int(len(native)), timeoutMillis(timeout)))
+	if n < 0 {
+		return 0, ErrIllegalState
+	}
+
+	set := e.streams
+
+	set.lock.Lock()
+	defer set.lock.Unlock()
+
+	size := 0
+
+	for _, event := range native[:n] {
+		s, ok := set.streams[event.stream]
+		if !ok {
+			if event.events&C.TCP_STREAM_ACCEPTED == 0 {
+				continue
+			}
+
+			s = newStream(set, event.stream)
+
+			set.streams[event.stream] = s
+		}
+
+		// no events follow an error, the caller holds the only reference from here on
+		if event.events&C.TCP_STREAM_ERROR != 0 {
+			delete(set.streams, event.stream)
+		}
+
+		events[size] = EngineEvent{
+			Stream: s,
+			Events: StreamEvents(event.events),
+		}
+
+		size++
+	}
+
+	return size, nil
+}
+
+func (e *engine) Close() error {
+	C.tcp_engine_close(e.context)
+
+	return nil
+}
+
+func (set *streamSet) remove(s *stream) {
+	set.lock.Lock()
+	defer set.lock.Unlock()
+
+	if set.streams[s.context] == s {
+		delete(set.streams, s.context)
+	}
+}
+
+func ListenEngine() (Engine, error) {
+	context := C.tcp_engine_listen()
+	if context == nil {
+		return nil, ErrIllegalState
+	}
+
+	e := &engine{
+		context: context,
+		streams: &streamSet{streams: map[*C.tcp_stream_t]*stream{}},
+	}
+
+	runtime.SetFinalizer(e, engineDestroy)
+
+	return e, nil
+}
+
+func engineDestroy(e *engine) {
+	C.tcp_engine_free(e.context)
+}
+
+type stream struct {
+	set     *streamSet
+	context *C.tcp_stream_t
+}
+
+func (s *stream) Read(b []byte) (int, error) {
+	if len(b) == 0 {
+		return 0, nil
+	}
+
+	n := int(C.tcp_stream_recv(s.context, unsafe.Pointer(&b[0]), C.int(len(b))))
+	if n == C.TCP_STREAM_AGAIN {
+		return 0, ErrWouldBlock
+	} else if n < 0 {
+		return 0, ErrNative
+	} else if n == 0 {
+		return 0, io.EOF
+	}
+
+	return n, nil
+}
+
+func (s *stream) Write(b []byte) (int, error) {
+	if len(b) == 0 {
+		return 0, nil
+	}
+
+	n := int(C.tcp_stream_send(s.context, unsafe.Pointer(&b[0]), C.int(len(b))))
+	if n == C.TCP_STREAM_AGAIN {
+		return 0, ErrWouldBlock
+	} else if n < 0 {
+		return 0, ErrNative
+	}
+
+	return n, nil
+}
+
+func (s *stream) CloseRead() error {
+	if C.tcp_stream_shutdown(s.context, 1, 0) < 0 {
+		return ErrNative
+	}
+
+	return nil
+}
+
+func (s *stream) CloseWrite() error {
+	if C.tcp_stream_shutdown(s.context, 0, 1) < 0 {
+		return ErrNative
+	}
+
+	return nil
+}
+
+func (s *stream) LocalAddr() net.Addr {
+	ip := net.IP{0, 0, 0, 0}
+	port := C.uint16_t(0)
+
+	C.tcp_stream_local_addr(s.context, (*C.uint8_t)(unsafe.Pointer(&ip[0])), &port)
+
+	return &net.TCPAddr{
+		IP:   ip,
+		Port: int(port),
+		Zone: "",
+	}
+}
+
+func (s *stream) RemoteAddr() net.Addr {
+	ip := net.IP{0, 0, 0, 0}
+	port := C.uint16_t(0)
+
+	C.tcp_stream_remote_addr(s.context, (*C.uint8_t)(unsafe.Pointer(&ip[0])), &port)
+
+	return &net.TCPAddr{
+		IP:   ip,
+		Port: int(port),
+		Zone: "",
+	}
+}
+
+func (s *stream) Close() error {
+	C.tcp_stream_close(s.context)
+
+	s.set.remove(s)
+
+	return nil
+}
+
+func newStream(set *streamSet, context *C.tcp_stream_t) *stream {
+	s := &stream{set: set, context: context}
+
+	runtime.SetFinalizer(s, streamDestroy)
+
+	return s
+}
+
+func streamDestroy(s *stream) {
+	C.tcp_stream_free(s.context)
+}
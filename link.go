@@ -8,29 +8,113 @@ package tun2socket
 import "C"
 
 import (
+	"errors"
+	"io"
+	"net"
+	"os"
 	"runtime"
+	"syscall"
+	"time"
 	"unsafe"
 )
 
+const leaseSegments = 16
+
+// maxFrameSize is the largest packet WriteBatch takes, a 10 byte
+// virtio_net_hdr followed by a 64K packet.
+const maxFrameSize = 10 + 65535
+
+var ErrInvalidBatch = errors.New("invalid batch")
+
+type LinkFlags int
+
+const (
+	// LinkVnetHdr prefixes every packet with a 10 byte virtio_net_hdr, enabling
+	// checksum offload and tcp segmentation offload (packets up to 64K).
+	LinkVnetHdr LinkFlags = C.LINK_FLAG_VNET_HDR
+)
+
 type Link interface {
 	Read(buf []byte) (int, error)
 	Write(buf []byte) (int, error)
+	ReadBatch(buf []byte, sizes []int) (int, error)
+	WriteBatch(buf []byte, sizes []int) (int, error)
+	ReadLease() (*Lease, error)
+	SetQueuePolicy(direction QueueDirection, policy QueuePolicy, limit int, timeout time.Duration)
+	QueueStats(direction QueueDirection) QueueStats
 	Close() error
 }
 
+// Lease references a packet in native memory without copying it.
+// Buffers are only valid until Release is called.
+type Lease struct {
+	Buffers net.Buffers
+
+	release func()
+}
+
+func (l *Lease) Release() {
+	if l.release != nil {
+		l.release()
+
+		l.release = nil
+		l.Buffers = nil
+	}
+}
+
+func newLease(segments []C.segment_t, release func()) *Lease {
+	buffers := make(net.Buffers, len(segments))
+
+	for i := range buffers {
+		buffers[i] = unsafe.Slice((*byte)(segments[i].data), int(segments[i].length))
+	}
+
+	return &Lease{Buffers: buffers, release: release}
+}
+
 type link struct {
 	context *C.link_t
+
+	readable *os.File
+	raw      syscall.RawConn
 }
 
-func (l *link) Read(buf []byte) (int, error) {
-	n := C.link_read(l.context, unsafe.Pointer(&buf[:cap(buf)][0]), C.int(len(buf)))
-	if n < 0 {
+// wait runs read, which returns 0 while nothing is queued, until it succeeds.
+// It parks on the netpoller instead of blocking a thread inside native code
+// when the link has a readiness fd, blocking is only left to native code
+// without one.
+func (l *link) wait(read func(try bool) C.int) (int, error) {
+	var n C.int
+
+	if l.raw == nil {
+		n = read(false)
+	} else if err := l.raw.Read(func(uintptr) bool {
+		n = read(true)
+
+		return n != 0
+	}); err != nil {
+		return 0, ErrNative
+	}
+
+	if n == C.LINK_SHORT_BUFFER {
+		return 0, io.ErrShortBuffer
+	} else if n < 0 {
 		return 0, ErrNative
 	}
 
 	return int(n), nil
 }
 
+func (l *link) Read(buf []byte) (int, error) {
+	return l.wait(func(try bool) C.int {
+		if try {
+			return C.link_try_read(l.context, unsafe.Pointer(&buf[:cap(buf)][0]), C.int(len(buf)))
+		}
+
+		return C.link_read(l.context, unsafe.Pointer(&buf[:cap(buf)][0]), C.int(len(buf)))
+	})
+}
+
 func (l *link) Write(buf []byte) (int, error) {
 	n := C.link_write(l.context, unsafe.Pointer(&buf[:cap(buf)][0]), C.int(len(buf)))
 	if n < 0 {
@@ -40,23 +124,155 @@ func (l *link) Write(buf []byte) (int, error) {
 	return int(n), nil
 }
 
+func (l *link) ReadBatch(buf []byte, sizes []int) (int, error) {
+	if len(buf) == 0 || len(sizes) == 0 {
+		return 0, ErrInvalidBatch
+	}
+
+	lengths := make([]C.int, len(sizes))
+
+	n, err := l.wait(func(try bool) C.int {
+		if try {
+			return C.link_try_read_batch(l.context, unsafe.Pointer(&buf[:cap(buf)][0]), C.int(len(buf)), &lengths[0], C.int(len(lengths)))
+		}
+
+		return C.link_read_batch(l.context, unsafe.Pointer(&buf[:cap(buf)][0]), C.int(len(buf)), &lengths[0], C.int(len(lengths)))
+	})
+	if err != nil {
+		return 0, err
+	}
+
+	for i := 0; i < n; i++ {
+		sizes[i] = int(lengths[i])
+	}
+
+	return n, nil
+}
+
+func (l *link) WriteBatch(buf []byte, sizes []int) (int, error) {
+	if len(sizes) == 0 {
+		return 0, ErrInvalidBatch
+	}
+
+	lengths := make([]C.int, len(sizes))
+	total := 0
+
+	// native code reads the packets back to back out of buf
+	for i, size := range sizes {
+		if size <= 0 || size > maxFrameSize {
+			return 0, ErrInvalidBatch
+		}
+
+		total += size
+		lengths[i] = C.int(size)
+	}
+
+	if total > len(buf) {
+		return 0, ErrInvalidBatch
+	}
+
+	// a short count means a packet could not be queued, the ones before it were
+	n := C.link_write_batch(l.context, unsafe.Pointer(&buf[:cap(buf)][0]), &lengths[0], C.int(len(lengths)))
+	if n < 0 {
+		return 0, ErrNative
+	} else if int(n) < len(sizes) {
+		return int(n), ErrNative
+	}
+
+	return int(n), nil
+}
+
+func (l *link) ReadLease() (*Lease, error) {
+	var segments [leaseSegments]C.segment_t
+	var context *C.link_lease_t
+
+	n, err := l.wait(func(try bool) C.int {
+		if try {
+			return C.link_try_read_lease(l.context, &segments[0], C.int(len(segments)), &context)
+		}
+
+		return C.link_read_lease(l.context, &segments[0], C.int(len(segments)), &context)
+	})
+	if err != nil {
+		return nil, err
+	}
+
+	return newLease(segments[:n], func() {
+		C.link_release(context)
+	}), nil
+}
+
+func (l *link) SetQueuePolicy(direction QueueDirection, policy QueuePolicy, limit int, timeout time.Duration) {
+	C.link_set_queue_policy(l.context, C.queue_direction_t(direction), C.queue_policy_t(policy), C.int(limit), timeoutMillis(timeout))
+}
+
+func (l *link) QueueStats(direction QueueDirection) QueueStats {
+	stats := C.queue_stats_t{}
+
+	C.link_queue_stats(l.context, C.queue_direction_t(direction), &stats)
+
+	return newQueueStats(&stats)
+}
+
 func (l *link) Close() error {
 	C.link_close(l.context)
 
+	if l.readable != nil {
+		_ = l.readable.Close()
+	}
+
 	return nil
 }
 
 func NewLink(mtu int) (Link, error) {
-	context := C.link_attach(C.int(mtu))
+	return NewLinkWithFlags(mtu, 0)
+}
+
+func NewLinkWithFlags(mtu int, flags LinkFlags) (Link, error) {
+	context := C.link_attach(C.int(mtu), C.int(flags))
 	if context == nil {
 		return nil, ErrNative
 	}
 
+	return newLink(context), nil
+}
+
+// AttachLink attaches fd (a TUN device) to the stack. Packets are read from
+// and written to fd by native threads, so Read/Write on the returned Link fail.
+func AttachLink(fd int, mtu int) (Link, error) {
+	return AttachLinkWithFlags(fd, mtu, 0)
+}
+
+func AttachLinkWithFlags(fd int, mtu int, flags LinkFlags) (Link, error) {
+	context := C.link_attach_fd(C.int(fd), C.int(mtu), C.int(flags))
+	if context == nil {
+		return nil, ErrNative
+	}
+
+	return newLink(context), nil
+}
+
+func newLink(context *C.link_t) *link {
 	l := &link{context: context}
 
+	if fd := int(C.link_readable_fd(context)); fd >= 0 {
+		if dup, err := syscall.Dup(fd); err == nil {
+			syscall.CloseOnExec(dup)
+
+			readable := os.NewFile(uintptr(dup), "link")
+
+			if raw, err := readable.SyscallConn(); err == nil {
+				l.readable = readable
+				l.raw = raw
+			} else {
+				_ = readable.Close()
+			}
+		}
+	}
+
 	runtime.SetFinalizer(l, linkDestroy)
 
-	return l, nil
+	return l
 }
 
 func linkDestroy(l *link) {
@@ -104,6 +104,8 @@
 #endif /* LWIP_NETCONN_FULLDUPLEX */
 
 static err_t netconn_close_shutdown(struct netconn *conn, u8_t how);
+static err_t netconn_write_vectors(struct netconn *conn, struct netvector *vectors, u16_t vectorcnt,
+                                   u8_t apiflags, void *ref, size_t *bytes_written);
 
 /**
  * Call the lower part of a netconn_* function
@@ -458,6 +460,7 @@ netconn_listen_with_backlog(struct netconn *conn, u8_t backlog)
 #endif /* LWIP_TCP */
 }
 
+#if LWIP_NETCONN_ACCEPT_BATCH
 /**
  * @ingroup netconn_tcp
  * Accept a new connection on a TCP listening netconn.
@@ -469,6 +472,37 @@ netconn_listen_with_backlog(struct netconn *conn, u8_t backlog)
  */
 err_t
 netconn_accept(struct netconn *conn, struct netconn **new_conn)
+{
+  return netconn_accept_flags(conn, new_conn, 0);
+}
+
+/**
+ * @ingroup netconn_tcp
+ * Accept a new connection on a TCP listening netconn, see netconn_accept.
+ *
+ * @param conn the TCP listen netconn
+ * @param new_conn pointer where the new connection is stored
+ * @param apiflags flags that control function behaviour. For now only:
+ * - NETCONN_DONTBLOCK: only accept a connection that is pending now
+ * @return ERR_OK if a new connection has been received or an error
+ *                code otherwise
+ *         ERR_WOULDBLOCK if NETCONN_DONTBLOCK is set and no connection is pending
+ */
+err_t
+netconn_accept_flags(struct netconn *conn, struct netconn **new_conn, u8_t apiflags)
+#else /* LWIP_NETCONN_ACCEPT_BATCH */
+/**
+ * @ingroup netconn_tcp
+ * Accept a new connection on a TCP listening netconn.
+ *
+ * @param conn the TCP listen netconn
+ * @param new_conn pointer where the new connection is stored
+ * @return ERR_OK if a new connection has been received or an error
+ *                code otherwise
+ */
+err_t
+netconn_accept(struct netconn *conn, struct netconn **new_conn)
+#endif /* LWIP_NETCONN_ACCEPT_BATCH */
 {
 #if LWIP_TCP
   err_t err;
@@ -499,7 +533,11 @@ netconn_accept(struct netconn *conn, struct netconn **new_conn)
   API_MSG_VAR_ALLOC_ACCEPT(msg);
 
   NETCONN_MBOX_WAITING_INC(conn);
+#if LWIP_NETCONN_ACCEPT_BATCH
+  if (netconn_is_nonblocking(conn) || (apiflags & NETCONN_DONTBLOCK)) {
+#else /* LWIP_NETCONN_ACCEPT_BATCH */
   if (netconn_is_nonblocking(conn)) {
+#endif /* LWIP_NETCONN_ACCEPT_BATCH */
     if (sys_arch_mbox_tryfetch(&conn->acceptmbox, &accept_ptr) == SYS_ARCH_TIMEOUT) {
       API_MSG_VAR_FREE_ACCEPT(msg);
       NETCONN_MBOX_WAITING_DEC(conn);
@@ -555,6 +593,9 @@ netconn_accept(struct netconn *conn, struct netconn **new_conn)
 #else /* LWIP_TCP */
   LWIP_UNUSED_ARG(conn);
   LWIP_UNUSED_ARG(new_conn);
+#if LWIP_NETCONN_ACCEPT_BATCH
+  LWIP_UNUSED_ARG(apiflags);
+#endif /* LWIP_NETCONN_ACCEPT_BATCH */
   return ERR_ARG;
 #endif /* LWIP_TCP */
 }
@@ -644,6 +685,20 @@ netconn_recv_data(struct netconn *conn, void **new_buf, u8_t apiflags)
         /* connection closed translates to ERR_OK with *new_buf == NULL */
         return ERR_OK;
       }
+#if LWIP_SO_RCVTIMEO
+      if (err == ERR_TIMEOUT) {
+        /* a wakeup from lwip_netconn_wake_recv, skip it when it has been cleared */
+        u8_t stale;
+        SYS_ARCH_DECL_PROTECT(lev);
+        SYS_ARCH_PROTECT(lev);
+        stale = !conn->recv_wakeup;
+        conn->recv_wakeup = 0;
+        SYS_ARCH_UNPROTECT(lev);
+        if (stale) {
+          return netconn_recv_data(conn, new_buf, apiflags);
+        }
+      }
+#endif /* LWIP_SO_RCVTIMEO */
       return err;
     }
     len = ((struct pbuf *)buf)->tot_len;
@@ -996,6 +1051,37 @@ netconn_write_partly(struct netconn *conn, const void *dataptr, size_t size,
 err_t
 netconn_write_vectors_partly(struct netconn *conn, struct netvector *vectors, u16_t vectorcnt,
                              u8_t apiflags, size_t *bytes_written)
+{
+  return netconn_write_vectors(conn, vectors, vectorcnt, apiflags, NULL, bytes_written);
+}
+
+#if LWIP_TCP_WRITE_REF
+/**
+ * @ingroup netconn_tcp
+ * Send data over a TCP netconn without copying it. Every pbuf queued for the
+ * data comes from LWIP_HOOK_TCP_WRITE_REF, which is handed 'ref'.
+ *
+ * @param conn the TCP netconn over which to send data
+ * @param dataptr pointer to the application buffer that contains the data to send
+ * @param size size of the application data to send
+ * @param ref passed to LWIP_HOOK_TCP_WRITE_REF for each pbuf referencing the data
+ * @param bytes_written pointer to a location that receives the number of written bytes
+ * @return ERR_OK if data was sent, any other err_t on error
+ */
+err_t
+netconn_write_ref_partly(struct netconn *conn, const void *dataptr, size_t size,
+                         void *ref, size_t *bytes_written)
+{
+  struct netvector vector;
+  vector.ptr = dataptr;
+  vector.len = size;
+  return netconn_write_vectors(conn, &vector, 1, TCP_WRITE_FLAG_REF, ref, bytes_written);
+}
+#endif /* LWIP_TCP_WRITE_REF */
+
+static err_t
+netconn_write_vectors(struct netconn *conn, struct netvector *vectors, u16_t vectorcnt,
+                      u8_t apiflags, void *ref, size_t *bytes_written)
 {
   API_MSG_VAR_DECLARE(msg);
   err_t err;
@@ -1048,6 +1134,11 @@ netconn_write_vectors_partly(struct netconn *conn, struct netvector *vectors, u1
   API_MSG_VAR_REF(msg).msg.w.apiflags = apiflags;
   API_MSG_VAR_REF(msg).msg.w.len = size;
   API_MSG_VAR_REF(msg).msg.w.offset = 0;
+#if LWIP_TCP_WRITE_REF
+  API_MSG_VAR_REF(msg).msg.w.ref = ref;
+#else /* LWIP_TCP_WRITE_REF */
+  LWIP_UNUSED_ARG(ref);
+#endif /* LWIP_TCP_WRITE_REF */
 #if LWIP_SO_SNDTIMEO
   if (conn->send_timeout != 0) {
     /* get the time we started, which is later compared to
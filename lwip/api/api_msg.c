@@ -65,6 +65,14 @@
   netconn_clear_flags(conn, NETCONN_FLAG_IN_NONBLOCKING_CONNECT); }} while(0)
 #define IN_NONBLOCKING_CONNECT(conn) netconn_is_flag_set(conn, NETCONN_FLAG_IN_NONBLOCKING_CONNECT)
 
+/* Writable again once below the low-water limits. A nonblocking write that
+   came up short is told as soon as there is any room, TCP_SNDQUEUELOWAT may
+   be 0 and the queue limit grows with the send buffer. */
+#define NETCONN_TCP_WRITABLE(conn) ((tcp_sndbuf((conn)->pcb.tcp) > TCP_SNDLOWAT) && \
+  ((tcp_sndqueuelen((conn)->pcb.tcp) < TCP_SNDQUEUELOWAT) || \
+   (netconn_is_flag_set(conn, NETCONN_FLAG_CHECK_WRITESPACE) && \
+    (tcp_sndqueuelen((conn)->pcb.tcp) < TCP_SND_QUEUELEN_MAX((conn)->pcb.tcp)))))
+
 #if LWIP_NETCONN_FULLDUPLEX
 #define NETCONN_MBOX_VALID(conn, mbox) (sys_mbox_valid(mbox) && ((conn->flags & NETCONN_FLAG_MBOXINVALID) == 0))
 #else
@@ -82,9 +90,14 @@
 #endif /* LWIP_TCPIP_CORE_LOCKING */
 static err_t lwip_netconn_do_writemore(struct netconn *conn  WRITE_DELAYED_PARAM);
 static err_t lwip_netconn_do_close_internal(struct netconn *conn  WRITE_DELAYED_PARAM);
+static void netconn_tcp_poll_update(struct netconn *conn);
 #endif
 
 static void netconn_drain(struct netconn *conn);
+#if LWIP_TCP && LWIP_NETCONN_DEFER_ACCEPT
+static err_t accept_post(struct netconn *conn, struct netconn *newconn);
+static err_t accept_deferred(struct netconn *newconn);
+#endif /* LWIP_TCP && LWIP_NETCONN_DEFER_ACCEPT */
 
 #if LWIP_TCPIP_CORE_LOCKING
 #define TCPIP_APIMSG_ACK(m)
@@ -109,6 +122,9 @@ lwip_netconn_is_deallocated_msg(void *msg)
 const u8_t netconn_aborted = 0;
 const u8_t netconn_reset = 0;
 const u8_t netconn_closed = 0;
+#if LWIP_SO_RCVTIMEO
+const u8_t netconn_timedout = 0;
+#endif /* LWIP_SO_RCVTIMEO */
 
 /** Translate an error to a unique void* passed via an mbox */
 static void *
@@ -121,6 +137,10 @@ lwip_netconn_err_to_msg(err_t err)
       return LWIP_CONST_CAST(void *, &netconn_reset);
     case ERR_CLSD:
       return LWIP_CONST_CAST(void *, &netconn_closed);
+#if LWIP_SO_RCVTIMEO
+    case ERR_TIMEOUT:
+      return LWIP_CONST_CAST(void *, &netconn_timedout);
+#endif /* LWIP_SO_RCVTIMEO */
     default:
       LWIP_ASSERT("unhandled error", err == ERR_OK);
       return NULL;
@@ -141,9 +161,72 @@ lwip_netconn_is_err_msg(void *msg, err_t *err)
   } else if (msg == &netconn_closed) {
     *err = ERR_CLSD;
     return 1;
+#if LWIP_SO_RCVTIMEO
+  } else if (msg == &netconn_timedout) {
+    *err = ERR_TIMEOUT;
+    return 1;
+#endif /* LWIP_SO_RCVTIMEO */
   }
   return 0;
 }
+
+#if LWIP_SO_RCVTIMEO
+/**
+ * Make a receiver blocked on a TCP netconn return ERR_TIMEOUT early, e.g.
+ * after its deadline moved. Called with the core locked.
+ */
+err_t
+lwip_netconn_wake_recv(struct netconn *conn)
+{
+  err_t err = ERR_OK;
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  if (!sys_mbox_valid(&conn->recvmbox) || (conn->flags & NETCONN_FLAG_MBOXINVALID)) {
+    return ERR_CONN;
+  }
+  SYS_ARCH_PROTECT(lev);
+  /* at most one wakeup is queued at a time */
+  if (!conn->recv_wakeup) {
+    err = sys_mbox_trypost(&conn->recvmbox, lwip_netconn_err_to_msg(ERR_TIMEOUT));
+    if (err == ERR_OK) {
+      conn->recv_wakeup = 1;
+    }
+  }
+  SYS_ARCH_UNPROTECT(lev);
+  return err;
+}
+
+/**
+ * Mark a wakeup queued by lwip_netconn_wake_recv as stale once no receiver
+ * waits for it anymore, the next receiver skips it. Called with the core locked.
+ */
+void
+lwip_netconn_clear_wakeup(struct netconn *conn)
+{
+  SYS_ARCH_DECL_PROTECT(lev);
+
+  SYS_ARCH_PROTECT(lev);
+  conn->recv_wakeup = 0;
+  SYS_ARCH_UNPROTECT(lev);
+}
+#endif /* LWIP_SO_RCVTIMEO */
+#if LWIP_SO_SNDTIMEO
+/**
+ * Let a blocked writer check its send timeout now instead of on the next sent
+ * or poll callback. Called with the core locked.
+ *
+ * @return 1 while the write is still pending, 0 otherwise
+ */
+int
+lwip_netconn_check_write(struct netconn *conn)
+{
+  if (conn->state != NETCONN_WRITE) {
+    return 0;
+  }
+  lwip_netconn_do_writemore(conn  WRITE_DELAYED);
+  return conn->state == NETCONN_WRITE;
+}
+#endif /* LWIP_SO_SNDTIMEO */
 #endif /* LWIP_TCP */
 
 
@@ -283,6 +366,30 @@ recv_udp(void *arg, struct udp_pcb *pcb, struct pbuf *p,
 #endif /* LWIP_UDP */
 
 #if LWIP_TCP
+#if LWIP_NETCONN_DEFER_ACCEPT
+/** Remove a netconn from the connections its listener holds back */
+static void
+netconn_defer_unlink(struct netconn *conn)
+{
+  *conn->defer_pprev = conn->defer_next;
+  if (conn->defer_next != NULL) {
+    conn->defer_next->defer_pprev = conn->defer_pprev;
+  }
+  conn->defer_listener = NULL;
+  conn->defer_next = NULL;
+  conn->defer_pprev = NULL;
+}
+
+/** Abort the connections a listener holds back, err_tcp unlinks and frees each one */
+static void
+netconn_defer_abort(struct netconn *conn)
+{
+  while (conn->deferred != NULL) {
+    tcp_abort(conn->deferred->pcb.tcp);
+  }
+}
+#endif /* LWIP_NETCONN_DEFER_ACCEPT */
+
 /**
  * Receive callback function for TCP netconns.
  * Posts the packet to conn->recvmbox, but doesn't delete it on errors.
@@ -308,6 +415,16 @@ recv_tcp(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
   }
   LWIP_ASSERT("recv_tcp: recv for wrong pcb!", conn->pcb.tcp == pcb);
 
+#if LWIP_NETCONN_DEFER_ACCEPT
+  /* first data or FIN: let the application accept the connection now */
+  if ((conn->defer_listener != NULL) && (accept_deferred(conn) != ERR_OK)) {
+    if (p != NULL) {
+      pbuf_free(p);
+    }
+    return ERR_ABRT;
+  }
+#endif /* LWIP_NETCONN_DEFER_ACCEPT */
+
   if (!NETCONN_MBOX_VALID(conn, &conn->recvmbox)) {
     /* recvmbox already deleted */
     if (p != NULL) {
@@ -361,6 +478,16 @@ poll_tcp(void *arg, struct tcp_pcb *pcb)
   LWIP_UNUSED_ARG(pcb);
   LWIP_ASSERT("conn != NULL", (conn != NULL));
 
+#if LWIP_NETCONN_DEFER_ACCEPT
+  if (conn->defer_listener != NULL) {
+    /* no data within the timeout, post the connection anyway */
+    if ((s32_t)(sys_now() - conn->defer_deadline) >= 0) {
+      return accept_deferred(conn);
+    }
+    return ERR_OK;
+  }
+#endif /* LWIP_NETCONN_DEFER_ACCEPT */
+
   if (conn->state == NETCONN_WRITE) {
     lwip_netconn_do_writemore(conn  WRITE_DELAYED);
   } else if (conn->state == NETCONN_CLOSE) {
@@ -377,12 +504,12 @@ poll_tcp(void *arg, struct tcp_pcb *pcb)
   if (conn->flags & NETCONN_FLAG_CHECK_WRITESPACE) {
     /* If the queued byte- or pbuf-count drops below the configured low-water limit,
        let select mark this pcb as writable again. */
-    if ((conn->pcb.tcp != NULL) && (tcp_sndbuf(conn->pcb.tcp) > TCP_SNDLOWAT) &&
-        (tcp_sndqueuelen(conn->pcb.tcp) < TCP_SNDQUEUELOWAT)) {
+    if ((conn->pcb.tcp != NULL) && NETCONN_TCP_WRITABLE(conn)) {
       netconn_clear_flags(conn, NETCONN_FLAG_CHECK_WRITESPACE);
       API_EVENT(conn, NETCONN_EVT_SENDPLUS, 0);
     }
   }
+  netconn_tcp_poll_update(conn);
 
   return ERR_OK;
 }
@@ -411,16 +538,48 @@ sent_tcp(void *arg, struct tcp_pcb *pcb, u16_t len)
 
     /* If the queued byte- or pbuf-count drops below the configured low-water limit,
        let select mark this pcb as writable again. */
-    if ((conn->pcb.tcp != NULL) && (tcp_sndbuf(conn->pcb.tcp) > TCP_SNDLOWAT) &&
-        (tcp_sndqueuelen(conn->pcb.tcp) < TCP_SNDQUEUELOWAT)) {
+    if ((conn->pcb.tcp != NULL) && NETCONN_TCP_WRITABLE(conn)) {
       netconn_clear_flags(conn, NETCONN_FLAG_CHECK_WRITESPACE);
       API_EVENT(conn, NETCONN_EVT_SENDPLUS, len);
     }
+    netconn_tcp_poll_update(conn);
   }
 
   return ERR_OK;
 }
 
+/**
+ * Register poll_tcp only while it has work: a write or close waiting for
+ * memory or a timeout, a nonblocking writer waiting for space or a deferred
+ * accept. Without a poll callback an idle pcb stays on the timer wheel until
+ * one of its own timers comes due.
+ *
+ * @param conn the TCP netconn whose state just changed
+ */
+static void
+netconn_tcp_poll_update(struct netconn *conn)
+{
+  struct tcp_pcb *pcb = conn->pcb.tcp;
+  u8_t busy;
+
+  if ((pcb == NULL) || (pcb->state == LISTEN)) {
+    return;
+  }
+  busy = (conn->state == NETCONN_WRITE) || (conn->state == NETCONN_CLOSE) ||
+         netconn_is_flag_set(conn, NETCONN_FLAG_CHECK_WRITESPACE);
+#if LWIP_NETCONN_DEFER_ACCEPT
+  busy = busy || (conn->defer_listener != NULL);
+#endif /* LWIP_NETCONN_DEFER_ACCEPT */
+  if (busy) {
+    /* a closing netconn keeps the interval lwip_netconn_do_close_internal set */
+    if (pcb->poll != poll_tcp) {
+      tcp_poll(pcb, poll_tcp, NETCONN_TCP_POLL_INTERVAL);
+    }
+  } else if (pcb->poll != NULL) {
+    tcp_poll(pcb, NULL, 0);
+  }
+}
+
 /**
  * Error callback function for TCP netconns.
  * Signals conn->sem, posts to all conn mboxes and calls API_EVENT.
@@ -439,6 +598,21 @@ err_tcp(void *arg, err_t err)
   conn = (struct netconn *)arg;
   LWIP_ASSERT("conn != NULL", (conn != NULL));
 
+#if LWIP_NETCONN_DEFER_ACCEPT
+  if (conn->defer_listener != NULL) {
+    /* gone before the application knew of it: nothing to report */
+    netconn_defer_unlink(conn);
+    conn->pcb.tcp = NULL;
+    sys_mbox_free(&conn->recvmbox);
+    sys_mbox_set_invalid(&conn->recvmbox);
+#if LWIP_NETCONN_FULLDUPLEX
+    conn->flags |= NETCONN_FLAG_MBOXINVALID;
+#endif /* LWIP_NETCONN_FULLDUPLEX */
+    netconn_free(conn);
+    return;
+  }
+#endif /* LWIP_NETCONN_DEFER_ACCEPT */
+
   SYS_ARCH_PROTECT(lev);
 
   /* when err is called, the pcb is deallocated, so delete the reference */
@@ -519,7 +693,7 @@ setup_tcp(struct netconn *conn)
   tcp_arg(pcb, conn);
   tcp_recv(pcb, recv_tcp);
   tcp_sent(pcb, sent_tcp);
-  tcp_poll(pcb, poll_tcp, NETCONN_TCP_POLL_INTERVAL);
+  /* poll_tcp is registered by netconn_tcp_poll_update once there is work */
   tcp_err(pcb, err_tcp);
 }
 
@@ -569,9 +743,43 @@ accept_function(void *arg, struct tcp_pcb *newpcb, err_t err)
   }
   newconn->pcb.tcp = newpcb;
   setup_tcp(newconn);
+#if LWIP_NETCONN_ACCEPT_BATCH
+  ip_addr_copy(newconn->local_ip, newpcb->local_ip);
+  ip_addr_copy(newconn->remote_ip, newpcb->remote_ip);
+  newconn->local_port = newpcb->local_port;
+  newconn->remote_port = newpcb->remote_port;
+#endif /* LWIP_NETCONN_ACCEPT_BATCH */
+
+#if LWIP_NETCONN_DEFER_ACCEPT
+  if (conn->defer_accept != 0) {
+    /* hold the connection back until its first data or the timeout,
+       it counts against the backlog like one waiting in the acceptmbox */
+    tcp_backlog_delayed(newpcb);
+    newconn->defer_listener = conn;
+    newconn->defer_deadline = sys_now() + conn->defer_accept;
+    newconn->defer_next = conn->deferred;
+    if (conn->deferred != NULL) {
+      conn->deferred->defer_pprev = &newconn->defer_next;
+    }
+    newconn->defer_pprev = &conn->deferred;
+    conn->deferred = newconn;
+    netconn_tcp_poll_update(newconn);
+    return ERR_OK;
+  }
 
+  return accept_post(conn, newconn);
+}
+
+/**
+ * Post an accepted netconn to conn->acceptmbox.
+ * On failure the netconn is freed and the pcb left for the caller to abort.
+ */
+static err_t
+accept_post(struct netconn *conn, struct netconn *newconn)
+{
+#endif /* LWIP_NETCONN_DEFER_ACCEPT */
   /* handle backlog counter */
-  tcp_backlog_delayed(newpcb);
+  tcp_backlog_delayed(newconn->pcb.tcp);
 
   if (sys_mbox_trypost(&conn->acceptmbox, newconn) != ERR_OK) {
     /* When returning != ERR_OK, the pcb is aborted in tcp_process(),
@@ -588,6 +796,9 @@ accept_function(void *arg, struct tcp_pcb *newpcb, err_t err)
     /* no need to drain since we know the recvmbox is empty. */
     sys_mbox_free(&newconn->recvmbox);
     sys_mbox_set_invalid(&newconn->recvmbox);
+#if LWIP_NETCONN_FULLDUPLEX
+    newconn->flags |= NETCONN_FLAG_MBOXINVALID;
+#endif /* LWIP_NETCONN_FULLDUPLEX */
     netconn_free(newconn);
     return ERR_MEM;
   } else {
@@ -597,6 +808,35 @@ accept_function(void *arg, struct tcp_pcb *newpcb, err_t err)
 
   return ERR_OK;
 }
+
+#if LWIP_NETCONN_DEFER_ACCEPT
+/**
+ * Post a netconn held back by accept_function to its listener.
+ * Aborts the pcb if that fails.
+ */
+static err_t
+accept_deferred(struct netconn *newconn)
+{
+  struct netconn *conn = newconn->defer_listener;
+  struct tcp_pcb *pcb = newconn->pcb.tcp;
+
+  if (!NETCONN_MBOX_VALID(conn, &conn->acceptmbox)) {
+    /* listener closing: err_tcp unlinks and frees newconn */
+    tcp_abort(pcb);
+    return ERR_ABRT;
+  }
+
+  netconn_defer_unlink(newconn);
+
+  if (accept_post(conn, newconn) != ERR_OK) {
+    /* newconn is freed and detached from the pcb */
+    tcp_abort(pcb);
+    return ERR_ABRT;
+  }
+  netconn_tcp_poll_update(newconn);
+  return ERR_OK;
+}
+#endif /* LWIP_NETCONN_DEFER_ACCEPT */
 #endif /* LWIP_TCP */
 
 /**
@@ -765,6 +1005,16 @@ netconn_alloc(enum netconn_type t, netconn_callback callback)
   conn->socket       = -1;
 #endif /* LWIP_SOCKET */
   conn->callback     = callback;
+#if LWIP_NETCONN_CALLBACK_ARG
+  conn->callback_arg = NULL;
+#endif /* LWIP_NETCONN_CALLBACK_ARG */
+#if LWIP_NETCONN_DEFER_ACCEPT
+  conn->defer_accept = 0;
+  conn->deferred = NULL;
+  conn->defer_listener = NULL;
+  conn->defer_next = NULL;
+  conn->defer_pprev = NULL;
+#endif /* LWIP_NETCONN_DEFER_ACCEPT */
 #if LWIP_TCP
   conn->current_msg  = NULL;
 #endif /* LWIP_TCP */
@@ -773,6 +1023,7 @@ netconn_alloc(enum netconn_type t, netconn_callback callback)
 #endif /* LWIP_SO_SNDTIMEO */
 #if LWIP_SO_RCVTIMEO
   conn->recv_timeout = 0;
+  conn->recv_wakeup = 0;
 #endif /* LWIP_SO_RCVTIMEO */
 #if LWIP_SO_RCVBUF
   conn->recv_bufsize = RECV_BUFSIZE_DEFAULT;
@@ -1078,6 +1329,7 @@ lwip_netconn_do_close_internal(struct netconn *conn  WRITE_DELAYED_PARAM)
         API_EVENT(conn, NETCONN_EVT_SENDPLUS, 0);
       }
     }
+    netconn_tcp_poll_update(conn);
 #if LWIP_TCPIP_CORE_LOCKING
     if (delayed)
 #endif
@@ -1156,6 +1408,10 @@ lwip_netconn_do_delconn(void *m)
 #else /* LWIP_NETCONN_FULLDUPLEX */
     netconn_drain(msg->conn);
 #endif /* LWIP_NETCONN_FULLDUPLEX */
+#if LWIP_TCP && LWIP_NETCONN_DEFER_ACCEPT
+    /* connections held back for their first data go with the listener */
+    netconn_defer_abort(msg->conn);
+#endif /* LWIP_TCP && LWIP_NETCONN_DEFER_ACCEPT */
 
     if (msg->conn->pcb.tcp != NULL) {
 
@@ -1687,6 +1943,16 @@ lwip_netconn_do_writemore(struct netconn *conn  WRITE_DELAYED_PARAM)
         len = (u16_t)diff;
       }
       available = tcp_sndbuf(conn->pcb.tcp);
+#if LWIP_TCP_WRITE_REF
+      if (apiflags & TCP_WRITE_FLAG_REF) {
+        /* referenced segments take a header and a data pbuf each, stay within the queue limit */
+        u16_t queue_left = (u16_t)(TCP_SND_QUEUELEN_MAX(conn->pcb.tcp) - tcp_sndqueuelen(conn->pcb.tcp));
+        u32_t queue_available = (queue_left > 1) ? (u32_t)((queue_left - 1) / 2) * tcp_mss(conn->pcb.tcp) : 0;
+        if (queue_available < available) {
+          available = (u16_t)queue_available;
+        }
+      }
+#endif /* LWIP_TCP_WRITE_REF */
       if (available < len) {
         /* don't try to write more than sendbuf */
         len = available;
@@ -1713,7 +1979,13 @@ lwip_netconn_do_writemore(struct netconn *conn  WRITE_DELAYED_PARAM)
       } else {
         write_more = 0;
       }
+#if LWIP_TCP_WRITE_REF
+      conn->pcb.tcp->write_ref = conn->current_msg->msg.w.ref;
+#endif /* LWIP_TCP_WRITE_REF */
       err = tcp_write(conn->pcb.tcp, dataptr, len, apiflags);
+#if LWIP_TCP_WRITE_REF
+      conn->pcb.tcp->write_ref = NULL;
+#endif /* LWIP_TCP_WRITE_REF */
       if (err == ERR_OK) {
         conn->current_msg->msg.w.offset += len;
         conn->current_msg->msg.w.vector_off += len;
@@ -1798,8 +2070,11 @@ err_mem:
       sys_sem_signal(op_completed_sem);
     }
   }
+  /* poll_tcp resumes a write waiting for memory and checks the space a short
+     nonblocking write waits for */
+  netconn_tcp_poll_update(conn);
 #if LWIP_TCPIP_CORE_LOCKING
-  else {
+  if (!write_finished) {
     return ERR_MEM;
   }
 #endif
@@ -1941,6 +2216,12 @@ lwip_netconn_do_close(void *m)
 
 #if LWIP_TCP
   enum netconn_state state = msg->conn->state;
+#if LWIP_NETCONN_DEFER_ACCEPT
+  if ((state == NETCONN_LISTEN) && (msg->msg.sd.shut == NETCONN_SHUT_RDWR)) {
+    /* the acceptmbox goes now, the connections held back for it with it */
+    netconn_defer_abort(msg->conn);
+  }
+#endif /* LWIP_NETCONN_DEFER_ACCEPT */
   /* First check if this is a TCP netconn and if it is in a correct state
       (LISTEN doesn't support half shutdown) */
   if ((msg->conn->pcb.tcp != NULL) &&
@@ -146,10 +146,16 @@ PACK_STRUCT_END
 #if (LWIP_TCP && ((TCP_WND >> TCP_RCV_SCALE) == 0))
 #error "TCP_WND is too small for the configured LWIP_WND_SCALE (results in zero window)!"
 #endif
+#if (LWIP_TCP && LWIP_TCP_BUFFERS && (TCP_RCV_BUF_MAX > (0xFFFFU << TCP_RCV_SCALE)))
+#error "TCP_RCV_BUF_MAX is bigger than the configured LWIP_WND_SCALE allows!"
+#endif
 #else /* LWIP_WND_SCALE */
 #if (LWIP_TCP && (TCP_WND > 0xffff))
 #error "If you want to use TCP, TCP_WND must fit in an u16_t, so, you have to reduce it in your lwipopts.h (or enable window scaling)"
 #endif
+#if (LWIP_TCP && LWIP_TCP_BUFFERS)
+#error "LWIP_TCP_BUFFERS needs LWIP_WND_SCALE"
+#endif
 #endif /* LWIP_WND_SCALE */
 #if (LWIP_TCP && (TCP_SND_QUEUELEN > 0xffff))
 #error "If you want to use TCP, TCP_SND_QUEUELEN must fit in an u16_t, so, you have to reduce it in your lwipopts.h"
@@ -305,7 +311,11 @@ PACK_STRUCT_END
 #if TCP_SNDLOWAT >= TCP_SND_BUF
 #error "lwip_sanity_check: WARNING: TCP_SNDLOWAT must be less than TCP_SND_BUF. If you know what you are doing, define LWIP_DISABLE_TCP_SANITY_CHECKS to 1 to disable this error."
 #endif
-#if TCP_SNDLOWAT >= (0xFFFF - (4 * TCP_MSS))
+#if LWIP_JUMBO_MTU
+#if TCP_SNDLOWAT != 0
+#error "lwip_sanity_check: WARNING: TCP_SNDLOWAT must be 0 with LWIP_JUMBO_MTU, there is no room for 4*MSS below u16_t overflow!"
+#endif
+#elif TCP_SNDLOWAT >= (0xFFFF - (4 * TCP_MSS))
 #error "lwip_sanity_check: WARNING: TCP_SNDLOWAT must at least be 4*MSS below u16_t overflow!"
 #endif
 #if TCP_SNDQUEUELOWAT >= TCP_SND_QUEUELEN
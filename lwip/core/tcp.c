@@ -111,6 +111,8 @@
 #include "lwip/ip6.h"
 #include "lwip/ip6_addr.h"
 #include "lwip/nd6.h"
+#include "lwip/priv/pcb_hash.h"
+#include "lwip/sys.h"
 
 #include <string.h>
 
@@ -190,6 +192,10 @@ static u8_t tcp_timer_ctr;
 static u16_t tcp_new_port(void);
 
 static err_t tcp_close_shutdown_fin(struct tcp_pcb *pcb);
+#if LWIP_TCP_BUFFERS
+/* Sum of rcv_buf over all pcbs, autotuning backs off above TCP_RCV_BUF_BUDGET */
+static u64_t tcp_rcv_buf_total;
+#endif /* LWIP_TCP_BUFFERS */
 #if LWIP_TCP_PCB_NUM_EXT_ARGS
 static void tcp_ext_arg_invoke_callbacks_destroyed(struct tcp_pcb_ext_args *ext_args);
 #endif
@@ -203,6 +209,9 @@ tcp_init(void)
 #ifdef LWIP_RAND
   tcp_port = TCP_ENSURE_LOCAL_PORT_RANGE(LWIP_RAND());
 #endif /* LWIP_RAND */
+#if LWIP_TCP_SYN_COOKIES
+  tcp_syncookie_init();
+#endif /* LWIP_TCP_SYN_COOKIES */
 }
 
 /** Free a tcp pcb */
@@ -210,6 +219,12 @@ void
 tcp_free(struct tcp_pcb *pcb)
 {
   LWIP_ASSERT("tcp_free: LISTEN", pcb->state != LISTEN);
+#if LWIP_TCP_TIMER_WHEEL
+  tcp_timer_remove(pcb);
+#endif /* LWIP_TCP_TIMER_WHEEL */
+#if LWIP_TCP_BUFFERS
+  tcp_rcv_buf_total -= pcb->rcv_buf;
+#endif /* LWIP_TCP_BUFFERS */
 #if LWIP_TCP_PCB_NUM_EXT_ARGS
   tcp_ext_arg_invoke_callbacks_destroyed(pcb->ext_args);
 #endif
@@ -491,6 +506,7 @@ tcp_close(struct tcp_pcb *pcb)
   tcp_debug_print_state(pcb->state);
 
   if (pcb->state != LISTEN) {
+    TCP_TIMER_TOUCH(pcb);
     /* Set a flag not to receive any more data... */
     tcp_set_flags(pcb, TF_RXCLOSED);
   }
@@ -521,6 +537,7 @@ tcp_shutdown(struct tcp_pcb *pcb, int shut_rx, int shut_tx)
   if (pcb->state == LISTEN) {
     return ERR_CONN;
   }
+  TCP_TIMER_TOUCH(pcb);
   if (shut_rx) {
     /* shut down the receive side: set a flag not to receive any more data... */
     tcp_set_flags(pcb, TF_RXCLOSED);
@@ -934,7 +951,7 @@ tcp_update_rcv_ann_wnd(struct tcp_pcb *pcb)
   LWIP_ASSERT("tcp_update_rcv_ann_wnd: invalid pcb", pcb != NULL);
   new_right_edge = pcb->rcv_nxt + pcb->rcv_wnd;
 
-  if (TCP_SEQ_GEQ(new_right_edge, pcb->rcv_ann_right_edge + LWIP_MIN((TCP_WND / 2), pcb->mss))) {
+  if (TCP_SEQ_GEQ(new_right_edge, pcb->rcv_ann_right_edge + LWIP_MIN((TCP_RCV_BUF(pcb) / 2), pcb->mss))) {
     /* we can advertise more window */
     pcb->rcv_ann_wnd = pcb->rcv_wnd;
     return new_right_edge - pcb->rcv_ann_right_edge;
@@ -955,6 +972,114 @@ tcp_update_rcv_ann_wnd(struct tcp_pcb *pcb)
   }
 }
 
+#if LWIP_TCP_BUFFERS
+/** Change the receive window of a pcb when fully open to 'size' */
+static void
+tcp_rcv_buf_resize(struct tcp_pcb *pcb, tcpwnd_size_t size)
+{
+  tcp_rcv_buf_total = tcp_rcv_buf_total - pcb->rcv_buf + size;
+
+  if (size > pcb->rcv_buf) {
+    TCP_WND_INC(pcb->rcv_wnd, (tcpwnd_size_t)(size - pcb->rcv_buf));
+  } else if (pcb->rcv_wnd > (tcpwnd_size_t)(pcb->rcv_buf - size)) {
+    pcb->rcv_wnd = (tcpwnd_size_t)(pcb->rcv_wnd - (pcb->rcv_buf - size));
+  } else {
+    /* more than 'size' is buffered already, tcp_recved caps the window
+       again as the application takes it */
+    pcb->rcv_wnd = 0;
+  }
+  pcb->rcv_buf = size;
+
+  /* the announced right edge stays put, see tcp_update_rcv_ann_wnd */
+  if (pcb->rcv_wnd > TCP_WND_MAX(pcb)) {
+    pcb->rcv_wnd = TCP_WND_MAX(pcb);
+  }
+}
+
+/**
+ * Receive window autotuning, called as the application takes 'len' bytes.
+ * An application taking more than two windows per TCP_TMR_INTERVAL keeps the
+ * sender window-limited for any RTT below half that interval, so the window
+ * doubles up to rcv_buf_max. Once the windows of all pcbs add up to more than
+ * TCP_RCV_BUF_BUDGET, grown windows halve back toward TCP_WND instead.
+ */
+static void
+tcp_rcv_autotune(struct tcp_pcb *pcb, u16_t len)
+{
+  u32_t now = sys_now();
+  tcpwnd_size_t size = pcb->rcv_buf;
+
+  TCP_WND_INC(pcb->rcv_tune_bytes, len);
+  if ((u32_t)(now - pcb->rcv_tune_time) < TCP_TMR_INTERVAL) {
+    return;
+  }
+
+  if (tcp_rcv_buf_total > TCP_RCV_BUF_BUDGET) {
+    if (size > TCP_WND) {
+      size = LWIP_MAX(size / 2, TCP_WND);
+    }
+  } else if ((pcb->rcv_tune_bytes / 2 >= size) && (size < pcb->rcv_buf_max)) {
+    size = LWIP_MIN(2 * size, pcb->rcv_buf_max);
+  }
+
+  pcb->rcv_tune_time = now;
+  pcb->rcv_tune_bytes = 0;
+
+  if (size != pcb->rcv_buf) {
+    LWIP_DEBUGF(TCP_WND_DEBUG, ("tcp_rcv_autotune: rcv_buf %"TCPWNDSIZE_F" -> %"TCPWNDSIZE_F"\n",
+                                pcb->rcv_buf, size));
+    tcp_rcv_buf_resize(pcb, size);
+  }
+}
+
+/**
+ * @ingroup tcp_raw
+ * Set the send buffer and the receive window of a pcb, 0 keeps the current
+ * size. Autotuning may grow the receive window up to rcv_buf_max, which is
+ * off when rcv_buf_max does not exceed rcv_buf.
+ *
+ * @param pcb the tcp_pcb to resize the buffers of
+ * @param snd_buf bytes that may be queued for sending
+ * @param rcv_buf receive window when the application keeps up
+ * @param rcv_buf_max largest receive window autotuning may grow to
+ */
+void
+tcp_set_buffers(struct tcp_pcb *pcb, tcpwnd_size_t snd_buf, tcpwnd_size_t rcv_buf, tcpwnd_size_t rcv_buf_max)
+{
+  LWIP_ASSERT_CORE_LOCKED();
+
+  LWIP_ERROR("tcp_set_buffers: invalid pcb", pcb != NULL, return);
+  LWIP_ASSERT("tcp_set_buffers: not for listen-pcbs", pcb->state != LISTEN);
+
+  if (snd_buf != 0) {
+    snd_buf = LWIP_MAX(snd_buf, (tcpwnd_size_t)(2U * pcb->mss));
+
+    /* ssthresh still at its initial value follows the send buffer */
+    if (pcb->ssthresh == pcb->snd_buf_size) {
+      pcb->ssthresh = snd_buf;
+    }
+
+    pcb->snd_buf = (snd_buf > pcb->snd_queued) ? (tcpwnd_size_t)(snd_buf - pcb->snd_queued) : 0;
+    pcb->snd_buf_size = snd_buf;
+  }
+
+  if (rcv_buf != 0) {
+    rcv_buf = LWIP_MIN(LWIP_MAX(rcv_buf, (tcpwnd_size_t)pcb->mss), (tcpwnd_size_t)(0xFFFFU << TCP_RCV_SCALE));
+    tcp_rcv_buf_resize(pcb, rcv_buf);
+  }
+  if (rcv_buf_max != 0) {
+    pcb->rcv_buf_max = LWIP_MIN(rcv_buf_max, (tcpwnd_size_t)(0xFFFFU << TCP_RCV_SCALE));
+  }
+  pcb->rcv_buf_max = LWIP_MAX(pcb->rcv_buf_max, pcb->rcv_buf);
+
+  /* a grown window is announced right away */
+  if ((tcp_update_rcv_ann_wnd(pcb) >= TCP_WND_UPDATE_THRESHOLD) && (pcb->state >= ESTABLISHED)) {
+    tcp_ack_now(pcb);
+    tcp_output(pcb);
+  }
+}
+#endif /* LWIP_TCP_BUFFERS */
+
 /**
  * @ingroup tcp_raw
  * This function should be called by the application when it has
@@ -978,6 +1103,10 @@ tcp_recved(struct tcp_pcb *pcb, u16_t len)
   LWIP_ASSERT("don't call tcp_recved for listen-pcbs",
               pcb->state != LISTEN);
 
+#if LWIP_TCP_BUFFERS
+  tcp_rcv_autotune(pcb, len);
+#endif /* LWIP_TCP_BUFFERS */
+
   rcv_wnd = (tcpwnd_size_t)(pcb->rcv_wnd + len);
   if ((rcv_wnd > TCP_WND_MAX(pcb)) || (rcv_wnd < pcb->rcv_wnd)) {
     /* window got too big or tcpwnd_size_t overflow */
@@ -1149,7 +1278,7 @@ tcp_connect(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port,
   pcb->snd_lbb = iss - 1;
   /* Start with a window that does not need scaling. When window scaling is
      enabled and used, the window is enlarged when both sides agree on scaling. */
-  pcb->rcv_wnd = pcb->rcv_ann_wnd = TCPWND_MIN16(TCP_WND);
+  pcb->rcv_wnd = pcb->rcv_ann_wnd = TCPWND_MIN16(TCP_RCV_BUF(pcb));
   pcb->rcv_ann_right_edge = pcb->rcv_nxt;
   pcb->snd_wnd = TCP_WND;
   /* As initial send MSS, we use TCP_MSS but limit it to 536.
@@ -1181,6 +1310,537 @@ tcp_connect(struct tcp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port,
   return ret;
 }
 
+/**
+ * Runs one slow tick of an active pcb's retransmission, persist, keepalive
+ * and state timers. Returns whether the pcb timed out and must be removed,
+ * *reset tells if the peer should get a RST then.
+ */
+static u8_t
+tcp_slowtmr_pcb(struct tcp_pcb *pcb, u8_t *reset)
+{
+#if !LWIP_TCP_CC
+  tcpwnd_size_t eff_wnd;
+#endif /* !LWIP_TCP_CC */
+  u8_t pcb_remove;      /* flag if a PCB should be removed */
+  u8_t pcb_reset;       /* flag if a RST should be sent when removing */
+  err_t err;
+
+  pcb_remove = 0;
+  pcb_reset = 0;
+
+  if (pcb->state == SYN_SENT && pcb->nrtx >= TCP_SYNMAXRTX) {
+    ++pcb_remove;
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: max SYN retries reached\n"));
+  } else if (pcb->nrtx >= TCP_MAXRTX) {
+    ++pcb_remove;
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: max DATA retries reached\n"));
+  } else {
+    if (pcb->persist_backoff > 0) {
+      LWIP_ASSERT("tcp_slowtimr: persist ticking with in-flight data", pcb->unacked == NULL);
+      LWIP_ASSERT("tcp_slowtimr: persist ticking with empty send buffer", pcb->unsent != NULL);
+      if (pcb->persist_probe >= TCP_MAXRTX) {
+        ++pcb_remove; /* max probes reached */
+      } else {
+        u8_t backoff_cnt = tcp_persist_backoff[pcb->persist_backoff - 1];
+        if (pcb->persist_cnt < backoff_cnt) {
+          pcb->persist_cnt++;
+        }
+        if (pcb->persist_cnt >= backoff_cnt) {
+          int next_slot = 1; /* increment timer to next slot */
+          /* If snd_wnd is zero, send 1 byte probes */
+          if (pcb->snd_wnd == 0) {
+            if (tcp_zero_window_probe(pcb) != ERR_OK) {
+              next_slot = 0; /* try probe again with current slot */
+            }
+            /* snd_wnd not fully closed, split unsent head and fill window */
+          } else {
+            if (tcp_split_unsent_seg(pcb, (u16_t)pcb->snd_wnd) == ERR_OK) {
+              if (tcp_output(pcb) == ERR_OK) {
+                /* sending will cancel persist timer, else retry with current slot */
+                next_slot = 0;
+              }
+            }
+          }
+          if (next_slot) {
+            pcb->persist_cnt = 0;
+            if (pcb->persist_backoff < sizeof(tcp_persist_backoff)) {
+              pcb->persist_backoff++;
+            }
+          }
+        }
+      }
+    } else {
+      /* Increase the retransmission timer if it is running */
+      if ((pcb->rtime >= 0) && (pcb->rtime < 0x7FFF)) {
+        ++pcb->rtime;
+      }
+
+      if (pcb->rtime >= pcb->rto) {
+        /* Time for a retransmission. */
+        LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_slowtmr: rtime %"S16_F
+                                    " pcb->rto %"S16_F"\n",
+                                    pcb->rtime, pcb->rto));
+        /* If prepare phase fails but we have unsent data but no unacked data,
+           still execute the backoff calculations below, as this means we somehow
+           failed to send segment. */
+        if ((tcp_rexmit_rto_prepare(pcb) == ERR_OK) || ((pcb->unacked == NULL) && (pcb->unsent != NULL))) {
+          /* Double retransmission time-out unless we are trying to
+           * connect to somebody (i.e., we are in SYN_SENT). */
+          if (pcb->state != SYN_SENT) {
+            u8_t backoff_idx = LWIP_MIN(pcb->nrtx, sizeof(tcp_backoff) - 1);
+            int calc_rto = ((pcb->sa >> 3) + pcb->sv) << tcp_backoff[backoff_idx];
+            pcb->rto = (s16_t)LWIP_MIN(calc_rto, 0x7FFF);
+          }
+
+          /* Reset the retransmission timer. */
+          pcb->rtime = 0;
+
+          /* Reduce congestion window and ssthresh. */
+#if LWIP_TCP_CC
+          pcb->cc->loss(pcb, 1);
+#else /* LWIP_TCP_CC */
+          eff_wnd = LWIP_MIN(pcb->cwnd, pcb->snd_wnd);
+          pcb->ssthresh = eff_wnd >> 1;
+          if (pcb->ssthresh < (tcpwnd_size_t)(pcb->mss << 1)) {
+            pcb->ssthresh = (tcpwnd_size_t)(pcb->mss << 1);
+          }
+          pcb->cwnd = pcb->mss;
+#endif /* LWIP_TCP_CC */
+          LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"TCPWNDSIZE_F
+                                       " ssthresh %"TCPWNDSIZE_F"\n",
+                                       pcb->cwnd, pcb->ssthresh));
+          pcb->bytes_acked = 0;
+
+          /* The following needs to be called AFTER cwnd is set to one
+             mss - STJ */
+          tcp_rexmit_rto_commit(pcb);
+        }
+      }
+    }
+  }
+  /* Check if this PCB has stayed too long in FIN-WAIT-2 */
+  if (pcb->state == FIN_WAIT_2) {
+    /* If this PCB is in FIN_WAIT_2 because of SHUT_WR don't let it time out. */
+    if (pcb->flags & TF_RXCLOSED) {
+      /* PCB was fully closed (either through close() or SHUT_RDWR):
+         normal FIN-WAIT timeout handling. */
+      if ((u32_t)(tcp_ticks - pcb->tmr) >
+          TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL) {
+        ++pcb_remove;
+        LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in FIN-WAIT-2\n"));
+      }
+    }
+  }
+
+  /* Check if KEEPALIVE should be sent */
+  if (ip_get_option(pcb, SOF_KEEPALIVE) &&
+      ((pcb->state == ESTABLISHED) ||
+       (pcb->state == CLOSE_WAIT))) {
+    if ((u32_t)(tcp_ticks - pcb->tmr) >
+        (pcb->keep_idle + TCP_KEEP_DUR(pcb)) / TCP_SLOW_INTERVAL) {
+      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: KEEPALIVE timeout. Aborting connection to "));
+      ip_addr_debug_print_val(TCP_DEBUG, pcb->remote_ip);
+      LWIP_DEBUGF(TCP_DEBUG, ("\n"));
+
+      ++pcb_remove;
+      ++pcb_reset;
+    } else if ((u32_t)(tcp_ticks - pcb->tmr) >
+               (pcb->keep_idle + pcb->keep_cnt_sent * TCP_KEEP_INTVL(pcb))
+               / TCP_SLOW_INTERVAL) {
+      err = tcp_keepalive(pcb);
+      if (err == ERR_OK) {
+        pcb->keep_cnt_sent++;
+      }
+    }
+  }
+
+  /* If this PCB has queued out of sequence data, but has been
+     inactive for too long, will drop the data (it will eventually
+     be retransmitted). */
+#if TCP_QUEUE_OOSEQ
+  if (pcb->ooseq != NULL &&
+      (tcp_ticks - pcb->tmr >= (u32_t)pcb->rto * TCP_OOSEQ_TIMEOUT)) {
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: dropping OOSEQ queued data\n"));
+    tcp_free_ooseq(pcb);
+  }
+#endif /* TCP_QUEUE_OOSEQ */
+
+  /* Check if this PCB has stayed too long in SYN-RCVD */
+  if (pcb->state == SYN_RCVD) {
+    if ((u32_t)(tcp_ticks - pcb->tmr) >
+        TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL) {
+      ++pcb_remove;
+      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in SYN-RCVD\n"));
+    }
+  }
+
+  /* Check if this PCB has stayed too long in LAST-ACK */
+  if (pcb->state == LAST_ACK) {
+    if ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
+      ++pcb_remove;
+      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in LAST-ACK\n"));
+    }
+  }
+
+  *reset = pcb_reset;
+  return pcb_remove;
+}
+
+#if LWIP_TCP_TIMER_WHEEL
+/* Active and TIME-WAIT pcbs wait on a two level wheel, keyed by the tick of
+   their next timer event: TCP_WHEEL_SIZE slots of one tick, then
+   TCP_WHEEL_OUTER slots of TCP_WHEEL_SIZE ticks cascading into the first
+   level. Events beyond that are parked in the farthest slot and re-armed when
+   it cascades. */
+#define TCP_WHEEL_BITS    8
+#define TCP_WHEEL_SIZE    (1UL << TCP_WHEEL_BITS)
+#define TCP_WHEEL_MASK    (TCP_WHEEL_SIZE - 1)
+#define TCP_WHEEL_OUTER   64UL
+#define TCP_WHEEL_HORIZON ((TCP_WHEEL_OUTER - 1) * TCP_WHEEL_SIZE)
+/* ticks until the next event of a pcb without running timers */
+#define TCP_WHEEL_IDLE    0x7FFFFFFFUL
+
+static struct tcp_pcb *tcp_wheel[TCP_WHEEL_SIZE];
+static struct tcp_pcb *tcp_wheel_outer[TCP_WHEEL_OUTER];
+/* pcbs touched since the last slow tick, and those with fast timer work left */
+static struct tcp_pcb *tcp_wheel_touched;
+/* pcb tcp_slowtmr runs the timers of, cleared when a callback frees it */
+static struct tcp_pcb *tcp_wheel_current;
+
+/* delayed ACKs, pending FINs and refused data only exist on pcbs touched since
+   the last slow tick, which keeps them on the touched list until done */
+#define TCP_FASTTMR_FIRST      tcp_wheel_touched
+#define TCP_FASTTMR_NEXT(pcb)  ((pcb)->touch_next)
+#define TCP_FASTTMR_PENDING(pcb) (((pcb)->state != TIME_WAIT) && \
+  ((((pcb)->flags & (TF_ACK_DELAY | TF_CLOSEPEND)) != 0) || ((pcb)->refused_data != NULL)))
+
+static void
+tcp_wheel_link(struct tcp_pcb **slot, struct tcp_pcb *pcb)
+{
+  pcb->wheel_next = *slot;
+  if (*slot != NULL) {
+    (*slot)->wheel_pprev = &pcb->wheel_next;
+  }
+  pcb->wheel_pprev = slot;
+  *slot = pcb;
+}
+
+static void
+tcp_wheel_unlink(struct tcp_pcb *pcb)
+{
+  if (pcb->wheel_pprev != NULL) {
+    *pcb->wheel_pprev = pcb->wheel_next;
+    if (pcb->wheel_next != NULL) {
+      pcb->wheel_next->wheel_pprev = pcb->wheel_pprev;
+    }
+    pcb->wheel_next = NULL;
+    pcb->wheel_pprev = NULL;
+  }
+}
+
+/** Move all pcbs of slot 'from' to the empty list 'to' */
+static void
+tcp_wheel_move(struct tcp_pcb **from, struct tcp_pcb **to)
+{
+  *to = *from;
+  if (*to != NULL) {
+    (*to)->wheel_pprev = to;
+  }
+  *from = NULL;
+}
+
+static void
+tcp_touched_link(struct tcp_pcb *pcb)
+{
+  if (pcb->touch_pprev == NULL) {
+    pcb->touch_next = tcp_wheel_touched;
+    if (tcp_wheel_touched != NULL) {
+      tcp_wheel_touched->touch_pprev = &pcb->touch_next;
+    }
+    pcb->touch_pprev = &tcp_wheel_touched;
+    tcp_wheel_touched = pcb;
+  }
+}
+
+static void
+tcp_touched_unlink(struct tcp_pcb *pcb)
+{
+  if (pcb->touch_pprev != NULL) {
+    *pcb->touch_pprev = pcb->touch_next;
+    if (pcb->touch_next != NULL) {
+      pcb->touch_next->touch_pprev = pcb->touch_pprev;
+    }
+    pcb->touch_next = NULL;
+    pcb->touch_pprev = NULL;
+  }
+}
+
+/** Queue pcb on the wheel to run at tick 'due', which must not be in the past */
+static void
+tcp_wheel_arm(struct tcp_pcb *pcb, u32_t due)
+{
+  u32_t delta = due - tcp_ticks;
+
+  pcb->wheel_due = due;
+  if (delta < TCP_WHEEL_SIZE) {
+    tcp_wheel_link(&tcp_wheel[due & TCP_WHEEL_MASK], pcb);
+  } else {
+    if (delta > TCP_WHEEL_HORIZON) {
+      due = tcp_ticks + TCP_WHEEL_HORIZON;
+    }
+    tcp_wheel_link(&tcp_wheel_outer[(due >> TCP_WHEEL_BITS) % TCP_WHEEL_OUTER], pcb);
+  }
+}
+
+/**
+ * Advance the counters tcp_slowtmr_pcb() steps each tick up to 'ticks'. The
+ * wheel made sure none of the skipped ticks would have fired a timer, so
+ * counting is all that is left of them.
+ */
+static void
+tcp_timer_sync(struct tcp_pcb *pcb, u32_t ticks)
+{
+  u32_t elapsed = ticks - pcb->wheel_ticks;
+
+  if ((s32_t)elapsed <= 0) {
+    return;
+  }
+  pcb->wheel_ticks = ticks;
+
+  if (pcb->state == TIME_WAIT) {
+    return;
+  }
+  if (pcb->persist_backoff > 0) {
+    u8_t backoff_cnt = tcp_persist_backoff[pcb->persist_backoff - 1];
+    pcb->persist_cnt = (u8_t)LWIP_MIN(pcb->persist_cnt + elapsed, backoff_cnt);
+  } else if (pcb->rtime >= 0) {
+    pcb->rtime = (s16_t)LWIP_MIN(pcb->rtime + elapsed, 0x7FFF);
+  }
+  if (pcb->pollinterval > 0) {
+    pcb->polltmr = (u8_t)((pcb->polltmr + elapsed) % pcb->pollinterval);
+  }
+}
+
+/** Lower *left, the ticks until the next timer event, to 'ticks' from now */
+static void
+tcp_timer_after(u32_t *left, s32_t ticks)
+{
+  if (ticks < 1) {
+    ticks = 1;
+  }
+  if ((u32_t)ticks < *left) {
+    *left = (u32_t)ticks;
+  }
+}
+
+/** Lower *left, the ticks until the next timer event, to the event at tick 'at' */
+static void
+tcp_timer_until(u32_t *left, u32_t at)
+{
+  tcp_timer_after(left, (s32_t)(at - tcp_ticks));
+}
+
+/**
+ * The first tick at which tcp_slowtmr() would act on pcb, whose counters are
+ * advanced to tcp_ticks. This mirrors every check of tcp_slowtmr_pcb(): too
+ * early only costs a visit, too late delays a timer.
+ */
+static u32_t
+tcp_timer_next(struct tcp_pcb *pcb)
+{
+  u32_t left = TCP_WHEEL_IDLE;
+
+  if (pcb->state == TIME_WAIT) {
+    tcp_timer_until(&left, pcb->tmr + 2 * TCP_MSL / TCP_SLOW_INTERVAL + 1);
+    return tcp_ticks + left;
+  }
+
+  if ((pcb->state == SYN_SENT && pcb->nrtx >= TCP_SYNMAXRTX) || pcb->nrtx >= TCP_MAXRTX) {
+    return tcp_ticks + 1;
+  }
+  if (pcb->persist_backoff > 0) {
+    if (pcb->persist_probe >= TCP_MAXRTX) {
+      return tcp_ticks + 1;
+    }
+    tcp_timer_after(&left, tcp_persist_backoff[pcb->persist_backoff - 1] - pcb->persist_cnt);
+  } else if (pcb->rtime >= 0 && (pcb->unacked != NULL || pcb->unsent != NULL)) {
+    tcp_timer_after(&left, pcb->rto - pcb->rtime);
+  }
+
+  if (pcb->state == FIN_WAIT_2 && (pcb->flags & TF_RXCLOSED)) {
+    tcp_timer_until(&left, pcb->tmr + TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL + 1);
+  }
+  if (ip_get_option(pcb, SOF_KEEPALIVE) &&
+      ((pcb->state == ESTABLISHED) ||
+       (pcb->state == CLOSE_WAIT))) {
+    tcp_timer_until(&left, pcb->tmr + (pcb->keep_idle + TCP_KEEP_DUR(pcb)) / TCP_SLOW_INTERVAL + 1);
+    tcp_timer_until(&left, pcb->tmr + (pcb->keep_idle + pcb->keep_cnt_sent * TCP_KEEP_INTVL(pcb))
+                    / TCP_SLOW_INTERVAL + 1);
+  }
+#if TCP_QUEUE_OOSEQ
+  if (pcb->ooseq != NULL) {
+    tcp_timer_until(&left, pcb->tmr + (u32_t)pcb->rto * TCP_OOSEQ_TIMEOUT);
+  }
+#endif /* TCP_QUEUE_OOSEQ */
+  if (pcb->state == SYN_RCVD) {
+    tcp_timer_until(&left, pcb->tmr + TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL + 1);
+  }
+  if (pcb->state == LAST_ACK) {
+    tcp_timer_until(&left, pcb->tmr + 2 * TCP_MSL / TCP_SLOW_INTERVAL + 1);
+  }
+
+  /* polling without a callback only retries tcp_output() */
+#if LWIP_CALLBACK_API
+  if (pcb->poll != NULL || pcb->unsent != NULL || (pcb->flags & TF_ACK_NOW))
+#endif /* LWIP_CALLBACK_API */
+  {
+    tcp_timer_after(&left, (s32_t)pcb->pollinterval - pcb->polltmr);
+  }
+
+  return tcp_ticks + left;
+}
+
+/**
+ * Note that pcb is about to change state its timers depend on: bring its
+ * counters up to date and have the next slow tick re-arm it.
+ */
+void
+tcp_timer_touch(struct tcp_pcb *pcb)
+{
+  if (pcb->state == CLOSED || pcb->state == LISTEN) {
+    return;
+  }
+  tcp_timer_sync(pcb, tcp_ticks);
+  tcp_touched_link(pcb);
+}
+
+/** Start the timers of a pcb entering the active or TIME-WAIT list */
+void
+tcp_timer_start(struct tcp_pcb *pcb)
+{
+  pcb->wheel_ticks = tcp_ticks;
+  tcp_touched_link(pcb);
+}
+
+/** Stop the timers of a pcb leaving the active or TIME-WAIT list */
+void
+tcp_timer_remove(struct tcp_pcb *pcb)
+{
+  tcp_wheel_unlink(pcb);
+  if (pcb->touch_pprev != NULL) {
+    tcp_touched_unlink(pcb);
+    /* tcp_fasttmr walks the touched list */
+    tcp_active_pcbs_changed = 1;
+  }
+  if (tcp_wheel_current == pcb) {
+    tcp_wheel_current = NULL;
+  }
+}
+
+/** Run this tick's timers of a pcb and re-arm it */
+static void
+tcp_wheel_run(struct tcp_pcb *pcb)
+{
+  u8_t pcb_reset;
+  err_t err;
+
+  /* catch up on the ticks skipped on the wheel, then run this one */
+  tcp_timer_sync(pcb, tcp_ticks - 1);
+  pcb->wheel_ticks = tcp_ticks;
+  tcp_wheel_current = pcb;
+
+  if (pcb->state == TIME_WAIT) {
+    /* Check if this PCB has stayed long enough in TIME-WAIT */
+    if ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
+      tcp_pcb_purge(pcb);
+      TCP_RMV(&tcp_tw_pcbs, pcb);
+      tcp_free(pcb);
+      return;
+    }
+  } else if (tcp_slowtmr_pcb(pcb, &pcb_reset)) {
+#if LWIP_CALLBACK_API
+    tcp_err_fn err_fn = pcb->errf;
+#endif /* LWIP_CALLBACK_API */
+    void *err_arg = pcb->callback_arg;
+    enum tcp_state last_state = pcb->state;
+
+    tcp_pcb_purge(pcb);
+    TCP_RMV_ACTIVE(pcb);
+
+    if (pcb_reset) {
+      tcp_rst(pcb, pcb->snd_nxt, pcb->rcv_nxt, &pcb->local_ip, &pcb->remote_ip,
+              pcb->local_port, pcb->remote_port);
+    }
+
+    tcp_free(pcb);
+    TCP_EVENT_ERR(last_state, err_fn, err_arg, ERR_ABRT);
+    return;
+  } else {
+    /* We check if we should poll the connection. */
+    ++pcb->polltmr;
+    if (pcb->polltmr >= pcb->pollinterval) {
+      pcb->polltmr = 0;
+      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: polling application\n"));
+      TCP_EVENT_POLL(pcb, err);
+      if (tcp_wheel_current != pcb) {
+        /* the callback freed the pcb */
+        return;
+      }
+      if (err == ERR_OK) {
+        tcp_output(pcb);
+      }
+    }
+  }
+
+  tcp_wheel_current = NULL;
+  tcp_touched_unlink(pcb);
+  tcp_wheel_arm(pcb, tcp_timer_next(pcb));
+  if (TCP_FASTTMR_PENDING(pcb)) {
+    tcp_touched_link(pcb);
+  }
+}
+
+/**
+ * Called every 500 ms and implements the retransmission timer and the timer that
+ * removes PCBs that have been in TIME-WAIT for enough time. Only pcbs with a
+ * timer due this tick or touched since the last one are visited, the per-tick
+ * counters of the others are caught up when they are.
+ *
+ * Automatically called from tcp_tmr().
+ */
+void
+tcp_slowtmr(void)
+{
+  struct tcp_pcb *expired;
+  struct tcp_pcb *pcb;
+
+  ++tcp_ticks;
+  ++tcp_timer_ctr;
+
+  if ((tcp_ticks & TCP_WHEEL_MASK) == 0) {
+    /* the outer slot of this round cascades into the first level */
+    tcp_wheel_move(&tcp_wheel_outer[(tcp_ticks >> TCP_WHEEL_BITS) % TCP_WHEEL_OUTER], &expired);
+    while ((pcb = expired) != NULL) {
+      tcp_wheel_unlink(pcb);
+      tcp_wheel_arm(pcb, pcb->wheel_due);
+    }
+  }
+
+  tcp_wheel_move(&tcp_wheel[tcp_ticks & TCP_WHEEL_MASK], &expired);
+  while ((pcb = tcp_wheel_touched) != NULL) {
+    tcp_touched_unlink(pcb);
+    tcp_wheel_unlink(pcb);
+    tcp_wheel_link(&expired, pcb);
+  }
+
+  /* callbacks may free any pcb, which then leaves the expired list as well */
+  while ((pcb = expired) != NULL) {
+    tcp_wheel_unlink(pcb);
+    tcp_wheel_run(pcb);
+  }
+  tcp_wheel_current = NULL;
+}
+#else /* LWIP_TCP_TIMER_WHEEL */
 /**
  * Called every 500 ms and implements the retransmission timer and the timer that
  * removes PCBs that have been in TIME-WAIT for enough time. It also increments
@@ -1192,7 +1852,6 @@ void
 tcp_slowtmr(void)
 {
   struct tcp_pcb *pcb, *prev;
-  tcpwnd_size_t eff_wnd;
   u8_t pcb_remove;      /* flag if a PCB should be removed */
   u8_t pcb_reset;       /* flag if a RST should be sent when removing */
   err_t err;
@@ -1222,158 +1881,7 @@ tcp_slowtmr_start:
     }
     pcb->last_timer = tcp_timer_ctr;
 
-    pcb_remove = 0;
-    pcb_reset = 0;
-
-    if (pcb->state == SYN_SENT && pcb->nrtx >= TCP_SYNMAXRTX) {
-      ++pcb_remove;
-      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: max SYN retries reached\n"));
-    } else if (pcb->nrtx >= TCP_MAXRTX) {
-      ++pcb_remove;
-      LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: max DATA retries reached\n"));
-    } else {
-      if (pcb->persist_backoff > 0) {
-        LWIP_ASSERT("tcp_slowtimr: persist ticking with in-flight data", pcb->unacked == NULL);
-        LWIP_ASSERT("tcp_slowtimr: persist ticking with empty send buffer", pcb->unsent != NULL);
-        if (pcb->persist_probe >= TCP_MAXRTX) {
-          ++pcb_remove; /* max probes reached */
-        } else {
-          u8_t backoff_cnt = tcp_persist_backoff[pcb->persist_backoff - 1];
-          if (pcb->persist_cnt < backoff_cnt) {
-            pcb->persist_cnt++;
-          }
-          if (pcb->persist_cnt >= backoff_cnt) {
-            int next_slot = 1; /* increment timer to next slot */
-            /* If snd_wnd is zero, send 1 byte probes */
-            if (pcb->snd_wnd == 0) {
-              if (tcp_zero_window_probe(pcb) != ERR_OK) {
-                next_slot = 0; /* try probe again with current slot */
-              }
-              /* snd_wnd not fully closed, split unsent head and fill window */
-            } else {
-              if (tcp_split_unsent_seg(pcb, (u16_t)pcb->snd_wnd) == ERR_OK) {
-                if (tcp_output(pcb) == ERR_OK) {
-                  /* sending will cancel persist timer, else retry with current slot */
-                  next_slot = 0;
-                }
-              }
-            }
-            if (next_slot) {
-              pcb->persist_cnt = 0;
-              if (pcb->persist_backoff < sizeof(tcp_persist_backoff)) {
-                pcb->persist_backoff++;
-              }
-            }
-          }
-        }
-      } else {
-        /* Increase the retransmission timer if it is running */
-        if ((pcb->rtime >= 0) && (pcb->rtime < 0x7FFF)) {
-          ++pcb->rtime;
-        }
-
-        if (pcb->rtime >= pcb->rto) {
-          /* Time for a retransmission. */
-          LWIP_DEBUGF(TCP_RTO_DEBUG, ("tcp_slowtmr: rtime %"S16_F
-                                      " pcb->rto %"S16_F"\n",
-                                      pcb->rtime, pcb->rto));
-          /* If prepare phase fails but we have unsent data but no unacked data,
-             still execute the backoff calculations below, as this means we somehow
-             failed to send segment. */
-          if ((tcp_rexmit_rto_prepare(pcb) == ERR_OK) || ((pcb->unacked == NULL) && (pcb->unsent != NULL))) {
-            /* Double retransmission time-out unless we are trying to
-             * connect to somebody (i.e., we are in SYN_SENT). */
-            if (pcb->state != SYN_SENT) {
-              u8_t backoff_idx = LWIP_MIN(pcb->nrtx, sizeof(tcp_backoff) - 1);
-              int calc_rto = ((pcb->sa >> 3) + pcb->sv) << tcp_backoff[backoff_idx];
-              pcb->rto = (s16_t)LWIP_MIN(calc_rto, 0x7FFF);
-            }
-
-            /* Reset the retransmission timer. */
-            pcb->rtime = 0;
-
-            /* Reduce congestion window and ssthresh. */
-            eff_wnd = LWIP_MIN(pcb->cwnd, pcb->snd_wnd);
-            pcb->ssthresh = eff_wnd >> 1;
-            if (pcb->ssthresh < (tcpwnd_size_t)(pcb->mss << 1)) {
-              pcb->ssthresh = (tcpwnd_size_t)(pcb->mss << 1);
-            }
-            pcb->cwnd = pcb->mss;
-            LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: cwnd %"TCPWNDSIZE_F
-                                         " ssthresh %"TCPWNDSIZE_F"\n",
-                                         pcb->cwnd, pcb->ssthresh));
-            pcb->bytes_acked = 0;
-
-            /* The following needs to be called AFTER cwnd is set to one
-               mss - STJ */
-            tcp_rexmit_rto_commit(pcb);
-          }
-        }
-      }
-    }
-    /* Check if this PCB has stayed too long in FIN-WAIT-2 */
-    if (pcb->state == FIN_WAIT_2) {
-      /* If this PCB is in FIN_WAIT_2 because of SHUT_WR don't let it time out. */
-      if (pcb->flags & TF_RXCLOSED) {
-        /* PCB was fully closed (either through close() or SHUT_RDWR):
-           normal FIN-WAIT timeout handling. */
-        if ((u32_t)(tcp_ticks - pcb->tmr) >
-            TCP_FIN_WAIT_TIMEOUT / TCP_SLOW_INTERVAL) {
-          ++pcb_remove;
-          LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in FIN-WAIT-2\n"));
-        }
-      }
-    }
-
-    /* Check if KEEPALIVE should be sent */
-    if (ip_get_option(pcb, SOF_KEEPALIVE) &&
-        ((pcb->state == ESTABLISHED) ||
-         (pcb->state == CLOSE_WAIT))) {
-      if ((u32_t)(tcp_ticks - pcb->tmr) >
-          (pcb->keep_idle + TCP_KEEP_DUR(pcb)) / TCP_SLOW_INTERVAL) {
-        LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: KEEPALIVE timeout. Aborting connection to "));
-        ip_addr_debug_print_val(TCP_DEBUG, pcb->remote_ip);
-        LWIP_DEBUGF(TCP_DEBUG, ("\n"));
-
-        ++pcb_remove;
-        ++pcb_reset;
-      } else if ((u32_t)(tcp_ticks - pcb->tmr) >
-                 (pcb->keep_idle + pcb->keep_cnt_sent * TCP_KEEP_INTVL(pcb))
-                 / TCP_SLOW_INTERVAL) {
-        err = tcp_keepalive(pcb);
-        if (err == ERR_OK) {
-          pcb->keep_cnt_sent++;
-        }
-      }
-    }
-
-    /* If this PCB has queued out of sequence data, but has been
-       inactive for too long, will drop the data (it will eventually
-       be retransmitted). */
-#if TCP_QUEUE_OOSEQ
-    if (pcb->ooseq != NULL &&
-        (tcp_ticks - pcb->tmr >= (u32_t)pcb->rto * TCP_OOSEQ_TIMEOUT)) {
-      LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_slowtmr: dropping OOSEQ queued data\n"));
-      tcp_free_ooseq(pcb);
-    }
-#endif /* TCP_QUEUE_OOSEQ */
-
-    /* Check if this PCB has stayed too long in SYN-RCVD */
-    if (pcb->state == SYN_RCVD) {
-      if ((u32_t)(tcp_ticks - pcb->tmr) >
-          TCP_SYN_RCVD_TIMEOUT / TCP_SLOW_INTERVAL) {
-        ++pcb_remove;
-        LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in SYN-RCVD\n"));
-      }
-    }
-
-    /* Check if this PCB has stayed too long in LAST-ACK */
-    if (pcb->state == LAST_ACK) {
-      if ((u32_t)(tcp_ticks - pcb->tmr) > 2 * TCP_MSL / TCP_SLOW_INTERVAL) {
-        ++pcb_remove;
-        LWIP_DEBUGF(TCP_DEBUG, ("tcp_slowtmr: removing pcb stuck in LAST-ACK\n"));
-      }
-    }
+    pcb_remove = tcp_slowtmr_pcb(pcb, &pcb_reset);
 
     /* If the PCB should be removed, do it. */
     if (pcb_remove) {
@@ -1393,6 +1901,9 @@ tcp_slowtmr_start:
         LWIP_ASSERT("tcp_slowtmr: first pcb == tcp_active_pcbs", tcp_active_pcbs == pcb);
         tcp_active_pcbs = pcb->next;
       }
+#if LWIP_PCB_HASH
+      tcp_pcb_hash_remove(pcb);
+#endif /* LWIP_PCB_HASH */
 
       if (pcb_reset) {
         tcp_rst(pcb, pcb->snd_nxt, pcb->rcv_nxt, &pcb->local_ip, &pcb->remote_ip,
@@ -1459,6 +1970,9 @@ tcp_slowtmr_start:
         LWIP_ASSERT("tcp_slowtmr: first pcb == tcp_tw_pcbs", tcp_tw_pcbs == pcb);
         tcp_tw_pcbs = pcb->next;
       }
+#if LWIP_PCB_HASH
+      tcp_pcb_hash_remove(pcb);
+#endif /* LWIP_PCB_HASH */
       pcb2 = pcb;
       pcb = pcb->next;
       tcp_free(pcb2);
@@ -1469,6 +1983,10 @@ tcp_slowtmr_start:
   }
 }
 
+#define TCP_FASTTMR_FIRST      tcp_active_pcbs
+#define TCP_FASTTMR_NEXT(pcb)  ((pcb)->next)
+#endif /* LWIP_TCP_TIMER_WHEEL */
+
 /**
  * Is called every TCP_FAST_INTERVAL (250 ms) and process data previously
  * "refused" by upper layer (application) and sends delayed ACKs or pending FINs.
@@ -1483,10 +2001,10 @@ tcp_fasttmr(void)
   ++tcp_timer_ctr;
 
 tcp_fasttmr_start:
-  pcb = tcp_active_pcbs;
+  pcb = TCP_FASTTMR_FIRST;
 
   while (pcb != NULL) {
-    if (pcb->last_timer != tcp_timer_ctr) {
+    if (pcb->last_timer != tcp_timer_ctr && pcb->state != TIME_WAIT) {
       struct tcp_pcb *next;
       pcb->last_timer = tcp_timer_ctr;
       /* send delayed ACKs */
@@ -1503,7 +2021,7 @@ tcp_fasttmr_start:
         tcp_close_shutdown_fin(pcb);
       }
 
-      next = pcb->next;
+      next = TCP_FASTTMR_NEXT(pcb);
 
       /* If there is data which was previously "refused" by upper layer */
       if (pcb->refused_data != NULL) {
@@ -1516,7 +2034,7 @@ tcp_fasttmr_start:
       }
       pcb = next;
     } else {
-      pcb = pcb->next;
+      pcb = TCP_FASTTMR_NEXT(pcb);
     }
   }
 }
@@ -1890,6 +2408,13 @@ tcp_alloc(u8_t prio)
     memset(pcb, 0, sizeof(struct tcp_pcb));
     pcb->prio = prio;
     pcb->snd_buf = TCP_SND_BUF;
+#if LWIP_TCP_BUFFERS
+    pcb->snd_buf_size = TCP_SND_BUF;
+    pcb->rcv_buf = TCP_WND;
+    pcb->rcv_buf_max = TCP_RCV_BUF_MAX;
+    pcb->rcv_tune_time = sys_now();
+    tcp_rcv_buf_total += TCP_WND;
+#endif /* LWIP_TCP_BUFFERS */
     /* Start with a window that does not need scaling. When window scaling is
        enabled and used, the window is enlarged when both sides agree on scaling. */
     pcb->rcv_wnd = pcb->rcv_ann_wnd = TCPWND_MIN16(TCP_WND);
@@ -1903,6 +2428,9 @@ tcp_alloc(u8_t prio)
     pcb->cwnd = 1;
     pcb->tmr = tcp_ticks;
     pcb->last_timer = tcp_timer_ctr;
+#if LWIP_TCP_TIMER_WHEEL
+    pcb->wheel_ticks = tcp_ticks;
+#endif /* LWIP_TCP_TIMER_WHEEL */
 
     /* RFC 5681 recommends setting ssthresh abritrarily high and gives an example
     of using the largest advertised receive window.  We've seen complications with
@@ -1911,6 +2439,9 @@ tcp_alloc(u8_t prio)
     connection is established. To avoid these complications, we set ssthresh to the
     largest effective cwnd (amount of in-flight data) that the sender can have. */
     pcb->ssthresh = TCP_SND_BUF;
+#if LWIP_TCP_CC
+    pcb->cc = tcp_cc_default;
+#endif /* LWIP_TCP_CC */
 
 #if LWIP_CALLBACK_API
     pcb->recv = tcp_recv_null;
@@ -2115,6 +2646,7 @@ tcp_poll(struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interval)
   LWIP_UNUSED_ARG(poll);
 #endif /* LWIP_CALLBACK_API */
   pcb->pollinterval = interval;
+  TCP_TIMER_TOUCH(pcb);
 }
 
 /**
@@ -2167,6 +2699,65 @@ tcp_pcb_purge(struct tcp_pcb *pcb)
   }
 }
 
+#if LWIP_PCB_HASH
+static struct tcp_pcb *tcp_pcb_hash[TCP_PCB_HASH_SIZE];
+
+void
+tcp_pcb_hash_insert(struct tcp_pcb *pcb)
+{
+  struct tcp_pcb **bucket = &tcp_pcb_hash[lwip_pcb_hash(&pcb->local_ip, pcb->local_port,
+                                                        &pcb->remote_ip, pcb->remote_port, TCP_PCB_HASH_SIZE)];
+
+  pcb->hash_next = *bucket;
+  *bucket = pcb;
+}
+
+void
+tcp_pcb_hash_remove(struct tcp_pcb *pcb)
+{
+  struct tcp_pcb **link = &tcp_pcb_hash[lwip_pcb_hash(&pcb->local_ip, pcb->local_port,
+                                                      &pcb->remote_ip, pcb->remote_port, TCP_PCB_HASH_SIZE)];
+
+  for (; *link != NULL; link = &(*link)->hash_next) {
+    if (*link == pcb) {
+      *link = pcb->hash_next;
+      break;
+    }
+  }
+  pcb->hash_next = NULL;
+}
+
+/**
+ * Find the active or TIME-WAIT pcb of a 4-tuple. A hit is moved to the front
+ * of its bucket since segments of one connection tend to arrive in bursts.
+ */
+struct tcp_pcb *
+tcp_pcb_hash_lookup(const ip_addr_t *local_ip, u16_t local_port,
+                    const ip_addr_t *remote_ip, u16_t remote_port)
+{
+  struct tcp_pcb **bucket = &tcp_pcb_hash[lwip_pcb_hash(local_ip, local_port, remote_ip, remote_port, TCP_PCB_HASH_SIZE)];
+  struct tcp_pcb *prev = NULL;
+  struct tcp_pcb *pcb;
+
+  for (pcb = *bucket; pcb != NULL; prev = pcb, pcb = pcb->hash_next) {
+    if (pcb->remote_port == remote_port &&
+        pcb->local_port == local_port &&
+        ip_addr_cmp(&pcb->remote_ip, remote_ip) &&
+        ip_addr_cmp(&pcb->local_ip, local_ip)) {
+      if (prev != NULL) {
+        prev->hash_next = pcb->hash_next;
+        pcb->hash_next = *bucket;
+        *bucket = pcb;
+      } else {
+        TCP_STATS_INC(tcp.cachehit);
+      }
+      return pcb;
+    }
+  }
+  return NULL;
+}
+#endif /* LWIP_PCB_HASH */
+
 /**
  * Purges the PCB and removes it from a PCB list. Any delayed ACKs are sent first.
  *
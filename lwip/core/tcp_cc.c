@@ -0,0 +1,270 @@
+/**
+ * @file
+ * Pluggable TCP congestion control (LWIP_TCP_CC)
+ *
+ * tcp_in.c, tcp_out.c and the retransmission timer hand every cwnd/ssthresh
+ * decision to the ops of the pcb. Fast recovery itself (window inflation on
+ * duplicate ACKs, deflation to ssthresh when it ends) stays in tcp_in.c.
+ */
+
+#include "lwip/opt.h"
+
+#if LWIP_TCP && LWIP_TCP_CC
+
+#include "lwip/tcp.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/sys.h"
+
+/* CUBIC multiplicative decrease, in 1/1024 */
+#define TCP_CUBIC_BETA      717
+/* Reno-friendly growth per window, 3 * (1 - beta) / (1 + beta) in 1/1024 */
+#define TCP_CUBIC_FRIENDLY  542
+/* (t - K)^3 in ms^3 per segment of growth, for C = 0.4 segments/s^3 */
+#define TCP_CUBIC_K3        2500000000LL
+/* clamp |t - K| so that its cube fits an s64_t */
+#define TCP_CUBIC_T_MAX     2000000LL
+
+const struct tcp_cc_ops *tcp_cc_default = &tcp_cc_reno;
+
+/* RFC 3465, section 2.2 Slow Start */
+static void
+tcp_cc_slow_start(struct tcp_pcb *pcb, tcpwnd_size_t acked)
+{
+  /* limit to 1 SMSS segment during period following RTO */
+  u8_t num_seg = (pcb->flags & TF_RTO) ? 1 : 2;
+  tcpwnd_size_t increase = LWIP_MIN(acked, (tcpwnd_size_t)(num_seg * pcb->mss));
+
+  TCP_WND_INC(pcb->cwnd, increase);
+  LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: slow start cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
+}
+
+static void
+tcp_reno_init(struct tcp_pcb *pcb)
+{
+  pcb->cwnd = LWIP_TCP_CALC_INITIAL_CWND(pcb->mss);
+}
+
+static void
+tcp_reno_acked(struct tcp_pcb *pcb, tcpwnd_size_t acked)
+{
+  if (pcb->cwnd < pcb->ssthresh) {
+    tcp_cc_slow_start(pcb, acked);
+  } else {
+    /* RFC 3465, section 2.1 Congestion Avoidance */
+    TCP_WND_INC(pcb->bytes_acked, acked);
+    if (pcb->bytes_acked >= pcb->cwnd) {
+      pcb->bytes_acked = (tcpwnd_size_t)(pcb->bytes_acked - pcb->cwnd);
+      TCP_WND_INC(pcb->cwnd, pcb->mss);
+    }
+    LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: congestion avoidance cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
+  }
+}
+
+static void
+tcp_reno_loss(struct tcp_pcb *pcb, u8_t rto)
+{
+  /* Set ssthresh to half of the minimum of the current
+   * cwnd and the advertised window, but at least 2 MSS */
+  pcb->ssthresh = LWIP_MIN(pcb->cwnd, pcb->snd_wnd) / 2;
+  if (pcb->ssthresh < (tcpwnd_size_t)(2U * pcb->mss)) {
+    pcb->ssthresh = (tcpwnd_size_t)(2U * pcb->mss);
+  }
+
+  /* an RTO restarts from one segment, fast retransmit inflates by the
+     three segments that left the network */
+  pcb->cwnd = rto ? pcb->mss : (tcpwnd_size_t)(pcb->ssthresh + 3 * pcb->mss);
+}
+
+const struct tcp_cc_ops tcp_cc_reno = {
+  "reno",
+  tcp_reno_init,
+  tcp_reno_acked,
+  tcp_reno_loss
+};
+
+/** Integer cube root, from Hacker's Delight */
+static u32_t
+tcp_cubic_cbrt(u64_t x)
+{
+  u64_t y = 0;
+  u64_t b;
+  int s;
+
+  for (s = 63; s >= 0; s -= 3) {
+    y += y;
+    b = 3 * y * (y + 1) + 1;
+    if ((x >> s) >= b) {
+      x -= b << s;
+      y++;
+    }
+  }
+  return (u32_t)y;
+}
+
+static void
+tcp_cubic_init(struct tcp_pcb *pcb)
+{
+  pcb->cwnd = LWIP_TCP_CALC_INITIAL_CWND(pcb->mss);
+  pcb->cc_epoch = 0;
+  pcb->cc_wmax = 0;
+}
+
+/* RFC 8312: W_cubic(t) = C * (t - K)^3 + W_max */
+static void
+tcp_cubic_acked(struct tcp_pcb *pcb, tcpwnd_size_t acked)
+{
+  u32_t now;
+  s64_t t;
+  s64_t target;
+  u64_t per_mss;
+  tcpwnd_size_t grown;
+
+  if (pcb->cwnd < pcb->ssthresh) {
+    tcp_cc_slow_start(pcb, acked);
+    return;
+  }
+
+  now = sys_now();
+  if (pcb->cc_epoch == 0) {
+    /* first ACK of a congestion avoidance epoch */
+    pcb->cc_epoch = now ? now : 1;
+    pcb->cc_west = pcb->cwnd;
+    if (pcb->cwnd < pcb->cc_wmax) {
+      pcb->cc_k = tcp_cubic_cbrt((u64_t)((pcb->cc_wmax - pcb->cwnd) / pcb->mss) * TCP_CUBIC_K3);
+      pcb->cc_origin = pcb->cc_wmax;
+    } else {
+      pcb->cc_k = 0;
+      pcb->cc_origin = pcb->cwnd;
+    }
+  }
+
+  t = (s64_t)(u32_t)(now - pcb->cc_epoch) - pcb->cc_k;
+  t = LWIP_MAX(LWIP_MIN(t, TCP_CUBIC_T_MAX), -TCP_CUBIC_T_MAX);
+  target = (s64_t)pcb->cc_origin + t * t * t / TCP_CUBIC_K3 * pcb->mss;
+
+  /* never fall behind the window Reno would have grown to */
+  TCP_WND_INC(pcb->cc_west, (tcpwnd_size_t)((u64_t)acked * pcb->mss * TCP_CUBIC_FRIENDLY / 1024 / pcb->cwnd));
+  if (target < (s64_t)pcb->cc_west) {
+    target = pcb->cc_west;
+  }
+
+  /* bytes to acknowledge per segment of growth: reach the target within
+     about one RTT, but grow by at most half of what was acked */
+  if (target > (s64_t)pcb->cwnd) {
+    per_mss = (u64_t)pcb->cwnd * pcb->mss / (u64_t)(target - pcb->cwnd);
+    per_mss = LWIP_MAX(per_mss, 2U * pcb->mss);
+  } else {
+    per_mss = (u64_t)pcb->cwnd * 100;
+  }
+
+  TCP_WND_INC(pcb->bytes_acked, acked);
+  if (pcb->bytes_acked >= per_mss) {
+    grown = (tcpwnd_size_t)(pcb->bytes_acked / per_mss);
+    pcb->bytes_acked = (tcpwnd_size_t)(pcb->bytes_acked - grown * per_mss);
+    TCP_WND_INC(pcb->cwnd, (tcpwnd_size_t)(grown * pcb->mss));
+  }
+  LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: cubic cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
+}
+
+static void
+tcp_cubic_loss(struct tcp_pcb *pcb, u8_t rto)
+{
+  tcpwnd_size_t eff_wnd = LWIP_MIN(pcb->cwnd, pcb->snd_wnd);
+
+  /* fast convergence: release bandwidth sooner while W_max keeps shrinking */
+  if (pcb->cwnd < pcb->cc_wmax) {
+    pcb->cc_wmax = (tcpwnd_size_t)((u64_t)pcb->cwnd * (1024 + TCP_CUBIC_BETA) / 2048);
+  } else {
+    pcb->cc_wmax = pcb->cwnd;
+  }
+  pcb->cc_epoch = 0;
+
+  pcb->ssthresh = (tcpwnd_size_t)((u64_t)eff_wnd * TCP_CUBIC_BETA / 1024);
+  if (pcb->ssthresh < (tcpwnd_size_t)(2U * pcb->mss)) {
+    pcb->ssthresh = (tcpwnd_size_t)(2U * pcb->mss);
+  }
+  pcb->cwnd = rto ? pcb->mss : (tcpwnd_size_t)(pcb->ssthresh + 3 * pcb->mss);
+}
+
+const struct tcp_cc_ops tcp_cc_cubic = {
+  "cubic",
+  tcp_cubic_init,
+  tcp_cubic_acked,
+  tcp_cubic_loss
+};
+
+/* For a peer across a local, lossless link: no slow start, the peer's
+   window alone bounds the data in flight. */
+static void
+tcp_local_init(struct tcp_pcb *pcb)
+{
+  pcb->cwnd = TCPWND_MAX;
+  pcb->ssthresh = TCPWND_MAX;
+}
+
+static void
+tcp_local_acked(struct tcp_pcb *pcb, tcpwnd_size_t acked)
+{
+  LWIP_UNUSED_ARG(pcb);
+  LWIP_UNUSED_ARG(acked);
+}
+
+static void
+tcp_local_loss(struct tcp_pcb *pcb, u8_t rto)
+{
+  LWIP_UNUSED_ARG(rto);
+
+  /* losses on the link come from a full queue rather than congestion,
+     keep the window and have fast recovery end at it again */
+  pcb->cwnd = TCPWND_MAX;
+  pcb->ssthresh = TCPWND_MAX;
+}
+
+const struct tcp_cc_ops tcp_cc_local = {
+  "local",
+  tcp_local_init,
+  tcp_local_acked,
+  tcp_local_loss
+};
+
+/**
+ * @ingroup tcp_raw
+ * Set the congestion control of pcbs allocated from now on, NULL for Reno.
+ */
+void
+tcp_set_default_cc(const struct tcp_cc_ops *cc)
+{
+  LWIP_ASSERT_CORE_LOCKED();
+
+  tcp_cc_default = cc != NULL ? cc : &tcp_cc_reno;
+}
+
+/**
+ * @ingroup tcp_raw
+ * Switch the congestion control of a pcb, NULL for Reno. An established
+ * connection restarts from the initial window of the new algorithm.
+ */
+void
+tcp_set_cc(struct tcp_pcb *pcb, const struct tcp_cc_ops *cc)
+{
+  LWIP_ASSERT_CORE_LOCKED();
+
+  LWIP_ERROR("tcp_set_cc: invalid pcb", pcb != NULL, return);
+  LWIP_ASSERT("tcp_set_cc: not for listen-pcbs", pcb->state != LISTEN);
+
+  pcb->cc = cc != NULL ? cc : &tcp_cc_reno;
+  pcb->cc_epoch = 0;
+  pcb->cc_wmax = 0;
+
+  if (pcb->state >= ESTABLISHED) {
+#if LWIP_TCP_BUFFERS
+    pcb->ssthresh = pcb->snd_buf_size;
+#else /* LWIP_TCP_BUFFERS */
+    pcb->ssthresh = TCP_SND_BUF;
+#endif /* LWIP_TCP_BUFFERS */
+    pcb->bytes_acked = 0;
+    pcb->cc->init(pcb);
+  }
+}
+
+#endif /* LWIP_TCP && LWIP_TCP_CC */
@@ -65,9 +65,6 @@
 #include LWIP_HOOK_FILENAME
 #endif
 
-/** Initial CWND calculation as defined RFC 2581 */
-#define LWIP_TCP_CALC_INITIAL_CWND(mss) ((tcpwnd_size_t)LWIP_MIN((4U * (mss)), LWIP_MAX((2U * (mss)), 4380U)))
-
 /* These variables are global to all functions involved in the input
    processing of TCP segments. They are set by the tcp_input()
    function. */
@@ -92,7 +89,7 @@ static err_t tcp_process(struct tcp_pcb *pcb);
 static void tcp_receive(struct tcp_pcb *pcb);
 static void tcp_parseopt(struct tcp_pcb *pcb);
 
-static void tcp_listen_input(struct tcp_pcb_listen *pcb);
+static struct tcp_pcb *tcp_listen_input(struct tcp_pcb_listen *pcb);
 static void tcp_timewait_input(struct tcp_pcb *pcb);
 
 static int tcp_input_delayed_close(struct tcp_pcb *pcb);
@@ -247,6 +244,28 @@ tcp_input(struct pbuf *p, struct netif *inp)
      for an active connection. */
   prev = NULL;
 
+#if LWIP_PCB_HASH
+  pcb = tcp_pcb_hash_lookup(ip_current_dest_addr(), tcphdr->dest, ip_current_src_addr(), tcphdr->src);
+
+  /* check if PCB is bound to specific netif */
+  if ((pcb != NULL) && (pcb->netif_idx != NETIF_NO_INDEX) &&
+      (pcb->netif_idx != netif_get_index(ip_data.current_input_netif))) {
+    pcb = NULL;
+  }
+
+  if ((pcb != NULL) && (pcb->state == TIME_WAIT)) {
+    LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_input: packed for TIME_WAITing connection.\n"));
+#ifdef LWIP_HOOK_TCP_INPACKET_PCB
+    if (LWIP_HOOK_TCP_INPACKET_PCB(pcb, tcphdr, tcphdr_optlen, tcphdr_opt1len,
+                                   tcphdr_opt2, p) == ERR_OK)
+#endif
+    {
+      tcp_timewait_input(pcb);
+    }
+    pbuf_free(p);
+    return;
+  }
+#else /* LWIP_PCB_HASH */
   for (pcb = tcp_active_pcbs; pcb != NULL; pcb = pcb->next) {
     LWIP_ASSERT("tcp_input: active pcb->state != CLOSED", pcb->state != CLOSED);
     LWIP_ASSERT("tcp_input: active pcb->state != TIME-WAIT", pcb->state != TIME_WAIT);
@@ -268,9 +287,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
          arrivals). */
       LWIP_ASSERT("tcp_input: pcb->next != pcb (before cache)", pcb->next != pcb);
       if (prev != NULL) {
-        prev->next = pcb->next;
-        pcb->next = tcp_active_pcbs;
-        tcp_active_pcbs = pcb;
+        TCP_LIST_FRONT(&tcp_active_pcbs, prev, pcb);
       } else {
         TCP_STATS_INC(tcp.cachehit);
       }
@@ -279,8 +296,10 @@ tcp_input(struct pbuf *p, struct netif *inp)
     }
     prev = pcb;
   }
+#endif /* LWIP_PCB_HASH */
 
   if (pcb == NULL) {
+#if !LWIP_PCB_HASH
     /* If it did not go to an active connection, we check the connections
        in the TIME-WAIT state. */
     for (pcb = tcp_tw_pcbs; pcb != NULL; pcb = pcb->next) {
@@ -311,6 +330,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
         return;
       }
     }
+#endif /* !LWIP_PCB_HASH */
 
     /* Finally, if we still did not get a match, we check all PCBs that
        are LISTENing for incoming connections. */
@@ -366,11 +386,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
          lookups will be faster (we exploit locality in TCP segment
          arrivals). */
       if (prev != NULL) {
-        ((struct tcp_pcb_listen *)prev)->next = lpcb->next;
-        /* our successor is the remainder of the listening list */
-        lpcb->next = tcp_listen_pcbs.listen_pcbs;
-        /* put this listening pcb at the head of the listening list */
-        tcp_listen_pcbs.listen_pcbs = lpcb;
+        TCP_LIST_FRONT(&tcp_listen_pcbs.pcbs, prev, (struct tcp_pcb *)lpcb);
       } else {
         TCP_STATS_INC(tcp.cachehit);
       }
@@ -381,10 +397,13 @@ tcp_input(struct pbuf *p, struct netif *inp)
                                      tcphdr_opt1len, tcphdr_opt2, p) == ERR_OK)
 #endif
       {
-        tcp_listen_input(lpcb);
+        /* the final ACK of a SYN cookie handshake goes on to the pcb it created */
+        pcb = tcp_listen_input(lpcb);
+      }
+      if (pcb == NULL) {
+        pbuf_free(p);
+        return;
       }
-      pbuf_free(p);
-      return;
     }
   }
 
@@ -404,6 +423,10 @@ tcp_input(struct pbuf *p, struct netif *inp)
 #endif
   if (pcb != NULL) {
     /* The incoming segment belongs to a connection. */
+    TCP_TIMER_TOUCH(pcb);
+#if LWIP_TCP_PCB_STATS
+    pcb->stats_segs_in++;
+#endif /* LWIP_TCP_PCB_STATS */
 #if TCP_INPUT_DEBUG
     tcp_debug_print_state(pcb->state);
 #endif /* TCP_INPUT_DEBUG */
@@ -458,6 +481,9 @@ tcp_input(struct pbuf *p, struct netif *inp)
            now. */
         if (recv_acked > 0) {
           u16_t acked16;
+#if LWIP_TCP_PCB_STATS
+          pcb->stats_bytes_out += recv_acked;
+#endif /* LWIP_TCP_PCB_STATS */
 #if LWIP_WND_SCALE
           /* recv_acked is u32_t but the sent callback only takes a u16_t,
              so we might have to call it multiple times. */
@@ -501,6 +527,9 @@ tcp_input(struct pbuf *p, struct netif *inp)
             goto aborted;
           }
 
+#if LWIP_TCP_PCB_STATS
+          pcb->stats_bytes_in += recv_data->tot_len;
+#endif /* LWIP_TCP_PCB_STATS */
           /* Notify application that data has been received. */
           TCP_EVENT_RECV(pcb, recv_data, ERR_OK, err);
           if (err == ERR_ABRT) {
@@ -621,16 +650,136 @@ tcp_input_delayed_close(struct tcp_pcb *pcb)
   return 0;
 }
 
+#if LWIP_TCP_SYN_COOKIES
+/** Set up a scratch pcb with the addresses and ports of the segment */
+static void
+tcp_listen_syncookie_pcb(struct tcp_pcb_listen *pcb, struct tcp_pcb *tmp)
+{
+  memset(tmp, 0, sizeof(*tmp));
+  ip_addr_copy(tmp->local_ip, *ip_current_dest_addr());
+  ip_addr_copy(tmp->remote_ip, *ip_current_src_addr());
+#if TCP_ACCEPT_ANY_PORT
+  LWIP_UNUSED_ARG(pcb);
+  tmp->local_port = tcphdr->dest;
+#else
+  tmp->local_port = pcb->local_port;
+#endif
+  tmp->remote_port = tcphdr->src;
+}
+
+/**
+ * Answer a SYN with a SYN cookie instead of a SYN_RCVD pcb.
+ */
+static void
+tcp_listen_syncookie_syn(struct tcp_pcb_listen *pcb)
+{
+  struct tcp_pcb syn;
+
+  tcp_listen_syncookie_pcb(pcb, &syn);
+  syn.rcv_nxt = seqno + 1;
+  syn.mss = 536; /* without an MSS option, RFC 1122 */
+#if LWIP_TCP_BUFFERS
+  syn.rcv_buf = TCP_WND;
+#endif /* LWIP_TCP_BUFFERS */
+  syn.rcv_wnd = syn.rcv_ann_wnd = TCPWND_MIN16(TCP_WND);
+  tcp_parseopt(&syn);
+
+  tcp_syncookie_synack(&syn, tcp_syncookie_make(&syn));
+}
+
+/**
+ * Create the pcb of a connection whose final ACK returns one of our SYN
+ * cookies. The pcb starts in SYN_RCVD as if it had sent the SYN|ACK, so that
+ * tcp_process() establishes it and handles any data in the ACK.
+ *
+ * @return the new pcb, NULL if the ACK was answered with a RST or dropped
+ */
+static struct tcp_pcb *
+tcp_listen_syncookie_ack(struct tcp_pcb_listen *pcb)
+{
+  struct tcp_pcb ack;
+  struct tcp_pcb *npcb;
+  u32_t iss = ackno - 1;
+
+  tcp_listen_syncookie_pcb(pcb, &ack);
+  ack.rcv_nxt = seqno;
+  if (!tcp_syncookie_check(&ack, iss)) {
+    LWIP_DEBUGF(TCP_RST_DEBUG, ("tcp_listen_input: ACK in LISTEN without a cookie, sending reset\n"));
+    tcp_rst((const struct tcp_pcb *)pcb, ackno, seqno + tcplen, ip_current_dest_addr(),
+            ip_current_src_addr(), tcphdr->dest, tcphdr->src);
+    return NULL;
+  }
+#if TCP_LISTEN_BACKLOG
+  if (pcb->accepts_pending >= pcb->backlog) {
+    /* as with a full accept queue: drop the ACK, the client resends any data */
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_listen_input: listen backlog exceeded for port %"U16_F"\n", tcphdr->dest));
+    return NULL;
+  }
+#endif /* TCP_LISTEN_BACKLOG */
+  npcb = tcp_alloc(pcb->prio);
+  if (npcb == NULL) {
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_listen_input: could not allocate PCB\n"));
+    TCP_STATS_INC(tcp.memerr);
+    return NULL;
+  }
+#if TCP_LISTEN_BACKLOG
+  pcb->accepts_pending++;
+  tcp_set_flags(npcb, TF_BACKLOGPEND);
+#endif /* TCP_LISTEN_BACKLOG */
+  ip_addr_copy(npcb->local_ip, ack.local_ip);
+  ip_addr_copy(npcb->remote_ip, ack.remote_ip);
+  npcb->local_port = ack.local_port;
+  npcb->remote_port = ack.remote_port;
+  npcb->state = SYN_RCVD;
+  npcb->rcv_nxt = seqno;
+  npcb->rcv_ann_right_edge = npcb->rcv_nxt;
+  /* the SYN|ACK is sent and only waits for this ACK */
+  npcb->snd_wl2 = iss;
+  npcb->lastack = iss;
+  npcb->snd_nxt = iss + 1;
+  npcb->snd_lbb = iss + 1;
+  npcb->snd_wl1 = seqno - 1;/* initialise to seqno-1 to force window update */
+  npcb->callback_arg = pcb->callback_arg;
+#if LWIP_CALLBACK_API || TCP_LISTEN_BACKLOG
+  npcb->listener = pcb;
+#endif /* LWIP_CALLBACK_API || TCP_LISTEN_BACKLOG */
+  /* inherit socket options */
+  npcb->so_options = pcb->so_options & SOF_INHERITED;
+  npcb->netif_idx = pcb->netif_idx;
+  TCP_REG_ACTIVE(npcb);
+
+  tcp_syncookie_restore(npcb, iss);
+  npcb->snd_wnd = SND_WND_SCALE(npcb, tcphdr->wnd);
+  npcb->snd_wnd_max = npcb->snd_wnd;
+
+#if TCP_CALCULATE_EFF_SEND_MSS
+  npcb->mss = tcp_eff_send_mss(npcb->mss, &npcb->local_ip, &npcb->remote_ip);
+#endif /* TCP_CALCULATE_EFF_SEND_MSS */
+
+  MIB2_STATS_INC(mib2.tcppassiveopens);
+
+#if LWIP_TCP_PCB_NUM_EXT_ARGS
+  if (tcp_ext_arg_invoke_callbacks_passive_open(pcb, npcb) != ERR_OK) {
+    tcp_abandon(npcb, 0);
+    return NULL;
+  }
+#endif
+  return npcb;
+}
+#endif /* LWIP_TCP_SYN_COOKIES */
+
 /**
  * Called by tcp_input() when a segment arrives for a listening
  * connection (from tcp_input()).
  *
  * @param pcb the tcp_pcb_listen for which a segment arrived
+ * @return the pcb created by the final ACK of a SYN cookie handshake, which
+ *         the segment is processed for next, NULL otherwise
  *
  * @note the segment which arrived is saved in global variables, therefore only the pcb
  *       involved is passed as a parameter to this function
  */
-static void
+static struct tcp_pcb *
 tcp_listen_input(struct tcp_pcb_listen *pcb)
 {
   struct tcp_pcb *npcb;
@@ -639,7 +788,7 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
 
   if (flags & TCP_RST) {
     /* An incoming RST should be ignored. Return. */
-    return;
+    return NULL;
   }
 
   LWIP_ASSERT("tcp_listen_input: invalid pcb", pcb != NULL);
@@ -647,6 +796,11 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
   /* In the LISTEN state, we check for incoming SYN segments,
      creates a new PCB, and responds with a SYN|ACK. */
   if (flags & TCP_ACK) {
+#if LWIP_TCP_SYN_COOKIES
+    if (!(flags & TCP_SYN)) {
+      return tcp_listen_syncookie_ack(pcb);
+    }
+#endif /* LWIP_TCP_SYN_COOKIES */
     /* For incoming segments with the ACK flag set, respond with a
        RST. */
     LWIP_DEBUGF(TCP_RST_DEBUG, ("tcp_listen_input: ACK in LISTEN, sending reset\n"));
@@ -654,10 +808,15 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
             ip_current_src_addr(), tcphdr->dest, tcphdr->src);
   } else if (flags & TCP_SYN) {
     LWIP_DEBUGF(TCP_DEBUG, ("TCP connection request %"U16_F" -> %"U16_F".\n", tcphdr->src, tcphdr->dest));
-#if TCP_LISTEN_BACKLOG
+#if LWIP_TCP_SYN_COOKIES && TCP_LISTEN_BACKLOG
+    if (pcb->accepts_pending >= LWIP_MIN(TCP_SYNCOOKIE_PENDING, pcb->backlog)) {
+      tcp_listen_syncookie_syn(pcb);
+      return NULL;
+    }
+#elif TCP_LISTEN_BACKLOG
     if (pcb->accepts_pending >= pcb->backlog) {
       LWIP_DEBUGF(TCP_DEBUG, ("tcp_listen_input: listen backlog exceeded for port %"U16_F"\n", tcphdr->dest));
-      return;
+      return NULL;
     }
 #endif /* TCP_LISTEN_BACKLOG */
     npcb = tcp_alloc(pcb->prio);
@@ -665,12 +824,19 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
        we don't do anything, but rely on the sender will retransmit the
        SYN at a time when we have more memory available. */
     if (npcb == NULL) {
-      err_t err;
       LWIP_DEBUGF(TCP_DEBUG, ("tcp_listen_input: could not allocate PCB\n"));
       TCP_STATS_INC(tcp.memerr);
-      TCP_EVENT_ACCEPT(pcb, NULL, pcb->callback_arg, ERR_MEM, err);
-      LWIP_UNUSED_ARG(err); /* err not useful here */
-      return;
+#if LWIP_TCP_SYN_COOKIES
+      /* no memory for a pcb now, the final ACK may find some */
+      tcp_listen_syncookie_syn(pcb);
+#else /* LWIP_TCP_SYN_COOKIES */
+      {
+        err_t err;
+        TCP_EVENT_ACCEPT(pcb, NULL, pcb->callback_arg, ERR_MEM, err);
+        LWIP_UNUSED_ARG(err); /* err not useful here */
+      }
+#endif /* LWIP_TCP_SYN_COOKIES */
+      return NULL;
     }
 #if TCP_LISTEN_BACKLOG
     pcb->accepts_pending++;
@@ -719,7 +885,7 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
 #if LWIP_TCP_PCB_NUM_EXT_ARGS
     if (tcp_ext_arg_invoke_callbacks_passive_open(pcb, npcb) != ERR_OK) {
       tcp_abandon(npcb, 0);
-      return;
+      return NULL;
     }
 #endif
 
@@ -727,11 +893,11 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
     rc = tcp_enqueue_flags(npcb, TCP_SYN | TCP_ACK);
     if (rc != ERR_OK) {
       tcp_abandon(npcb, 0);
-      return;
+      return NULL;
     }
     tcp_output(npcb);
   }
-  return;
+  return NULL;
 }
 
 /**
@@ -877,7 +1043,11 @@ tcp_process(struct tcp_pcb *pcb)
         pcb->mss = tcp_eff_send_mss(pcb->mss, &pcb->local_ip, &pcb->remote_ip);
 #endif /* TCP_CALCULATE_EFF_SEND_MSS */
 
+#if LWIP_TCP_CC
+        pcb->cc->init(pcb);
+#else /* LWIP_TCP_CC */
         pcb->cwnd = LWIP_TCP_CALC_INITIAL_CWND(pcb->mss);
+#endif /* LWIP_TCP_CC */
         LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_process (SENT): cwnd %"TCPWNDSIZE_F
                                      " ssthresh %"TCPWNDSIZE_F"\n",
                                      pcb->cwnd, pcb->ssthresh));
@@ -965,7 +1135,11 @@ tcp_process(struct tcp_pcb *pcb)
             recv_acked--;
           }
 
+#if LWIP_TCP_CC
+          pcb->cc->init(pcb);
+#else /* LWIP_TCP_CC */
           pcb->cwnd = LWIP_TCP_CALC_INITIAL_CWND(pcb->mss);
+#endif /* LWIP_TCP_CC */
           LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_process (SYN_RCVD): cwnd %"TCPWNDSIZE_F
                                        " ssthresh %"TCPWNDSIZE_F"\n",
                                        pcb->cwnd, pcb->ssthresh));
@@ -1262,6 +1436,9 @@ tcp_receive(struct tcp_pcb *pcb)
       /* Update the congestion control variables (cwnd and
          ssthresh). */
       if (pcb->state >= ESTABLISHED) {
+#if LWIP_TCP_CC
+        pcb->cc->acked(pcb, acked);
+#else /* LWIP_TCP_CC */
         if (pcb->cwnd < pcb->ssthresh) {
           tcpwnd_size_t increase;
           /* limit to 1 SMSS segment during period following RTO */
@@ -1279,6 +1456,7 @@ tcp_receive(struct tcp_pcb *pcb)
           }
           LWIP_DEBUGF(TCP_CWND_DEBUG, ("tcp_receive: congestion avoidance cwnd %"TCPWNDSIZE_F"\n", pcb->cwnd));
         }
+#endif /* LWIP_TCP_CC */
       }
       LWIP_DEBUGF(TCP_INPUT_DEBUG, ("tcp_receive: ACK for %"U32_F", unacked->seqno %"U32_F":%"U32_F"\n",
                                     ackno,
@@ -1321,7 +1499,14 @@ tcp_receive(struct tcp_pcb *pcb)
       }
 #endif /* LWIP_IPV6 && LWIP_ND6_TCP_REACHABILITY_HINTS*/
 
+#if LWIP_TCP_BUFFERS
+      /* the send buffer may have shrunk while the data was in flight */
+      pcb->snd_queued = (tcpwnd_size_t)(pcb->snd_queued - recv_acked);
+      pcb->snd_buf = (pcb->snd_buf_size > pcb->snd_queued) ?
+                     (tcpwnd_size_t)(pcb->snd_buf_size - pcb->snd_queued) : 0;
+#else /* LWIP_TCP_BUFFERS */
       pcb->snd_buf = (tcpwnd_size_t)(pcb->snd_buf + recv_acked);
+#endif /* LWIP_TCP_BUFFERS */
       /* check if this ACK ends our retransmission of in-flight data */
       if (pcb->flags & TF_RTO) {
         /* RTO is done if
@@ -1970,9 +2155,9 @@ tcp_parseopt(struct tcp_pcb *pcb)
             pcb->rcv_scale = TCP_RCV_SCALE;
             tcp_set_flags(pcb, TF_WND_SCALE);
             /* window scaling is enabled, we can use the full receive window */
-            LWIP_ASSERT("window not at default value", pcb->rcv_wnd == TCPWND_MIN16(TCP_WND));
-            LWIP_ASSERT("window not at default value", pcb->rcv_ann_wnd == TCPWND_MIN16(TCP_WND));
-            pcb->rcv_wnd = pcb->rcv_ann_wnd = TCP_WND;
+            LWIP_ASSERT("window not at default value", pcb->rcv_wnd == TCPWND_MIN16(TCP_RCV_BUF(pcb)));
+            LWIP_ASSERT("window not at default value", pcb->rcv_ann_wnd == TCPWND_MIN16(TCP_RCV_BUF(pcb)));
+            pcb->rcv_wnd = pcb->rcv_ann_wnd = TCP_RCV_BUF(pcb);
           }
           break;
 #endif /* LWIP_WND_SCALE */
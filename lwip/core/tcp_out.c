@@ -330,9 +330,9 @@ tcp_write_checks(struct tcp_pcb *pcb, u16_t len)
   /* If total number of pbufs on the unsent/unacked queues exceeds the
    * configured maximum, return an error */
   /* check for configured max queuelen and possible overflow */
-  if (pcb->snd_queuelen >= LWIP_MIN(TCP_SND_QUEUELEN, (TCP_SNDQUEUELEN_OVERFLOW + 1))) {
+  if (pcb->snd_queuelen >= TCP_SND_QUEUELEN_MAX(pcb)) {
     LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SEVERE, ("tcp_write: too long queue %"U16_F" (max %"U16_F")\n",
-                pcb->snd_queuelen, (u16_t)TCP_SND_QUEUELEN));
+                pcb->snd_queuelen, (u16_t)TCP_SND_QUEUELEN_MAX(pcb)));
     TCP_STATS_INC(tcp.memerr);
     tcp_set_flags(pcb, TF_NAGLEMEMERR);
     return ERR_MEM;
@@ -417,6 +417,21 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
   mss_local = LWIP_MIN(pcb->mss, TCPWND_MIN16(pcb->snd_wnd_max / 2));
   mss_local = mss_local ? mss_local : pcb->mss;
 
+#if LWIP_TCP_GSO
+  if (mss_local == pcb->mss) {
+    struct netif *netif = tcp_route(pcb, &pcb->local_ip, &pcb->remote_ip);
+
+    if ((netif != NULL) && (netif->flags & NETIF_FLAG_TSO)) {
+      /* multiple of mss, segmented by the device */
+      u32_t gso = LWIP_MIN(TCP_GSO_MAX_SIZE, pcb->snd_wnd_max / 2);
+      gso -= gso % pcb->mss;
+      if (gso > mss_local) {
+        mss_local = (u16_t)gso;
+      }
+    }
+  }
+#endif // LWIP_TCP_GSO
+
   LWIP_ASSERT_CORE_LOCKED();
 
 #if LWIP_NETIF_TX_SINGLE_PBUF
@@ -433,6 +448,7 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
   if (err != ERR_OK) {
     return err;
   }
+  TCP_TIMER_TOUCH(pcb);
   queuelen = pcb->snd_queuelen;
 
 #if LWIP_TCP_TIMESTAMPS
@@ -561,13 +577,22 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
           LWIP_ASSERT("tcp_write: ROM pbufs cannot be oversized", pos == 0);
           extendlen = seglen;
         } else {
-          if ((concat_p = pbuf_alloc(PBUF_RAW, seglen, PBUF_ROM)) == NULL) {
-            LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SERIOUS,
-                        ("tcp_write: could not allocate memory for zero-copy pbuf\n"));
-            goto memerr;
+#if LWIP_TCP_WRITE_REF
+          if (apiflags & TCP_WRITE_FLAG_REF) {
+            if ((concat_p = LWIP_HOOK_TCP_WRITE_REF(pcb, (const u8_t *)arg + pos, seglen)) == NULL) {
+              goto memerr;
+            }
+          } else
+#endif /* LWIP_TCP_WRITE_REF */
+          {
+            if ((concat_p = pbuf_alloc(PBUF_RAW, seglen, PBUF_ROM)) == NULL) {
+              LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SERIOUS,
+                          ("tcp_write: could not allocate memory for zero-copy pbuf\n"));
+              goto memerr;
+            }
+            /* reference the non-volatile payload data */
+            ((struct pbuf_rom *)concat_p)->payload = (const u8_t *)arg + pos;
           }
-          /* reference the non-volatile payload data */
-          ((struct pbuf_rom *)concat_p)->payload = (const u8_t *)arg + pos;
           queuelen += pbuf_clen(concat_p);
         }
 #if TCP_CHECKSUM_ON_COPY
@@ -624,7 +649,15 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
 #if TCP_OVERSIZE
       LWIP_ASSERT("oversize == 0", oversize == 0);
 #endif /* TCP_OVERSIZE */
-      if ((p2 = pbuf_alloc(PBUF_TRANSPORT, seglen, PBUF_ROM)) == NULL) {
+#if LWIP_TCP_WRITE_REF
+      if (apiflags & TCP_WRITE_FLAG_REF) {
+        p2 = LWIP_HOOK_TCP_WRITE_REF(pcb, (const u8_t *)arg + pos, seglen);
+      } else
+#endif /* LWIP_TCP_WRITE_REF */
+      {
+        p2 = pbuf_alloc(PBUF_TRANSPORT, seglen, PBUF_ROM);
+      }
+      if (p2 == NULL) {
         LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("tcp_write: could not allocate memory for zero-copy pbuf\n"));
         goto memerr;
       }
@@ -637,7 +670,12 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
       }
 #endif /* TCP_CHECKSUM_ON_COPY */
       /* reference the non-volatile payload data */
-      ((struct pbuf_rom *)p2)->payload = (const u8_t *)arg + pos;
+#if LWIP_TCP_WRITE_REF
+      if (!(apiflags & TCP_WRITE_FLAG_REF))
+#endif /* LWIP_TCP_WRITE_REF */
+      {
+        ((struct pbuf_rom *)p2)->payload = (const u8_t *)arg + pos;
+      }
 
       /* Second, allocate a pbuf for the headers. */
       if ((p = pbuf_alloc(PBUF_TRANSPORT, optlen, PBUF_RAM)) == NULL) {
@@ -656,9 +694,9 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
     /* Now that there are more segments queued, we check again if the
      * length of the queue exceeds the configured maximum or
      * overflows. */
-    if (queuelen > LWIP_MIN(TCP_SND_QUEUELEN, TCP_SNDQUEUELEN_OVERFLOW)) {
+    if (queuelen > TCP_SND_QUEUELEN_MAX(pcb)) {
       LWIP_DEBUGF(TCP_OUTPUT_DEBUG | LWIP_DBG_LEVEL_SERIOUS, ("tcp_write: queue too long %"U16_F" (%d)\n",
-                  queuelen, (int)TCP_SND_QUEUELEN));
+                  queuelen, (int)TCP_SND_QUEUELEN_MAX(pcb)));
       pbuf_free(p);
       goto memerr;
     }
@@ -778,6 +816,9 @@ tcp_write(struct tcp_pcb *pcb, const void *arg, u16_t len, u8_t apiflags)
    */
   pcb->snd_lbb += len;
   pcb->snd_buf -= len;
+#if LWIP_TCP_BUFFERS
+  pcb->snd_queued += len;
+#endif /* LWIP_TCP_BUFFERS */
   pcb->snd_queuelen = queuelen;
 
   LWIP_DEBUGF(TCP_QLEN_DEBUG, ("tcp_write: %"S16_F" (after enqueued)\n",
@@ -856,7 +897,9 @@ tcp_split_unsent_seg(struct tcp_pcb *pcb, u16_t split)
     return ERR_OK;
   }
 
+#if !LWIP_TCP_GSO
   LWIP_ASSERT("split <= mss", split <= pcb->mss);
+#endif // LWIP_TCP_GSO
   LWIP_ASSERT("useg->len > 0", useg->len > 0);
 
   /* We should check that we don't exceed TCP_SND_QUEUELEN but we need
@@ -1259,6 +1302,8 @@ tcp_output(struct tcp_pcb *pcb)
     return ERR_OK;
   }
 
+  TCP_TIMER_TOUCH(pcb);
+
   wnd = LWIP_MIN(pcb->snd_wnd, pcb->cwnd);
 
   seg = pcb->unsent;
@@ -1301,6 +1346,20 @@ tcp_output(struct tcp_pcb *pcb)
     ip_addr_copy(pcb->local_ip, *local_ip);
   }
 
+#if LWIP_TCP_GSO
+  /* A GSO segment may be larger than the whole window, send the mss multiple that fits */
+  if ((seg->len > pcb->mss) && (lwip_ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len > wnd)) {
+    u32_t inflight = lwip_ntohl(seg->tcphdr->seqno) - pcb->lastack;
+
+    if (wnd >= inflight + pcb->mss) {
+      u32_t split = wnd - inflight;
+      split -= split % pcb->mss;
+      tcp_split_unsent_seg(pcb, (u16_t)split);
+      seg = pcb->unsent;
+    }
+  }
+#endif // LWIP_TCP_GSO
+
   /* Handle the current segment not fitting within the window */
   if (lwip_ntohl(seg->tcphdr->seqno) - pcb->lastack + seg->len > wnd) {
     /* We need to start the persistent timer when the next unsent segment does not fit
@@ -1558,6 +1617,10 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb, struct netif *netif
 
   seg->tcphdr->chksum = 0;
 
+#if LWIP_TCP_GSO
+  seg->p->gso_size = (seg->len > pcb->mss) ? pcb->mss : 0;
+#endif // LWIP_TCP_GSO
+
 #ifdef LWIP_HOOK_TCP_OUT_ADD_TCPOPTS
   opts = LWIP_HOOK_TCP_OUT_ADD_TCPOPTS(seg->p, seg->tcphdr, pcb, opts);
 #endif
@@ -1602,6 +1665,13 @@ tcp_output_segment(struct tcp_seg *seg, struct tcp_pcb *pcb, struct netif *netif
   }
 #endif /* CHECKSUM_GEN_TCP */
   TCP_STATS_INC(tcp.xmit);
+#if LWIP_TCP_PCB_STATS
+  pcb->stats_segs_out++;
+  /* snd_nxt never moves back, anything sent below it was sent before */
+  if (TCP_SEQ_LT(lwip_ntohl(seg->tcphdr->seqno), pcb->snd_nxt)) {
+    pcb->stats_rexmits++;
+  }
+#endif /* LWIP_TCP_PCB_STATS */
 
   NETIF_SET_HINTS(netif, &(pcb->netif_hints));
   err = ip_output_if(seg->p, &pcb->local_ip, &pcb->remote_ip, pcb->ttl,
@@ -1792,6 +1862,9 @@ tcp_rexmit_fast(struct tcp_pcb *pcb)
                  (u16_t)pcb->dupacks, pcb->lastack,
                  lwip_ntohl(pcb->unacked->tcphdr->seqno)));
     if (tcp_rexmit(pcb) == ERR_OK) {
+#if LWIP_TCP_CC
+      pcb->cc->loss(pcb, 0);
+#else /* LWIP_TCP_CC */
       /* Set ssthresh to half of the minimum of the current
        * cwnd and the advertised window */
       pcb->ssthresh = LWIP_MIN(pcb->cwnd, pcb->snd_wnd) / 2;
@@ -1806,6 +1879,7 @@ tcp_rexmit_fast(struct tcp_pcb *pcb)
       }
 
       pcb->cwnd = pcb->ssthresh + 3 * pcb->mss;
+#endif /* LWIP_TCP_CC */
       tcp_set_flags(pcb, TF_INFR);
 
       /* Reset the retransmission timer to prevent immediate rto retransmissions */
@@ -1940,6 +2014,12 @@ tcp_output_control_segment(const struct tcp_pcb *pcb, struct pbuf *p,
 #endif
     if (pcb != NULL) {
       NETIF_SET_HINTS(netif, LWIP_CONST_CAST(struct netif_hint*, &(pcb->netif_hints)));
+#if LWIP_TCP_PCB_STATS
+      /* a RST from tcp_listen_input passes a struct tcp_pcb_listen, which has no counters */
+      if (pcb->state != LISTEN) {
+        LWIP_CONST_CAST(struct tcp_pcb *, pcb)->stats_segs_out++;
+      }
+#endif /* LWIP_TCP_PCB_STATS */
       ttl = pcb->ttl;
       tos = pcb->tos;
     } else {
@@ -2010,6 +2090,67 @@ tcp_rst(const struct tcp_pcb *pcb, u32_t seqno, u32_t ackno,
   LWIP_DEBUGF(TCP_RST_DEBUG, ("tcp_rst: seqno %"U32_F" ackno %"U32_F".\n", seqno, ackno));
 }
 
+#if LWIP_TCP_SYN_COOKIES
+/**
+ * Send a SYN|ACK carrying a SYN cookie. Nothing is queued or retransmitted:
+ * the client retransmits its SYN if this segment is lost.
+ *
+ * @param syn pcb holding the addresses, ports, rcv_nxt and the options parsed
+ *            from the SYN, as for tcp_syncookie_make()
+ * @param iss the cookie
+ */
+void
+tcp_syncookie_synack(const struct tcp_pcb *syn, u32_t iss)
+{
+  struct pbuf *p;
+  u32_t *opts;
+  u16_t mss;
+  u8_t optflags = TF_SEG_OPTS_MSS;
+
+#if LWIP_WND_SCALE
+  if (syn->flags & TF_WND_SCALE) {
+    optflags |= TF_SEG_OPTS_WND_SCALE;
+  }
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_SACK_OUT
+  if (syn->flags & TF_SACK) {
+    optflags |= TF_SEG_OPTS_SACK_PERM;
+  }
+#endif /* LWIP_TCP_SACK_OUT */
+
+  /* the window of a SYN is never scaled */
+  p = tcp_output_alloc_header_common(syn->rcv_nxt, LWIP_TCP_OPT_LENGTH(optflags), 0,
+    lwip_htonl(iss), syn->local_port, syn->remote_port, TCP_SYN | TCP_ACK,
+    TCPWND_MIN16(TCP_WND));
+  if (p == NULL) {
+    LWIP_DEBUGF(TCP_DEBUG, ("tcp_syncookie_synack: could not allocate memory for pbuf\n"));
+    return;
+  }
+
+  opts = (u32_t *)(void *)((struct tcp_hdr *)p->payload + 1);
+#if TCP_CALCULATE_EFF_SEND_MSS
+  mss = tcp_eff_send_mss(TCP_MSS, &syn->local_ip, &syn->remote_ip);
+#else /* TCP_CALCULATE_EFF_SEND_MSS */
+  mss = TCP_MSS;
+#endif /* TCP_CALCULATE_EFF_SEND_MSS */
+  *(opts++) = TCP_BUILD_MSS_OPTION(mss);
+#if LWIP_WND_SCALE
+  if (optflags & TF_SEG_OPTS_WND_SCALE) {
+    tcp_build_wnd_scale_option(opts++);
+  }
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_SACK_OUT
+  if (optflags & TF_SEG_OPTS_SACK_PERM) {
+    *(opts++) = PP_HTONL(0x01010402);
+  }
+#endif /* LWIP_TCP_SACK_OUT */
+  LWIP_UNUSED_ARG(opts);
+
+  tcp_output_control_segment(NULL, p, &syn->local_ip, &syn->remote_ip);
+  LWIP_DEBUGF(TCP_DEBUG, ("tcp_syncookie_synack: cookie %"U32_F" ackno %"U32_F".\n", iss, syn->rcv_nxt));
+}
+#endif /* LWIP_TCP_SYN_COOKIES */
+
 /**
  * Send an ACK without data.
  *
@@ -0,0 +1,266 @@
+/**
+ * @file
+ * SYN cookies and keyed initial sequence numbers (LWIP_TCP_SYN_COOKIES)
+ *
+ * A listener under pressure answers a SYN without allocating a pcb: the ISN
+ * of its SYN|ACK carries what the pcb would have remembered, authenticated by
+ * a keyed hash of the 4-tuple and the client's ISN. The pcb is only created
+ * once the client's ACK returns the cookie.
+ *
+ * Cookie layout (the ISN of the SYN|ACK):
+ *   31..30  time slot (sys_now() >> 16, about 65 seconds), current or previous
+ *   29..8   22 bits of keyed hash
+ *    7..0   SYN options: MSS index, window scale of the client, SACK permitted
+ */
+
+#include "lwip/opt.h"
+
+#if LWIP_TCP && LWIP_TCP_SYN_COOKIES
+
+#include "lwip/tcp.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/sys.h"
+
+#define TCP_SYNCOOKIE_MSS_MASK   0x07
+#define TCP_SYNCOOKIE_WS_SHIFT   3
+#define TCP_SYNCOOKIE_WS_MASK    0x0f
+#define TCP_SYNCOOKIE_WS_NONE    0x0f
+#define TCP_SYNCOOKIE_SACK       0x80
+
+#define TCP_SYNCOOKIE_SLOT(now)  ((now) >> 16)
+
+/* MSS values a cookie can restore, the client's MSS is rounded down to one of
+   them: the classic minimum, common MTUs of 1280 to 1500 and jumbo links */
+static const u16_t tcp_syncookie_mss[] = {
+  536, 1220, 1360, 1440, 1460, 4036, 8960, 65495
+};
+
+static u32_t tcp_syncookie_key[2];
+
+/** HalfSipHash-2-4 over 32-bit words */
+struct tcp_hsip {
+  u32_t v0, v1, v2, v3;
+  u32_t len;
+};
+
+#define TCP_HSIP_ROTL(x, b) (u32_t)(((x) << (b)) | ((x) >> (32 - (b))))
+
+static void
+tcp_hsip_round(struct tcp_hsip *s)
+{
+  s->v0 += s->v1;
+  s->v1 = TCP_HSIP_ROTL(s->v1, 5);
+  s->v1 ^= s->v0;
+  s->v0 = TCP_HSIP_ROTL(s->v0, 16);
+  s->v2 += s->v3;
+  s->v3 = TCP_HSIP_ROTL(s->v3, 8);
+  s->v3 ^= s->v2;
+  s->v0 += s->v3;
+  s->v3 = TCP_HSIP_ROTL(s->v3, 7);
+  s->v3 ^= s->v0;
+  s->v2 += s->v1;
+  s->v1 = TCP_HSIP_ROTL(s->v1, 13);
+  s->v1 ^= s->v2;
+  s->v2 = TCP_HSIP_ROTL(s->v2, 16);
+}
+
+static void
+tcp_hsip_init(struct tcp_hsip *s)
+{
+  s->v0 = tcp_syncookie_key[0];
+  s->v1 = tcp_syncookie_key[1];
+  s->v2 = 0x6c796765UL ^ tcp_syncookie_key[0];
+  s->v3 = 0x74656462UL ^ tcp_syncookie_key[1];
+  s->len = 0;
+}
+
+static void
+tcp_hsip_word(struct tcp_hsip *s, u32_t m)
+{
+  s->v3 ^= m;
+  tcp_hsip_round(s);
+  tcp_hsip_round(s);
+  s->v0 ^= m;
+  s->len += 4;
+}
+
+static void
+tcp_hsip_addr(struct tcp_hsip *s, const ip_addr_t *ip)
+{
+#if LWIP_IPV6
+  if (IP_IS_V6(ip)) {
+    int i;
+    for (i = 0; i < 4; i++) {
+      tcp_hsip_word(s, ip_2_ip6(ip)->addr[i]);
+    }
+    return;
+  }
+#endif /* LWIP_IPV6 */
+#if LWIP_IPV4
+  tcp_hsip_word(s, ip4_addr_get_u32(ip_2_ip4(ip)));
+#endif /* LWIP_IPV4 */
+}
+
+static u32_t
+tcp_hsip_final(struct tcp_hsip *s)
+{
+  u32_t b = s->len << 24;
+
+  s->v3 ^= b;
+  tcp_hsip_round(s);
+  tcp_hsip_round(s);
+  s->v0 ^= b;
+  s->v2 ^= 0xff;
+  tcp_hsip_round(s);
+  tcp_hsip_round(s);
+  tcp_hsip_round(s);
+  tcp_hsip_round(s);
+  return s->v1 ^ s->v3;
+}
+
+static void
+tcp_hsip_tuple(struct tcp_hsip *s, const struct tcp_pcb *pcb)
+{
+  tcp_hsip_init(s);
+  tcp_hsip_addr(s, &pcb->local_ip);
+  tcp_hsip_addr(s, &pcb->remote_ip);
+  tcp_hsip_word(s, ((u32_t)pcb->local_port << 16) | pcb->remote_port);
+}
+
+static u32_t
+tcp_syncookie_hash(const struct tcp_pcb *pcb, u32_t slot, u8_t opts)
+{
+  struct tcp_hsip s;
+
+  tcp_hsip_tuple(&s, pcb);
+  /* rcv_nxt is the client's ISN + 1 for both the SYN and its ACK */
+  tcp_hsip_word(&s, pcb->rcv_nxt);
+  tcp_hsip_word(&s, (slot << 8) | opts);
+  return tcp_hsip_final(&s);
+}
+
+/**
+ * Key the cookie and ISN hash, called once from tcp_init() so the first SYN
+ * never sees a guessable key. The port provides LWIP_RAND_BYTES() from the
+ * system entropy source, LWIP_RAND() alone is usually an unseeded rand().
+ */
+void
+tcp_syncookie_init(void)
+{
+#ifdef LWIP_RAND_BYTES
+  LWIP_RAND_BYTES(tcp_syncookie_key, sizeof(tcp_syncookie_key));
+#else /* LWIP_RAND_BYTES */
+  u32_t seed = sys_now() ^ (u32_t)(mem_ptr_t)&seed;
+#ifdef LWIP_RAND
+  tcp_syncookie_key[0] = LWIP_RAND() ^ seed;
+  tcp_syncookie_key[1] = LWIP_RAND() ^ TCP_HSIP_ROTL(seed, 16);
+#else /* LWIP_RAND */
+  tcp_syncookie_key[0] = seed;
+  tcp_syncookie_key[1] = TCP_HSIP_ROTL(seed, 16) ^ 0x9e3779b9UL;
+#endif /* LWIP_RAND */
+#endif /* LWIP_RAND_BYTES */
+}
+
+/**
+ * Cookie to send as the ISN of a SYN|ACK.
+ *
+ * @param syn pcb holding the addresses and ports, rcv_nxt and the options
+ *            parsed from the SYN (mss, TF_WND_SCALE/snd_scale, TF_SACK)
+ */
+u32_t
+tcp_syncookie_make(const struct tcp_pcb *syn)
+{
+  u32_t slot = TCP_SYNCOOKIE_SLOT(sys_now());
+  u8_t opts = 0;
+  u8_t i;
+
+  for (i = 1; i < LWIP_ARRAYSIZE(tcp_syncookie_mss); i++) {
+    if (tcp_syncookie_mss[i] > syn->mss) {
+      break;
+    }
+  }
+  opts |= (u8_t)(i - 1);
+#if LWIP_WND_SCALE
+  if (syn->flags & TF_WND_SCALE) {
+    opts |= (u8_t)(syn->snd_scale << TCP_SYNCOOKIE_WS_SHIFT);
+  } else
+#endif /* LWIP_WND_SCALE */
+  {
+    opts |= TCP_SYNCOOKIE_WS_NONE << TCP_SYNCOOKIE_WS_SHIFT;
+  }
+#if LWIP_TCP_SACK_OUT
+  if (syn->flags & TF_SACK) {
+    opts |= TCP_SYNCOOKIE_SACK;
+  }
+#endif /* LWIP_TCP_SACK_OUT */
+
+  return ((slot & 3) << 30) | ((tcp_syncookie_hash(syn, slot, opts) & 0x3fffff) << 8) | opts;
+}
+
+/**
+ * Check the cookie acknowledged by the final ACK of a handshake.
+ *
+ * @param ack pcb holding the addresses and ports and rcv_nxt (the sequence
+ *            number of the ACK)
+ * @param iss the acknowledged ISN (ackno - 1)
+ * @return 1 if the cookie is ours and recent, 0 otherwise
+ */
+u8_t
+tcp_syncookie_check(const struct tcp_pcb *ack, u32_t iss)
+{
+  u32_t now = TCP_SYNCOOKIE_SLOT(sys_now());
+  u32_t age;
+
+  for (age = 0; age < 2; age++) {
+    u32_t slot = now - age;
+    if ((slot & 3) == (iss >> 30) &&
+        (tcp_syncookie_hash(ack, slot, (u8_t)iss) & 0x3fffff) == ((iss >> 8) & 0x3fffff)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Restore the options of the SYN from a valid cookie into a new pcb, as
+ * tcp_parseopt() would have set them.
+ */
+void
+tcp_syncookie_restore(struct tcp_pcb *pcb, u32_t iss)
+{
+  u8_t opts = (u8_t)iss;
+
+  pcb->mss = LWIP_MIN(tcp_syncookie_mss[opts & TCP_SYNCOOKIE_MSS_MASK], TCP_MSS);
+#if LWIP_WND_SCALE
+  if (((opts >> TCP_SYNCOOKIE_WS_SHIFT) & TCP_SYNCOOKIE_WS_MASK) != TCP_SYNCOOKIE_WS_NONE) {
+    pcb->snd_scale = (u8_t)LWIP_MIN((opts >> TCP_SYNCOOKIE_WS_SHIFT) & TCP_SYNCOOKIE_WS_MASK, 14U);
+    pcb->rcv_scale = TCP_RCV_SCALE;
+    tcp_set_flags(pcb, TF_WND_SCALE);
+    pcb->rcv_wnd = pcb->rcv_ann_wnd = TCP_RCV_BUF(pcb);
+  }
+#endif /* LWIP_WND_SCALE */
+#if LWIP_TCP_SACK_OUT
+  if (opts & TCP_SYNCOOKIE_SACK) {
+    tcp_set_flags(pcb, TF_SACK);
+  }
+#endif /* LWIP_TCP_SACK_OUT */
+}
+
+/**
+ * ISN for actively and passively opened connections (LWIP_HOOK_TCP_ISN),
+ * RFC 6528: a keyed hash of the 4-tuple plus a clock ticking every 4us.
+ */
+u32_t
+tcp_syncookie_isn(const ip_addr_t *local_ip, u16_t local_port,
+                  const ip_addr_t *remote_ip, u16_t remote_port)
+{
+  struct tcp_hsip s;
+
+  tcp_hsip_init(&s);
+  tcp_hsip_addr(&s, local_ip);
+  tcp_hsip_addr(&s, remote_ip);
+  tcp_hsip_word(&s, ((u32_t)local_port << 16) | remote_port);
+  return tcp_hsip_final(&s) + sys_now() * 250;
+}
+
+#endif /* LWIP_TCP && LWIP_TCP_SYN_COOKIES */
@@ -62,6 +62,7 @@
 #include "lwip/stats.h"
 #include "lwip/snmp.h"
 #include "lwip/dhcp.h"
+#include "lwip/priv/pcb_hash.h"
 
 #include <string.h>
 
@@ -83,6 +84,85 @@ struct udp_pcb *udp_pcbs;
 #ifdef UDP_ACCEPT_ANY_PORT
 struct udp_data udp_data = {.src = 0, .dst = 0};
 #endif
+
+#if LWIP_PCB_HASH
+/* Connected pcbs with a fully specified 4-tuple, also kept in udp_pcbs */
+static struct udp_pcb *udp_pcb_hash[UDP_PCB_HASH_SIZE];
+
+static struct udp_pcb **
+udp_pcb_hash_bucket(const ip_addr_t *local_ip, u16_t local_port, const ip_addr_t *remote_ip, u16_t remote_port)
+{
+  return &udp_pcb_hash[lwip_pcb_hash(local_ip, local_port, remote_ip, remote_port, UDP_PCB_HASH_SIZE)];
+}
+
+/* Call before changing any part of the 4-tuple */
+static void
+udp_pcb_hash_remove(struct udp_pcb *pcb)
+{
+  struct udp_pcb **link;
+
+  if ((pcb->flags & UDP_FLAGS_HASHED) == 0) {
+    return;
+  }
+
+  for (link = udp_pcb_hash_bucket(&pcb->local_ip, pcb->local_port, &pcb->remote_ip, pcb->remote_port);
+       *link != NULL; link = &(*link)->hash_next) {
+    if (*link == pcb) {
+      *link = pcb->hash_next;
+      break;
+    }
+  }
+  pcb->hash_next = NULL;
+  udp_clear_flags(pcb, UDP_FLAGS_HASHED);
+}
+
+/* Call after changing the 4-tuple, only fully specified ones are indexed */
+static void
+udp_pcb_hash_insert(struct udp_pcb *pcb)
+{
+  struct udp_pcb **bucket;
+
+  if (((pcb->flags & UDP_FLAGS_CONNECTED) == 0) || (pcb->flags & UDP_FLAGS_HASHED) ||
+      ip_addr_isany(&pcb->local_ip) || ip_addr_isany(&pcb->remote_ip) ||
+#if UDP_ACCEPT_ANY_PORT
+      (pcb->local_port == UDP_ACCEPT_ANY_PORT) ||
+#endif /* UDP_ACCEPT_ANY_PORT */
+      (pcb->local_port == 0)) {
+    return;
+  }
+
+  bucket = udp_pcb_hash_bucket(&pcb->local_ip, pcb->local_port, &pcb->remote_ip, pcb->remote_port);
+  pcb->hash_next = *bucket;
+  *bucket = pcb;
+  udp_set_flags(pcb, UDP_FLAGS_HASHED);
+}
+
+/* Move-to-front lookup of a connected pcb */
+static struct udp_pcb *
+udp_pcb_hash_lookup(const ip_addr_t *local_ip, u16_t local_port, const ip_addr_t *remote_ip, u16_t remote_port)
+{
+  struct udp_pcb **bucket = udp_pcb_hash_bucket(local_ip, local_port, remote_ip, remote_port);
+  struct udp_pcb *prev = NULL;
+  struct udp_pcb *pcb;
+
+  for (pcb = *bucket; pcb != NULL; prev = pcb, pcb = pcb->hash_next) {
+    if (pcb->remote_port == remote_port &&
+        pcb->local_port == local_port &&
+        ip_addr_cmp(&pcb->remote_ip, remote_ip) &&
+        ip_addr_cmp(&pcb->local_ip, local_ip)) {
+      if (prev != NULL) {
+        prev->hash_next = pcb->hash_next;
+        pcb->hash_next = *bucket;
+        *bucket = pcb;
+      } else {
+        UDP_STATS_INC(udp.cachehit);
+      }
+      return pcb;
+    }
+  }
+  return NULL;
+}
+#endif /* LWIP_PCB_HASH */
 /**
  * Initialize this module.
  */
@@ -254,11 +334,25 @@ udp_input(struct pbuf *p, struct netif *inp)
   pcb = NULL;
   prev = NULL;
   uncon_pcb = NULL;
+#if LWIP_PCB_HASH
+  /* connected pcbs with a fully specified 4-tuple are found by hash */
+  pcb = udp_pcb_hash_lookup(ip_current_dest_addr(), dest, ip_current_src_addr(), src);
+  if ((pcb != NULL) && (udp_input_local_match(pcb, inp, broadcast) == 0)) {
+    pcb = NULL;
+  }
+  if (pcb == NULL)
+#endif /* LWIP_PCB_HASH */
   /* Iterate through the UDP pcb list for a matching pcb.
    * 'Perfect match' pcbs (connected to the remote port & ip address) are
    * preferred. If no perfect match is found, the first unconnected pcb that
    * matches the local port and ip address gets the datagram. */
   for (pcb = udp_pcbs; pcb != NULL; pcb = pcb->next) {
+#if LWIP_PCB_HASH
+    if (pcb->flags & UDP_FLAGS_HASHED) {
+      prev = pcb;
+      continue;
+    }
+#endif /* LWIP_PCB_HASH */
     /* print the PCB local and remote address */
     LWIP_DEBUGF(UDP_DEBUG, ("pcb ("));
     ip_addr_debug_print_val(UDP_DEBUG, pcb->local_ip);
@@ -1041,10 +1135,16 @@ udp_bind(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
     }
   }
 
+#if LWIP_PCB_HASH
+  udp_pcb_hash_remove(pcb);
+#endif /* LWIP_PCB_HASH */
   ip_addr_set_ipaddr(&pcb->local_ip, ipaddr);
 
   pcb->local_port = port;
   mib2_udp_bind(pcb);
+#if LWIP_PCB_HASH
+  udp_pcb_hash_insert(pcb);
+#endif /* LWIP_PCB_HASH */
   /* pcb not active yet? */
   if (rebind == 0) {
     /* place the PCB on the active list if not already there */
@@ -1115,6 +1215,9 @@ udp_connect(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
     }
   }
 
+#if LWIP_PCB_HASH
+  udp_pcb_hash_remove(pcb);
+#endif /* LWIP_PCB_HASH */
   ip_addr_set_ipaddr(&pcb->remote_ip, ipaddr);
 #if LWIP_IPV6 && LWIP_IPV6_SCOPES
   /* If the given IP address should have a zone but doesn't, assign one now,
@@ -1127,6 +1230,9 @@ udp_connect(struct udp_pcb *pcb, const ip_addr_t *ipaddr, u16_t port)
 
   pcb->remote_port = port;
   pcb->flags |= UDP_FLAGS_CONNECTED;
+#if LWIP_PCB_HASH
+  udp_pcb_hash_insert(pcb);
+#endif /* LWIP_PCB_HASH */
 
   LWIP_DEBUGF(UDP_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_STATE, ("udp_connect: connected to "));
   ip_addr_debug_print_val(UDP_DEBUG | LWIP_DBG_TRACE | LWIP_DBG_STATE,
@@ -1160,6 +1266,9 @@ udp_disconnect(struct udp_pcb *pcb)
 
   LWIP_ERROR("udp_disconnect: invalid pcb", pcb != NULL, return);
 
+#if LWIP_PCB_HASH
+  udp_pcb_hash_remove(pcb);
+#endif /* LWIP_PCB_HASH */
   /* reset remote address association */
 #if LWIP_IPV4 && LWIP_IPV6
   if (IP_IS_ANY_TYPE_VAL(pcb->local_ip)) {
@@ -1216,6 +1325,9 @@ udp_remove(struct udp_pcb *pcb)
   LWIP_ERROR("udp_remove: invalid pcb", pcb != NULL, return);
 
   mib2_udp_unbind(pcb);
+#if LWIP_PCB_HASH
+  udp_pcb_hash_remove(pcb);
+#endif /* LWIP_PCB_HASH */
   /* pcb to be removed is first in list? */
   if (udp_pcbs == pcb) {
     /* make list start at 2nd pcb */
@@ -1316,7 +1428,13 @@ void udp_netif_ip_addr_changed(const ip_addr_t *old_addr, const ip_addr_t *new_a
       if (ip_addr_cmp(&upcb->local_ip, old_addr)) {
         /* The PCB is bound to the old ipaddr and
          * is set to bound to the new one instead */
+#if LWIP_PCB_HASH
+        udp_pcb_hash_remove(upcb);
+#endif /* LWIP_PCB_HASH */
         ip_addr_copy(upcb->local_ip, *new_addr);
+#if LWIP_PCB_HASH
+        udp_pcb_hash_insert(upcb);
+#endif /* LWIP_PCB_HASH */
       }
     }
   }
@@ -259,6 +259,9 @@ struct netconn {
   /** timeout in milliseconds to wait for new data to be received
       (or connections to arrive for listening netconns) */
   u32_t recv_timeout;
+  /** an ERR_TIMEOUT wakeup from lwip_netconn_wake_recv is queued in recvmbox,
+      a queued wakeup found with this cleared is stale and skipped */
+  u8_t recv_wakeup;
 #endif /* LWIP_SO_RCVTIMEO */
 #if LWIP_SO_RCVBUF
   /** maximum amount of bytes queued in recvmbox
@@ -283,6 +286,31 @@ struct netconn {
 #endif /* LWIP_TCP */
   /** A callback function that is informed about events for this netconn */
   netconn_callback callback;
+#if LWIP_NETCONN_CALLBACK_ARG
+  /** user argument for the callback, not inherited by accepted netconns */
+  void *callback_arg;
+#endif /* LWIP_NETCONN_CALLBACK_ARG */
+#if LWIP_NETCONN_ACCEPT_BATCH
+  /** TCP: addresses of an accepted netconn, captured by accept_function so
+      the application needs no netconn_getaddr per connection */
+  ip_addr_t local_ip;
+  ip_addr_t remote_ip;
+  u16_t local_port;
+  u16_t remote_port;
+#endif /* LWIP_NETCONN_ACCEPT_BATCH */
+#if LWIP_NETCONN_DEFER_ACCEPT
+  /** TCP listen: milliseconds to hold accepted connections back until their
+      first data arrives, 0 to post them to acceptmbox right away */
+  u32_t defer_accept;
+  /** TCP listen: connections held back, not yet in acceptmbox */
+  struct netconn *deferred;
+  /** TCP: the listener holding this connection back, NULL once posted */
+  struct netconn *defer_listener;
+  struct netconn *defer_next;
+  struct netconn **defer_pprev;
+  /** TCP: sys_now() at which the connection is posted without data */
+  u32_t defer_deadline;
+#endif /* LWIP_NETCONN_DEFER_ACCEPT */
 };
 
 /** This vector type is passed to @ref netconn_write_vectors_partly to send
@@ -331,6 +359,9 @@ err_t   netconn_listen_with_backlog(struct netconn *conn, u8_t backlog);
 /** @ingroup netconn_tcp */
 #define netconn_listen(conn) netconn_listen_with_backlog(conn, TCP_DEFAULT_LISTEN_BACKLOG)
 err_t   netconn_accept(struct netconn *conn, struct netconn **new_conn);
+#if LWIP_NETCONN_ACCEPT_BATCH
+err_t   netconn_accept_flags(struct netconn *conn, struct netconn **new_conn, u8_t apiflags);
+#endif /* LWIP_NETCONN_ACCEPT_BATCH */
 err_t   netconn_recv(struct netconn *conn, struct netbuf **new_buf);
 err_t   netconn_recv_udp_raw_netbuf(struct netconn *conn, struct netbuf **new_buf);
 err_t   netconn_recv_udp_raw_netbuf_flags(struct netconn *conn, struct netbuf **new_buf, u8_t apiflags);
@@ -344,6 +375,10 @@ err_t   netconn_write_partly(struct netconn *conn, const void *dataptr, size_t s
                              u8_t apiflags, size_t *bytes_written);
 err_t   netconn_write_vectors_partly(struct netconn *conn, struct netvector *vectors, u16_t vectorcnt,
                                      u8_t apiflags, size_t *bytes_written);
+#if LWIP_TCP_WRITE_REF
+err_t   netconn_write_ref_partly(struct netconn *conn, const void *dataptr, size_t size,
+                                 void *ref, size_t *bytes_written);
+#endif /* LWIP_TCP_WRITE_REF */
 /** @ingroup netconn_tcp */
 #define netconn_write(conn, dataptr, size, apiflags) \
           netconn_write_partly(conn, dataptr, size, apiflags, NULL)
@@ -381,6 +416,12 @@ err_t   netconn_err(struct netconn *conn);
 /** Get the blocking status of netconn calls (@todo: write/send is missing) */
 #define netconn_is_nonblocking(conn)        (((conn)->flags & NETCONN_FLAG_NON_BLOCKING) != 0)
 
+#if LWIP_NETCONN_CALLBACK_ARG
+/** Set the argument passed back through the netconn callback, call with the core locked */
+#define netconn_set_callback_arg(conn, arg) ((conn)->callback_arg = (arg))
+#define netconn_get_callback_arg(conn)      ((conn)->callback_arg)
+#endif /* LWIP_NETCONN_CALLBACK_ARG */
+
 #if LWIP_IPV6
 /** @ingroup netconn_common
  * TCP: Set the IPv6 ONLY status of netconn calls (see NETCONN_FLAG_IPV6_V6ONLY)
@@ -407,6 +448,12 @@ err_t   netconn_err(struct netconn *conn);
 /** Get the receive timeout in milliseconds */
 #define netconn_get_recvtimeout(conn)               ((conn)->recv_timeout)
 #endif /* LWIP_SO_RCVTIMEO */
+#if LWIP_NETCONN_DEFER_ACCEPT
+/** Hold accepted connections back until they send data or timeout milliseconds pass, 0 to turn off (core locked) */
+#define netconn_set_defer_accept(conn, timeout)     ((conn)->defer_accept = (timeout))
+/** Get the defer accept timeout in milliseconds */
+#define netconn_get_defer_accept(conn)              ((conn)->defer_accept)
+#endif /* LWIP_NETCONN_DEFER_ACCEPT */
 #if LWIP_SO_RCVBUF
 /** Set the receive buffer in bytes */
 #define netconn_set_recvbufsize(conn, recvbufsize)  ((conn)->recv_bufsize = (recvbufsize))
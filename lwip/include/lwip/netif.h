@@ -105,6 +105,10 @@ extern "C" {
 /** If set, the netif has MLD6 capability.
  * Set by the netif driver in its init function. */
 #define NETIF_FLAG_MLD6         0x40U
+#if LWIP_TCP_GSO
+/** If set, the netif accepts TCP segments larger than MSS and segments them itself. */
+#define NETIF_FLAG_TSO          0x80U
+#endif // LWIP_TCP_GSO
 
 /**
  * @}
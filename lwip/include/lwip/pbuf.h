@@ -219,6 +219,11 @@ struct pbuf {
 
   /** For incoming packets, this contains the input netif's index */
   u8_t if_idx;
+
+#if LWIP_TCP_GSO
+  /** For outgoing TCP segments larger than MSS, the size the device should segment them to */
+  u16_t gso_size;
+#endif // LWIP_TCP_GSO
 };
 
 
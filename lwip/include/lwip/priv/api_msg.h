@@ -118,6 +118,10 @@ struct api_msg {
 #if LWIP_SO_SNDTIMEO
       u32_t time_started;
 #endif /* LWIP_SO_SNDTIMEO */
+#if LWIP_TCP_WRITE_REF
+      /** handed to tcp_write as pcb->write_ref with TCP_WRITE_FLAG_REF */
+      void *ref;
+#endif /* LWIP_TCP_WRITE_REF */
     } w;
     /** used for lwip_netconn_do_recv */
     struct {
@@ -191,6 +195,13 @@ struct dns_api_msg {
 int lwip_netconn_is_deallocated_msg(void *msg);
 #endif
 int lwip_netconn_is_err_msg(void *msg, err_t *err);
+#if LWIP_TCP && LWIP_SO_RCVTIMEO
+err_t lwip_netconn_wake_recv(struct netconn *conn);
+void lwip_netconn_clear_wakeup(struct netconn *conn);
+#endif /* LWIP_TCP && LWIP_SO_RCVTIMEO */
+#if LWIP_TCP && LWIP_SO_SNDTIMEO
+int lwip_netconn_check_write(struct netconn *conn);
+#endif /* LWIP_TCP && LWIP_SO_SNDTIMEO */
 void lwip_netconn_do_newconn         (void *m);
 void lwip_netconn_do_delconn         (void *m);
 void lwip_netconn_do_bind            (void *m);
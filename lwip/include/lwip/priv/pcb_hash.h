@@ -0,0 +1,59 @@
+/**
+ * @file
+ * 4-tuple hashing for PCB demultiplexing (LWIP_PCB_HASH)
+ */
+
+#ifndef LWIP_HDR_PCB_HASH_H
+#define LWIP_HDR_PCB_HASH_H
+
+#include "lwip/opt.h"
+
+#if LWIP_PCB_HASH
+
+#include "lwip/ip_addr.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline u32_t
+lwip_pcb_hash_addr(const ip_addr_t *addr)
+{
+#if LWIP_IPV6
+  if (IP_IS_V6(addr)) {
+    const ip6_addr_t *ip6 = ip_2_ip6(addr);
+    return ip6->addr[0] ^ ip6->addr[1] ^ ip6->addr[2] ^ ip6->addr[3];
+  }
+#endif /* LWIP_IPV6 */
+#if LWIP_IPV4
+  return ip4_addr_get_u32(ip_2_ip4(addr));
+#else /* LWIP_IPV4 */
+  return 0;
+#endif /* LWIP_IPV4 */
+}
+
+/** Bucket of a 4-tuple in a table of 'size' buckets, size must be a power of two */
+static inline u32_t
+lwip_pcb_hash(const ip_addr_t *local_ip, u16_t local_port,
+              const ip_addr_t *remote_ip, u16_t remote_port, u32_t size)
+{
+  u32_t h = lwip_pcb_hash_addr(local_ip) ^ (lwip_pcb_hash_addr(remote_ip) * 0x9e3779b1UL) ^
+            (((u32_t)local_port << 16) | remote_port);
+
+  /* murmur3 finalizer */
+  h ^= h >> 16;
+  h *= 0x85ebca6bUL;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35UL;
+  h ^= h >> 16;
+
+  return h & (size - 1);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LWIP_PCB_HASH */
+
+#endif /* LWIP_HDR_PCB_HASH_H */
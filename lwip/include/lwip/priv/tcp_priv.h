@@ -101,7 +101,7 @@ err_t            tcp_process_refused_data(struct tcp_pcb *pcb);
                             ((tpcb)->flags & (TF_NODELAY | TF_INFR)) || \
                             (((tpcb)->unsent != NULL) && (((tpcb)->unsent->next != NULL) || \
                               ((tpcb)->unsent->len >= (tpcb)->mss))) || \
-                            ((tcp_sndbuf(tpcb) == 0) || (tcp_sndqueuelen(tpcb) >= TCP_SND_QUEUELEN)) \
+                            ((tcp_sndbuf(tpcb) == 0) || (tcp_sndqueuelen(tpcb) >= TCP_SND_QUEUELEN_MAX(tpcb))) \
                             ) ? 1 : 0)
 #define tcp_output_nagle(tpcb) (tcp_do_output_nagle(tpcb) ? tcp_output(tpcb) : ERR_OK)
 
@@ -322,10 +322,16 @@ struct tcp_seg {
 #define TCPWND_MIN16(x)    x
 #endif /* LWIP_WND_SCALE */
 
+/** Initial CWND calculation as defined RFC 2581 */
+#define LWIP_TCP_CALC_INITIAL_CWND(mss) ((tcpwnd_size_t)LWIP_MIN((4U * (mss)), LWIP_MAX((2U * (mss)), 4380U)))
+
 /* Global variables: */
 extern struct tcp_pcb *tcp_input_pcb;
 extern u32_t tcp_ticks;
 extern u8_t tcp_active_pcbs_changed;
+#if LWIP_TCP_CC
+extern const struct tcp_cc_ops *tcp_cc_default; /* Congestion control of new pcbs */
+#endif /* LWIP_TCP_CC */
 
 /* The TCP PCB lists. */
 union tcp_listen_pcbs_t { /* List of all TCP PCBs in LISTEN state. */
@@ -349,6 +355,87 @@ extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
    3) All PCBs in the tcp_listen_pcbs list is in LISTEN state.
    4) All PCBs in the tcp_tw_pcbs list is in TIME-WAIT state.
 */
+
+#if LWIP_PCB_HASH
+/* Active and TIME-WAIT pcbs are additionally indexed by 4-tuple for tcp_input */
+void tcp_pcb_hash_insert(struct tcp_pcb *pcb);
+void tcp_pcb_hash_remove(struct tcp_pcb *pcb);
+struct tcp_pcb *tcp_pcb_hash_lookup(const ip_addr_t *local_ip, u16_t local_port,
+                                    const ip_addr_t *remote_ip, u16_t remote_port);
+
+#define TCP_PCB_HASHED(pcbs) (((pcbs) == &tcp_active_pcbs) || ((pcbs) == &tcp_tw_pcbs))
+#define TCP_HASH_REG(pcbs, npcb) do { if (TCP_PCB_HASHED(pcbs)) { tcp_pcb_hash_insert(npcb); } } while (0)
+#define TCP_HASH_RMV(pcbs, npcb) do { if (TCP_PCB_HASHED(pcbs)) { tcp_pcb_hash_remove(npcb); } } while (0)
+#else /* LWIP_PCB_HASH */
+#define TCP_HASH_REG(pcbs, npcb)
+#define TCP_HASH_RMV(pcbs, npcb)
+#endif /* LWIP_PCB_HASH */
+
+#if LWIP_TCP_TIMER_WHEEL
+/* Timers of active and TIME-WAIT pcbs run off a wheel, see tcp_slowtmr. Any
+   code changing what a pcb's timers depend on touches it first. */
+void tcp_timer_touch(struct tcp_pcb *pcb);
+void tcp_timer_start(struct tcp_pcb *pcb);
+void tcp_timer_remove(struct tcp_pcb *pcb);
+
+#define TCP_TIMER_TOUCH(pcb) tcp_timer_touch(pcb)
+#define TCP_PCB_TIMED(pcbs) (((pcbs) == &tcp_active_pcbs) || ((pcbs) == &tcp_tw_pcbs))
+#define TCP_TIMER_REG(pcbs, npcb) do { if (TCP_PCB_TIMED(pcbs)) { tcp_timer_start(npcb); } } while (0)
+#define TCP_TIMER_RMV(pcbs, npcb) do { if (TCP_PCB_TIMED(pcbs)) { tcp_timer_remove(npcb); } } while (0)
+
+/* pcb lists are doubly linked so that TCP_RMV does not scan them */
+#define TCP_LIST_LINK(pcbs, npcb) do { \
+    (npcb)->next = *(pcbs); \
+    if (*(pcbs) != NULL) { \
+      (*(pcbs))->pprev = &(npcb)->next; \
+    } \
+    (npcb)->pprev = (pcbs); \
+    *(pcbs) = (npcb); \
+  } while (0)
+#define TCP_LIST_UNLINK(pcbs, npcb) do { \
+    if ((npcb)->pprev != NULL) { \
+      *(npcb)->pprev = (npcb)->next; \
+      if ((npcb)->next != NULL) { \
+        (npcb)->next->pprev = (npcb)->pprev; \
+      } \
+      (npcb)->pprev = NULL; \
+    } \
+  } while (0)
+#define TCP_LIST_FIX_PPREV(npcb, link) ((npcb)->pprev = (link))
+#else /* LWIP_TCP_TIMER_WHEEL */
+#define TCP_TIMER_TOUCH(pcb)
+#define TCP_TIMER_REG(pcbs, npcb)
+#define TCP_TIMER_RMV(pcbs, npcb)
+
+#define TCP_LIST_LINK(pcbs, npcb) do { \
+    (npcb)->next = *(pcbs); \
+    *(pcbs) = (npcb); \
+  } while (0)
+#define TCP_LIST_UNLINK(pcbs, npcb) do { \
+    if (*(pcbs) == (npcb)) { \
+      *(pcbs) = (*(pcbs))->next; \
+    } else { \
+      struct tcp_pcb *tcp_tmp_pcb; \
+      for (tcp_tmp_pcb = *(pcbs); tcp_tmp_pcb != NULL; tcp_tmp_pcb = tcp_tmp_pcb->next) { \
+        if (tcp_tmp_pcb->next == (npcb)) { \
+          tcp_tmp_pcb->next = (npcb)->next; \
+          break; \
+        } \
+      } \
+    } \
+  } while (0)
+#define TCP_LIST_FIX_PPREV(npcb, link)
+#endif /* LWIP_TCP_TIMER_WHEEL */
+
+/* Move npcb, found after prev while searching pcbs, to the front of the list */
+#define TCP_LIST_FRONT(pcbs, prev, npcb) do { \
+    (prev)->next = (npcb)->next; \
+    if ((npcb)->next != NULL) { \
+      TCP_LIST_FIX_PPREV((npcb)->next, &(prev)->next); \
+    } \
+    TCP_LIST_LINK(pcbs, npcb); \
+  } while (0)
+
 /* Define two macros, TCP_REG and TCP_RMV that registers a TCP PCB
    with a PCB list or removes a PCB from a list, respectively. */
 #ifndef TCP_DEBUG_PCB_LISTS
@@ -364,25 +451,20 @@ extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
                                 LWIP_ASSERT("TCP_REG: already registered\n", tcp_tmp_pcb != (npcb)); \
                             } \
                             LWIP_ASSERT("TCP_REG: pcb->state != CLOSED", ((pcbs) == &tcp_bound_pcbs) || ((npcb)->state != CLOSED)); \
-                            (npcb)->next = *(pcbs); \
+                            TCP_LIST_LINK(pcbs, npcb); \
                             LWIP_ASSERT("TCP_REG: npcb->next != npcb", (npcb)->next != (npcb)); \
-                            *(pcbs) = (npcb); \
+                            TCP_HASH_REG(pcbs, npcb); \
+                            TCP_TIMER_REG(pcbs, npcb); \
                             LWIP_ASSERT("TCP_REG: tcp_pcbs sane", tcp_pcbs_sane()); \
               tcp_timer_needed(); \
                             } while(0)
 #define TCP_RMV(pcbs, npcb) do { \
-                            struct tcp_pcb *tcp_tmp_pcb; \
                             LWIP_ASSERT("TCP_RMV: pcbs != NULL", *(pcbs) != NULL); \
                             LWIP_DEBUGF(TCP_DEBUG, ("TCP_RMV: removing %p from %p\n", (void *)(npcb), (void *)(*(pcbs)))); \
-                            if(*(pcbs) == (npcb)) { \
-                               *(pcbs) = (*pcbs)->next; \
-                            } else for (tcp_tmp_pcb = *(pcbs); tcp_tmp_pcb != NULL; tcp_tmp_pcb = tcp_tmp_pcb->next) { \
-                               if(tcp_tmp_pcb->next == (npcb)) { \
-                                  tcp_tmp_pcb->next = (npcb)->next; \
-                                  break; \
-                               } \
-                            } \
+                            TCP_LIST_UNLINK(pcbs, npcb); \
                             (npcb)->next = NULL; \
+                            TCP_HASH_RMV(pcbs, npcb); \
+                            TCP_TIMER_RMV(pcbs, npcb); \
                             LWIP_ASSERT("TCP_RMV: tcp_pcbs sane", tcp_pcbs_sane()); \
                             LWIP_DEBUGF(TCP_DEBUG, ("TCP_RMV: removed %p from %p\n", (void *)(npcb), (void *)(*(pcbs)))); \
                             } while(0)
@@ -391,28 +473,18 @@ extern struct tcp_pcb ** const tcp_pcb_lists[NUM_TCP_PCB_LISTS];
 
 #define TCP_REG(pcbs, npcb)                        \
   do {                                             \
-    (npcb)->next = *pcbs;                          \
-    *(pcbs) = (npcb);                              \
+    TCP_LIST_LINK(pcbs, npcb);                     \
+    TCP_HASH_REG(pcbs, npcb);                      \
+    TCP_TIMER_REG(pcbs, npcb);                     \
     tcp_timer_needed();                            \
   } while (0)
 
 #define TCP_RMV(pcbs, npcb)                        \
   do {                                             \
-    if(*(pcbs) == (npcb)) {                        \
-      (*(pcbs)) = (*pcbs)->next;                   \
-    }                                              \
-    else {                                         \
-      struct tcp_pcb *tcp_tmp_pcb;                 \
-      for (tcp_tmp_pcb = *pcbs;                    \
-          tcp_tmp_pcb != NULL;                     \
-          tcp_tmp_pcb = tcp_tmp_pcb->next) {       \
-        if(tcp_tmp_pcb->next == (npcb)) {          \
-          tcp_tmp_pcb->next = (npcb)->next;        \
-          break;                                   \
-        }                                          \
-      }                                            \
-    }                                              \
+    TCP_LIST_UNLINK(pcbs, npcb);                   \
     (npcb)->next = NULL;                           \
+    TCP_HASH_RMV(pcbs, npcb);                      \
+    TCP_TIMER_RMV(pcbs, npcb);                     \
   } while(0)
 
 #endif /* LWIP_DEBUG */
@@ -470,6 +542,14 @@ void tcp_rst(const struct tcp_pcb* pcb, u32_t seqno, u32_t ackno,
 
 u32_t tcp_next_iss(struct tcp_pcb *pcb);
 
+#if LWIP_TCP_SYN_COOKIES
+void  tcp_syncookie_init(void);
+u32_t tcp_syncookie_make(const struct tcp_pcb *syn);
+u8_t  tcp_syncookie_check(const struct tcp_pcb *ack, u32_t iss);
+void  tcp_syncookie_restore(struct tcp_pcb *pcb, u32_t iss);
+void  tcp_syncookie_synack(const struct tcp_pcb *syn, u32_t iss);
+#endif /* LWIP_TCP_SYN_COOKIES */
+
 err_t tcp_keepalive(struct tcp_pcb *pcb);
 err_t tcp_split_unsent_seg(struct tcp_pcb *pcb, u16_t split);
 err_t tcp_zero_window_probe(struct tcp_pcb *pcb);
@@ -133,16 +133,21 @@ typedef void  (*tcp_err_fn)(void *arg, err_t err);
  */
 typedef err_t (*tcp_connected_fn)(void *arg, struct tcp_pcb *tpcb, err_t err);
 
+#if LWIP_TCP_BUFFERS
+#define TCP_RCV_BUF(pcb)        ((pcb)->rcv_buf)
+#else /* LWIP_TCP_BUFFERS */
+#define TCP_RCV_BUF(pcb)        TCP_WND
+#endif /* LWIP_TCP_BUFFERS */
 #if LWIP_WND_SCALE
 #define RCV_WND_SCALE(pcb, wnd) (((wnd) >> (pcb)->rcv_scale))
 #define SND_WND_SCALE(pcb, wnd) (((wnd) << (pcb)->snd_scale))
 #define TCPWND16(x)             ((u16_t)LWIP_MIN((x), 0xFFFF))
-#define TCP_WND_MAX(pcb)        ((tcpwnd_size_t)(((pcb)->flags & TF_WND_SCALE) ? TCP_WND : TCPWND16(TCP_WND)))
+#define TCP_WND_MAX(pcb)        ((tcpwnd_size_t)(((pcb)->flags & TF_WND_SCALE) ? TCP_RCV_BUF(pcb) : TCPWND16(TCP_RCV_BUF(pcb))))
 #else
 #define RCV_WND_SCALE(pcb, wnd) (wnd)
 #define SND_WND_SCALE(pcb, wnd) (wnd)
 #define TCPWND16(x)             (x)
-#define TCP_WND_MAX(pcb)        TCP_WND
+#define TCP_WND_MAX(pcb)        TCP_RCV_BUF(pcb)
 #endif
 /* Increments a tcpwnd_size_t and holds at max value rather than rollover */
 #define TCP_WND_INC(wnd, inc)   do { \
@@ -209,8 +214,16 @@ typedef u16_t tcpflags_t;
 /**
  * members common to struct tcp_pcb and struct tcp_listen_pcb
  */
+#if LWIP_TCP_TIMER_WHEEL
+/* back link, so expiring pcbs leave their list without scanning it */
+#define TCP_PCB_PPREV(type) type **pprev;
+#else /* LWIP_TCP_TIMER_WHEEL */
+#define TCP_PCB_PPREV(type)
+#endif /* LWIP_TCP_TIMER_WHEEL */
+
 #define TCP_PCB_COMMON(type) \
   type *next; /* for the linked list */ \
+  TCP_PCB_PPREV(type) \
   void *callback_arg; \
   TCP_PCB_EXTARGS \
   enum tcp_state state; /* TCP state */ \
@@ -238,6 +251,10 @@ struct tcp_pcb_listen {
 };
 
 
+#if LWIP_TCP_CC
+struct tcp_cc_ops;
+#endif /* LWIP_TCP_CC */
+
 /** the TCP protocol control block */
 struct tcp_pcb {
 /** common PCB members */
@@ -245,6 +262,11 @@ struct tcp_pcb {
 /** protocol specific PCB members */
   TCP_PCB_COMMON(struct tcp_pcb);
 
+#if LWIP_PCB_HASH
+  /* next pcb in the same tcp_pcb_hash bucket */
+  struct tcp_pcb *hash_next;
+#endif /* LWIP_PCB_HASH */
+
   /* ports are in host byte order */
   u16_t remote_port;
 
@@ -278,12 +300,25 @@ struct tcp_pcb {
   u8_t polltmr, pollinterval;
   u8_t last_timer;
   u32_t tmr;
+#if LWIP_TCP_TIMER_WHEEL
+  /* timer wheel slot, and the list of pcbs touched since the last slow tick */
+  struct tcp_pcb *wheel_next, **wheel_pprev;
+  struct tcp_pcb *touch_next, **touch_pprev;
+  u32_t wheel_due;   /* tcp_ticks of the next timer event */
+  u32_t wheel_ticks; /* tcp_ticks the per-tick counters are advanced to */
+#endif /* LWIP_TCP_TIMER_WHEEL */
 
   /* receiver variables */
   u32_t rcv_nxt;   /* next seqno expected */
   tcpwnd_size_t rcv_wnd;   /* receiver window available */
   tcpwnd_size_t rcv_ann_wnd; /* receiver window to announce */
   u32_t rcv_ann_right_edge; /* announced right edge of window */
+#if LWIP_TCP_BUFFERS
+  tcpwnd_size_t rcv_buf;        /* receive window when fully open */
+  tcpwnd_size_t rcv_buf_max;    /* autotuning grows rcv_buf up to this */
+  tcpwnd_size_t rcv_tune_bytes; /* bytes the application took since rcv_tune_time */
+  u32_t rcv_tune_time;          /* sys_now() when the current autotuning period began */
+#endif /* LWIP_TCP_BUFFERS */
 
 #if LWIP_TCP_SACK_OUT
   /* SACK ranges to include in ACK packets (entry is invalid if left==right) */
@@ -311,6 +346,15 @@ struct tcp_pcb {
   /* congestion avoidance/control variables */
   tcpwnd_size_t cwnd;
   tcpwnd_size_t ssthresh;
+#if LWIP_TCP_CC
+  const struct tcp_cc_ops *cc;
+  /* state private to the congestion control algorithm */
+  u32_t cc_epoch;           /* sys_now() when the current growth epoch began, 0 if none */
+  u32_t cc_k;               /* ms from cc_epoch until cwnd is back at cc_origin */
+  tcpwnd_size_t cc_wmax;    /* cwnd before the last reduction */
+  tcpwnd_size_t cc_origin;  /* cwnd the growth curve flattens at */
+  tcpwnd_size_t cc_west;    /* cwnd Reno would have reached in this epoch */
+#endif /* LWIP_TCP_CC */
 
   /* first byte following last rto byte */
   u32_t rto_end;
@@ -324,8 +368,15 @@ struct tcp_pcb {
   tcpwnd_size_t snd_wnd_max; /* the maximum sender window announced by the remote host */
 
   tcpwnd_size_t snd_buf;   /* Available buffer space for sending (in bytes). */
+#if LWIP_TCP_BUFFERS
+  tcpwnd_size_t snd_buf_size; /* Send buffer size, snd_buf counts down from it. */
+  tcpwnd_size_t snd_queued;   /* Bytes written and not yet acknowledged. */
+#endif /* LWIP_TCP_BUFFERS */
 #define TCP_SNDQUEUELEN_OVERFLOW (0xffffU-3)
   u16_t snd_queuelen; /* Number of pbufs currently in the send buffer. */
+#if LWIP_TCP_WRITE_REF
+  void *write_ref; /* Handed to LWIP_HOOK_TCP_WRITE_REF by a tcp_write with TCP_WRITE_FLAG_REF. */
+#endif /* LWIP_TCP_WRITE_REF */
 
 #if TCP_OVERSIZE
   /* Extra bytes available at the end of the last pbuf in unsent. */
@@ -343,6 +394,14 @@ struct tcp_pcb {
 
   struct pbuf *refused_data; /* Data previously received but not yet taken by upper layer */
 
+#if LWIP_TCP_PCB_STATS
+  u64_t stats_bytes_in;   /* In-sequence data bytes passed up */
+  u64_t stats_bytes_out;  /* Data bytes acknowledged by the remote host */
+  u32_t stats_segs_in;    /* Segments received */
+  u32_t stats_segs_out;   /* Segments sent, including retransmissions and control segments */
+  u32_t stats_rexmits;    /* Segments retransmitted */
+#endif /* LWIP_TCP_PCB_STATS */
+
 #if LWIP_CALLBACK_API || TCP_LISTEN_BACKLOG
   struct tcp_pcb_listen* listener;
 #endif /* LWIP_CALLBACK_API || TCP_LISTEN_BACKLOG */
@@ -434,6 +493,12 @@ void             tcp_poll    (struct tcp_pcb *pcb, tcp_poll_fn poll, u8_t interv
 #define          tcp_sndbuf(pcb)          (TCPWND16((pcb)->snd_buf))
 /** @ingroup tcp_raw */
 #define          tcp_sndqueuelen(pcb)     ((pcb)->snd_queuelen)
+#if LWIP_TCP_BUFFERS
+/* a larger send buffer needs room for more segments */
+#define          TCP_SND_QUEUELEN_MAX(pcb) ((u16_t)LWIP_MIN(LWIP_MAX(TCP_SND_QUEUELEN, 2U * (pcb)->snd_buf_size / (pcb)->mss), TCP_SNDQUEUELEN_OVERFLOW))
+#else /* LWIP_TCP_BUFFERS */
+#define          TCP_SND_QUEUELEN_MAX(pcb) LWIP_MIN(TCP_SND_QUEUELEN, TCP_SNDQUEUELEN_OVERFLOW)
+#endif /* LWIP_TCP_BUFFERS */
 /** @ingroup tcp_raw */
 #define          tcp_nagle_disable(pcb)   tcp_set_flags(pcb, TF_NODELAY)
 /** @ingroup tcp_raw */
@@ -484,6 +549,30 @@ err_t            tcp_tcp_get_tcp_addrinfo(struct tcp_pcb *pcb, int local, ip_add
 /* for compatibility with older implementation */
 #define tcp_new_ip6() tcp_new_ip_type(IPADDR_TYPE_V6)
 
+#if LWIP_TCP_BUFFERS
+void             tcp_set_buffers(struct tcp_pcb *pcb, tcpwnd_size_t snd_buf, tcpwnd_size_t rcv_buf, tcpwnd_size_t rcv_buf_max);
+#endif /* LWIP_TCP_BUFFERS */
+
+#if LWIP_TCP_CC
+/** A congestion control algorithm, called in place of lwIP's built-in Reno */
+struct tcp_cc_ops {
+  const char *name;
+  /** the connection got established, set the initial cwnd */
+  void (*init)(struct tcp_pcb *pcb);
+  /** 'acked' bytes of new data got acknowledged outside of fast recovery */
+  void (*acked)(struct tcp_pcb *pcb, tcpwnd_size_t acked);
+  /** a loss was detected by duplicate ACKs, or by the retransmission timer if 'rto' */
+  void (*loss)(struct tcp_pcb *pcb, u8_t rto);
+};
+
+extern const struct tcp_cc_ops tcp_cc_reno;
+extern const struct tcp_cc_ops tcp_cc_cubic;
+extern const struct tcp_cc_ops tcp_cc_local;
+
+void tcp_set_default_cc(const struct tcp_cc_ops *cc);
+void tcp_set_cc(struct tcp_pcb *pcb, const struct tcp_cc_ops *cc);
+#endif /* LWIP_TCP_CC */
+
 #if LWIP_TCP_PCB_NUM_EXT_ARGS
 u8_t tcp_ext_arg_alloc_id(void);
 void tcp_ext_arg_set_callbacks(struct tcp_pcb *pcb, uint8_t id, const struct tcp_ext_arg_callbacks * const callbacks);
@@ -57,6 +57,9 @@ extern "C" {
 #define UDP_FLAGS_UDPLITE        0x02U
 #define UDP_FLAGS_CONNECTED      0x04U
 #define UDP_FLAGS_MULTICAST_LOOP 0x08U
+#if LWIP_PCB_HASH
+#define UDP_FLAGS_HASHED         0x10U
+#endif /* LWIP_PCB_HASH */
 
 #define udp_current_src()        (udp_data.src)
 #define udp_current_dst()        (udp_data.dst)
@@ -88,6 +91,10 @@ struct udp_pcb {
 /* Protocol specific PCB members */
 
   struct udp_pcb *next;
+#if LWIP_PCB_HASH
+  /* next pcb in the same udp_pcb_hash bucket */
+  struct udp_pcb *hash_next;
+#endif /* LWIP_PCB_HASH */
 
   u8_t flags;
   /** ports are in host byte order */
@@ -0,0 +1,25 @@
+#ifndef LWIP_HOOKS_H
+#define LWIP_HOOKS_H
+
+#include "lwip/arch.h"
+
+struct pbuf;
+struct tcp_pcb;
+
+#if LWIP_TCP_WRITE_REF
+struct pbuf *tcp_write_ref_pbuf(void *ref, const void *data, u16_t length);
+
+#define LWIP_HOOK_TCP_WRITE_REF(pcb, data, length) tcp_write_ref_pbuf((pcb)->write_ref, data, length)
+#endif /* LWIP_TCP_WRITE_REF */
+
+#if LWIP_TCP_SYN_COOKIES
+#include "lwip/ip_addr.h"
+
+u32_t tcp_syncookie_isn(const ip_addr_t *local_ip, u16_t local_port,
+                        const ip_addr_t *remote_ip, u16_t remote_port);
+
+#define LWIP_HOOK_TCP_ISN(local_ip, local_port, remote_ip, remote_port) \
+  tcp_syncookie_isn(local_ip, local_port, remote_ip, remote_port)
+#endif /* LWIP_TCP_SYN_COOKIES */
+
+#endif /* LWIP_HOOKS_H */
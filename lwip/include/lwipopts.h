@@ -64,9 +64,13 @@
 #define LWIP_NETIF_LOOPBACK        0
 
 #define TCP_LISTEN_BACKLOG         128
+/* Connections waiting for accept, at most what the acceptmbox of the port holds (SYS_MBOX_SIZE - 1):
+   one established beyond it is reset. */
+#define TCP_DEFAULT_LISTEN_BACKLOG 127
 
 #define LWIP_COMPAT_SOCKETS        0
-#define LWIP_SO_RCVTIMEO           0
+#define LWIP_SO_RCVTIMEO           1
+#define LWIP_SO_SNDTIMEO           1
 #define LWIP_SO_RCVBUF             0
 
 #define LWIP_TCPIP_CORE_LOCKING    1
@@ -77,6 +81,9 @@
 #define LWIP_NETIF_EXT_STATUS_CALLBACK  0
 
 #define LWIP_NETCONN_FULLDUPLEX     1
+#define LWIP_NETCONN_CALLBACK_ARG   1
+#define LWIP_NETCONN_ACCEPT_BATCH   1
+#define LWIP_NETCONN_DEFER_ACCEPT   1
 #define LWIP_NETCONN_SEM_PER_THREAD 1
 
 #ifdef LWIP_DEBUG
@@ -199,19 +206,59 @@ a lot of data that needs to be copied, this should be set high. */
 #define LWIP_TCP_SACK_OUT 1
 #define LWIP_TCP_TIMESTAMPS 0
 #define LWIP_CHECKSUM_ON_COPY 0
+#define LWIP_CHECKSUM_CTRL_PER_NETIF 1
+
+/* Build TCP segments larger than MSS on TSO capable netif, segmented later by the device. */
+#define LWIP_TCP_GSO            1
+#define TCP_GSO_MAX_SIZE        65000
+
+/* Reference caller memory for TCP_WRITE_FLAG_REF writes through custom pbufs, freed once lwIP drops them. */
+#define LWIP_TCP_WRITE_REF      1
+#define LWIP_SUPPORT_CUSTOM_PBUF 1
+#define LWIP_HOOK_FILENAME      "lwip_hooks.h"
+
+/* Find active/TIME-WAIT TCP pcbs and connected UDP pcbs through a 4-tuple hash instead of list scans. */
+#define LWIP_PCB_HASH           1
+#define TCP_PCB_HASH_SIZE       4096
+#define UDP_PCB_HASH_SIZE       1024
+
+/* Run TCP timers off a timer wheel that only visits pcbs with a timer due or state changed since the last tick. */
+#define LWIP_TCP_TIMER_WHEEL    1
+
+/* Route cwnd/ssthresh updates through per-pcb congestion control ops (Reno, CUBIC, local link). */
+#define LWIP_TCP_CC             1
+
+/* Per-pcb send buffer and receive window sizes, with receive window autotuning up to TCP_RCV_BUF_MAX
+   while the receive windows of all pcbs add up to less than TCP_RCV_BUF_BUDGET. */
+#define LWIP_TCP_BUFFERS        1
+#define TCP_RCV_BUF_MAX         (4 * 1024 * 1024)
+#define TCP_RCV_BUF_BUDGET      (256 * 1024 * 1024)
+
+/* Answer SYNs with SYN cookies and no pcb once a listener has TCP_SYNCOOKIE_PENDING connections (or its
+   whole backlog) waiting for a handshake or for accept, or when a pcb cannot be allocated. ISNs come from a
+   keyed hash of the 4-tuple (LWIP_HOOK_TCP_ISN). */
+#define LWIP_TCP_SYN_COOKIES    1
+#define TCP_SYNCOOKIE_PENDING   64
+
+/* Count segments, bytes and retransmissions per pcb for tcp_conn_stats(). */
+#define LWIP_TCP_PCB_STATS      1
 
 /* Controls if TCP should queue segments that arrive out of
    order. Define to 0 if your device is low on memory. */
 #define TCP_QUEUE_OOSEQ         1
 
-/* TCP Maximum segment size. */
-#define TCP_MSS                 9000
+/* Links with an MTU up to 65535: pbufs up to 64 KiB in one allocation, TCP_SNDLOWAT must be 0. */
+#define LWIP_JUMBO_MTU          1
+
+/* TCP Maximum segment size, 65535 minus the IP and TCP headers. The MSS in use
+   follows the MTU of the link through TCP_CALCULATE_EFF_SEND_MSS. */
+#define TCP_MSS                 65495
 
-/* TCP sender buffer space (bytes). */
-#define TCP_SND_BUF             65535
+/* TCP sender buffer space (bytes), four segments at the largest MSS. */
+#define TCP_SND_BUF             (256 * 1024)
 
 /* TCP receive window. */
-#define TCP_WND                 65535
+#define TCP_WND                 (256 * 1024)
 
 /* TCP sender buffer space (pbufs). This must be at least = 2 *
    TCP_SND_BUF/TCP_MSS for things to work. */
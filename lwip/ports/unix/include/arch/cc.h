@@ -58,6 +58,10 @@
 
 #define LWIP_RAND() ((u32_t)rand())
 
+#include <stddef.h>
+void sys_arch_random(void *buf, size_t len);
+#define LWIP_RAND_BYTES(buf, len) sys_arch_random(buf, len)
+
 /* different handling for unit test, normally not needed */
 #ifdef LWIP_NOASSERT_ON_ERROR
 #define LWIP_ERROR(message, expression, handler) do { if (!(expression)) { \
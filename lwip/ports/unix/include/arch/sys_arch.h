@@ -55,6 +55,7 @@ typedef struct sys_mbox * sys_mbox_t;
 #define sys_mbox_valid_val(mbox)       sys_sem_valid_val(mbox)
 #define sys_mbox_set_invalid(mbox)     sys_sem_set_invalid(mbox)
 #define sys_mbox_set_invalid_val(mbox) sys_sem_set_invalid_val(mbox)
+int sys_arch_mbox_count(sys_mbox_t *mbox);
 
 struct sys_thread;
 typedef struct sys_thread * sys_thread_t;
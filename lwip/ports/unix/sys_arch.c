@@ -53,6 +53,8 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
 
 #include "lwip/def.h"
 
@@ -391,6 +393,22 @@ sys_arch_mbox_tryfetch(struct sys_mbox **mb, void **msg)
   return 0;
 }
 
+/* Number of messages waiting in a mailbox */
+int
+sys_arch_mbox_count(struct sys_mbox **mb)
+{
+  struct sys_mbox *mbox;
+  int count;
+  LWIP_ASSERT("invalid mbox", (mb != NULL) && (*mb != NULL));
+  mbox = *mb;
+
+  sys_arch_sem_wait(&mbox->mutex, 0);
+  count = mbox->last - mbox->first;
+  sys_sem_signal(&mbox->mutex);
+
+  return count;
+}
+
 u32_t
 sys_arch_mbox_fetch(struct sys_mbox **mb, void **msg, u32_t timeout)
 {
@@ -650,6 +668,50 @@ sys_jiffies(void)
   return (u32_t)(ts.tv_sec * 1000000000L + ts.tv_nsec);
 }
 
+/*-----------------------------------------------------------------------------------*/
+/* Random */
+void
+sys_arch_random(void *buf, size_t len)
+{
+  u8_t *p = (u8_t *)buf;
+  int fd;
+
+#ifdef SYS_getrandom
+  while (len > 0) {
+    long n = syscall(SYS_getrandom, p, len, 0);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  if (len == 0) {
+    return;
+  }
+#endif /* SYS_getrandom */
+  /* kernels before 3.17 */
+  fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+  while (fd >= 0 && len > 0) {
+    ssize_t n = read(fd, p, len);
+    if (n <= 0) {
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  if (len > 0) {
+    LWIP_DEBUGF(SYS_DEBUG, ("sys_arch_random: no entropy, errno %d", errno));
+    abort();
+  }
+  close(fd);
+}
+
 /*-----------------------------------------------------------------------------------*/
 /* Init */
 
@@ -0,0 +1,583 @@
+#include "engine.h"
+
+#include "interface.h"
+#include "notify.h"
+
+#include "lwip/tcp.h"
+
+#include <stdlib.h>
+#include <stdatomic.h>
+
+// coarse TCP timer ticks between retries of a write refused for memory
+#define STREAM_POLL_INTERVAL 1
+
+struct tcp_engine_t {
+    struct tcp_pcb *pcb;
+
+    pthread_mutex_t lock;
+    notify_t notify;
+    tcp_stream_t *head;
+    tcp_stream_t *tail;
+    int closed;
+
+    // the owner plus every stream
+    atomic_int refs;
+};
+
+// received data is queued as chains, tot_len of each stays within 16 bits
+typedef struct stream_chain_t {
+    struct pbuf *p;
+    struct stream_chain_t *next;
+} stream_chain_t;
+
+struct tcp_stream_t {
+    tcp_engine_t *engine;
+
+    ip_addr_t local;
+    ip_addr_t remote;
+    uint16_t local_port;
+    uint16_t remote_port;
+
+    // guarded by the lwIP core lock
+    struct tcp_pcb *pcb;
+    stream_chain_t *received;
+    stream_chain_t *received_tail;
+    int fin;
+    int rx_closed;
+    int tx_closed;
+    int want_write;
+
+    // guarded by the engine lock
+    tcp_stream_t *next;
+    int events;
+    int queued;
+    int closed;
+
+    // the owner, the attached pcb and the ready list
+    atomic_int refs;
+};
+
+static void engine_put(tcp_engine_t *engine) {
+    if (atomic_fetch_sub(&engine->refs, 1) != 1)
+        return;
+
+    pthread_mutex_destroy(&engine->lock);
+    notify_destroy(&engine->notify);
+
+    free(engine);
+}
+
+// frees everything queued and returns its length
+static int stream_drop_received(tcp_stream_t *stream) {
+    int length = 0;
+
+    while (stream->received != NULL) {
+        stream_chain_t *chain = stream->received;
+
+        stream->received = chain->next;
+
+        length += chain->p->tot_len;
+
+        pbuf_free(chain->p);
+        free(chain);
+    }
+
+    stream->received_tail = NULL;
+
+    return length;
+}
+
+// the window reopens for data the owner has taken or dropped
+static void stream_recved(tcp_stream_t *stream, int length) {
+    if (stream->pcb == NULL)
+        return;
+
+    while (length > 0) {
+        u16_t chunk = (u16_t) LWIP_MIN(length, 0xffff);
+
+        tcp_recved(stream->pcb, chunk);
+
+        length -= chunk;
+    }
+}
+
+static void stream_put(tcp_stream_t *stream) {
+    if (atomic_fetch_sub(&stream->refs, 1) != 1)
+        return;
+
+    stream_drop_received(stream);
+
+    engine_put(stream->engine);
+
+    free(stream);
+}
+
+static void stream_signal(tcp_stream_t *stream, int events) {
+    tcp_engine_t *engine = stream->engine;
+
+    {
+        WITH_MUTEX_LOCKED(lock, &engine->lock);
+
+        if (engine->closed || stream->closed)
+            return;
+
+        stream->events |= events;
+
+        if (stream->queued)
+            return;
+
+        stream->queued = 1;
+        stream->next = NULL;
+
+        atomic_fetch_add(&stream->refs, 1);
+
+        if (engine->tail != NULL)
+            engine->tail->next = stream;
+        else
+            engine->head = stream;
+
+        engine->tail = stream;
+    }
+
+    notify_signal(&engine->notify);
+}
+
+// called with the core locked, lwIP keeps finishing the close on its own
+static void stream_detach(tcp_stream_t *stream) {
+    struct tcp_pcb *pcb = stream->pcb;
+    if (pcb == NULL)
+        return;
+
+    stream->pcb = NULL;
+
+    tcp_arg(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_sent(pcb, NULL);
+    tcp_poll(pcb, NULL, 0);
+    tcp_err(pcb, NULL);
+
+    if (tcp_close(pcb) != ERR_OK)
+        tcp_abort(pcb);
+
+    stream_put(stream);
+}
+
+static err_t stream_recv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err) {
+    tcp_stream_t *stream = (tcp_stream_t *) arg;
+
+    (void) err;
+
+    if (p == NULL) {
+        stream->fin = 1;
+
+        stream_signal(stream, TCP_STREAM_READABLE);
+
+        return ERR_OK;
+    }
+
+    if (stream->rx_closed) {
+        tcp_recved(pcb, p->tot_len);
+        pbuf_free(p);
+
+        return ERR_OK;
+    }
+
+    stream_chain_t *tail = stream->received_tail;
+
+    if (tail != NULL && tail->p->tot_len + p->tot_len <= 0xffff) {
+        pbuf_cat(tail->p, p);
+    } else {
+        stream_chain_t *chain = malloc(sizeof(stream_chain_t));
+
+        // lwIP keeps the segment as refused data and retries later
+        if (chain == NULL)
+            return ERR_MEM;
+
+        chain->p = p;
+        chain->next = NULL;
+
+        if (tail != NULL)
+            tail->next = chain;
+        else
+            stream->received = chain;
+
+        stream->received_tail = chain;
+    }
+
+    stream_signal(stream, TCP_STREAM_READABLE);
+
+    return ERR_OK;
+}
+
+// what tcp_write takes without failing on the send buffer or the segment queue
+static int stream_send_room(struct tcp_pcb *pcb) {
+    int queue_left = TCP_SND_QUEUELEN_MAX(pcb) - tcp_sndqueuelen(pcb);
+
+    return queue_left > 0 ? LWIP_MIN(tcp_sndbuf(pcb), queue_left * tcp_mss(pcb)) : 0;
+}
+
+static void stream_writable(tcp_stream_t *stream, struct tcp_pcb *pcb) {
+    stream->want_write = 0;
+
+    tcp_poll(pcb, NULL, 0);
+
+    stream_signal(stream, TCP_STREAM_WRITABLE);
+}
+
+static err_t stream_sent(void *arg, struct tcp_pcb *pcb, u16_t length) {
+    tcp_stream_t *stream = (tcp_stream_t *) arg;
+
+    (void) length;
+
+    if (stream->want_write)
+        stream_writable(stream, pcb);
+
+    return ERR_OK;
+}
+
+// a write refused for memory with nothing in flight gets no ACK to wait for
+static err_t stream_poll(void *arg, struct tcp_pcb *pcb) {
+    tcp_stream_t *stream = (tcp_stream_t *) arg;
+
+    if (stream->want_write && stream_send_room(pcb) > 0)
+        stream_writable(stream, pcb);
+
+    return ERR_OK;
+}
+
+// the pcb is already gone when this runs
+static void stream_error(void *arg, err_t err) {
+    tcp_stream_t *stream = (tcp_stream_t *) arg;
+
+    (void) err;
+
+    stream->pcb = NULL;
+
+    stream_signal(stream, TCP_STREAM_ERROR);
+    stream_put(stream);
+}
+
+static err_t engine_accept(void *arg, struct tcp_pcb *pcb, err_t err) {
+    tcp_engine_t *engine = (tcp_engine_t *) arg;
+
+    if (err != ERR_OK || pcb == NULL)
+        return ERR_VAL;
+
+    tcp_stream_t *stream = malloc(sizeof(tcp_stream_t));
+    if (stream == NULL)
+        return ERR_MEM;
+
+    stream->engine = engine;
+    stream->local = pcb->local_ip;
+    stream->remote = pcb->remote_ip;
+    stream->local_port = pcb->local_port;
+    stream->remote_port = pcb->remote_port;
+    stream->pcb = pcb;
+    stream->received = NULL;
+    stream->received_tail = NULL;
+    stream->fin = 0;
+    stream->rx_closed = 0;
+    stream->tx_closed = 0;
+    stream->want_write = 0;
+    stream->next = NULL;
+    stream->events = 0;
+    stream->queued = 0;
+    stream->closed = 0;
+
+    atomic_init(&stream->refs, 2);
+    atomic_fetch_add(&engine->refs, 1);
+
+    tcp_arg(pcb, stream);
+    tcp_recv(pcb, &stream_recv);
+    tcp_sent(pcb, &stream_sent);
+    tcp_err(pcb, &stream_error);
+
+    stream_signal(stream, TCP_STREAM_ACCEPTED);
+
+    return ERR_OK;
+}
+
+EXPORT
+tcp_engine_t *tcp_engine_listen() {
+    tcp_engine_t *engine = malloc(sizeof(tcp_engine_t));
+    if (engine == NULL)
+        return NULL;
+
+    engine->head = NULL;
+    engine->tail = NULL;
+    engine->closed = 0;
+
+    atomic_init(&engine->refs, 1);
+
+    pthread_mutex_init(&engine->lock, NULL);
+    notify_init(&engine->notify);
+
+    WITH_LWIP_LOCKED();
+
+    struct tcp_pcb *pcb = tcp_new();
+    if (pcb == NULL)
+        goto abort;
+
+    tcp_bind_netif(pcb, global_interface_get());
+
+    if (tcp_bind(pcb, IP4_ADDR_ANY, TCP_ACCEPT_ANY_PORT) != ERR_OK)
+        goto abort_pcb;
+
+    engine->pcb = tcp_listen_with_backlog(pcb, TCP_DEFAULT_LISTEN_BACKLOG);
+    if (engine->pcb == NULL)
+        goto abort_pcb;
+
+    tcp_arg(engine->pcb, engine);
+    tcp_accept(engine->pcb, &engine_accept);
+
+    return engine;
+
+    abort_pcb:
+    tcp_close(pcb);
+
+    abort:
+    engine_put(engine);
+
+    return NULL;
+}
+
+EXPORT
+int tcp_engine_poll(tcp_engine_t *engine, tcp_engine_event_t events[], int count, int timeout) {
+    while (1) {
+        uint32_t sequence = notify_prepare(&engine->notify);
+
+        {
+            WITH_MUTEX_LOCKED(lock, &engine->lock);
+
+            int size = 0;
+
+            while (engine->head != NULL && size < count) {
+                tcp_stream_t *stream = engine->head;
+
+                engine->head = stream->next;
+                if (engine->head == NULL)
+                    engine->tail = NULL;
+
+                // events of streams closed meanwhile are dropped
+                if (!stream->closed) {
+                    events[size].stream = stream;
+                    events[size].events = stream->events;
+
+                    size++;
+                }
+
+                stream->queued = 0;
+                stream->events = 0;
+
+                stream_put(stream);
+            }
+
+            if (size > 0 || engine->closed || timeout == 0) {
+                notify_cancel(&engine->notify);
+
+                return size == 0 && engine->closed ? -1 : size;
+            }
+        }
+
+        if (notify_wait(&engine->notify, sequence, timeout) < 0)
+            return 0;
+    }
+}
+
+EXPORT
+void tcp_engine_close(tcp_engine_t *engine) {
+    {
+        WITH_LWIP_LOCKED();
+
+        if (engine->pcb != NULL) {
+            tcp_arg(engine->pcb, NULL);
+            tcp_accept(engine->pcb, NULL);
+            tcp_close(engine->pcb);
+
+            engine->pcb = NULL;
+        }
+    }
+
+    {
+        WITH_MUTEX_LOCKED(lock, &engine->lock);
+
+        engine->closed = 1;
+    }
+
+    notify_signal(&engine->notify);
+}
+
+EXPORT
+void tcp_engine_free(tcp_engine_t *engine) {
+    tcp_engine_close(engine);
+
+    tcp_stream_t *pending;
+
+    {
+        WITH_MUTEX_LOCKED(lock, &engine->lock);
+
+        pending = engine->head;
+
+        engine->head = NULL;
+        engine->tail = NULL;
+    }
+
+    while (pending != NULL) {
+        tcp_stream_t *stream = pending;
+
+        pending = stream->next;
+
+        // never handed to the owner, nobody else would free it
+        if (stream->events & TCP_STREAM_ACCEPTED)
+            tcp_stream_free(stream);
+
+        stream_put(stream);
+    }
+
+    engine_put(engine);
+}
+
+EXPORT
+int tcp_stream_recv(tcp_stream_t *stream, void *data, int length) {
+    WITH_LWIP_LOCKED();
+
+    if (stream->received != NULL) {
+        int copied = 0;
+
+        while (stream->received != NULL && copied < length) {
+            stream_chain_t *chain = stream->received;
+
+            u16_t n = pbuf_copy_partial(chain->p, (uint8_t *) data + copied, (u16_t) LWIP_MIN(length - copied, 0xffff), 0);
+
+            copied += n;
+
+            chain->p = pbuf_free_header(chain->p, n);
+            if (chain->p != NULL)
+                continue;
+
+            stream->received = chain->next;
+            if (stream->received == NULL)
+                stream->received_tail = NULL;
+
+            free(chain);
+        }
+
+        stream_recved(stream, copied);
+
+        return copied;
+    }
+
+    if (stream->fin || stream->rx_closed)
+        return 0;
+
+    if (stream->pcb == NULL)
+        return -1;
+
+    return TCP_STREAM_AGAIN;
+}
+
+EXPORT
+int tcp_stream_send(tcp_stream_t *stream, const void *data, int length) {
+    WITH_LWIP_LOCKED();
+
+    struct tcp_pcb *pcb = stream->pcb;
+    if (pcb == NULL || stream->tx_closed)
+        return -1;
+
+    int available = stream_send_room(pcb);
+
+    if (length > available)
+        length = available;
+
+    if (length > 0) {
+        err_t err = tcp_write(pcb, data, length, TCP_WRITE_FLAG_COPY);
+        if (err == ERR_MEM)
+            length = 0;
+        else if (err != ERR_OK)
+            return -1;
+    }
+
+    // stream_sent raises TCP_STREAM_WRITABLE once acked data frees room, stream_poll retries without any
+    if (length == 0) {
+        if (!stream->want_write) {
+            stream->want_write = 1;
+
+            tcp_poll(pcb, &stream_poll, STREAM_POLL_INTERVAL);
+        }
+
+        return TCP_STREAM_AGAIN;
+    }
+
+    tcp_output(pcb);
+
+    return length;
+}
+
+EXPORT
+int tcp_stream_shutdown(tcp_stream_t *stream, int rx, int tx) {
+    WITH_LWIP_LOCKED();
+
+    if (rx && !stream->rx_closed) {
+        stream->rx_closed = 1;
+
+        stream_recved(stream, stream_drop_received(stream));
+    }
+
+    if (tx)
+        stream->tx_closed = 1;
+
+    if (stream->pcb == NULL)
+        return -1;
+
+    // lwIP may free a pcb shut in both directions, hand it over like a close
+    if (stream->rx_closed && stream->tx_closed) {
+        stream_detach(stream);
+
+        return 0;
+    }
+
+    if (tcp_shutdown(stream->pcb, rx, tx) != ERR_OK)
+        return -1;
+
+    return 0;
+}
+
+EXPORT
+void tcp_stream_local_addr(tcp_stream_t *stream, uint8_t addr[4], uint16_t *port) {
+    addr[0] = ip4_addr_get_byte(&stream->local, 0);
+    addr[1] = ip4_addr_get_byte(&stream->local, 1);
+    addr[2] = ip4_addr_get_byte(&stream->local, 2);
+    addr[3] = ip4_addr_get_byte(&stream->local, 3);
+
+    *port = stream->local_port;
+}
+
+EXPORT
+void tcp_stream_remote_addr(tcp_stream_t *stream, uint8_t addr[4], uint16_t *port) {
+    addr[0] = ip4_addr_get_byte(&stream->remote, 0);
+    addr[1] = ip4_addr_get_byte(&stream->remote, 1);
+    addr[2] = ip4_addr_get_byte(&stream->remote, 2);
+    addr[3] = ip4_addr_get_byte(&stream->remote, 3);
+
+    *port = stream->remote_port;
+}
+
+EXPORT
+void tcp_stream_close(tcp_stream_t *stream) {
+    {
+        WITH_MUTEX_LOCKED(lock, &stream->engine->lock);
+
+        stream->closed = 1;
+    }
+
+    WITH_LWIP_LOCKED();
+
+    stream_detach(stream);
+}
+
+EXPORT
+void tcp_stream_free(tcp_stream_t *stream) {
+    tcp_stream_close(stream);
+
+    stream_put(stream);
+}
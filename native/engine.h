@@ -0,0 +1,35 @@
+#pragma once
+
+#include "utils.h"
+
+#include <stdint.h>
+
+#define TCP_STREAM_AGAIN -2
+
+typedef struct tcp_engine_t tcp_engine_t;
+typedef struct tcp_stream_t tcp_stream_t;
+
+typedef enum tcp_stream_events_t {
+    TCP_STREAM_ACCEPTED = 1 << 0,
+    TCP_STREAM_READABLE = 1 << 1,
+    TCP_STREAM_WRITABLE = 1 << 2,
+    TCP_STREAM_ERROR = 1 << 3,
+} tcp_stream_events_t;
+
+typedef struct tcp_engine_event_t {
+    tcp_stream_t *stream;
+    int events;
+} tcp_engine_event_t;
+
+EXPORT tcp_engine_t *tcp_engine_listen();
+EXPORT int tcp_engine_poll(tcp_engine_t *engine, tcp_engine_event_t events[], int count, int timeout);
+EXPORT void tcp_engine_close(tcp_engine_t *engine);
+EXPORT void tcp_engine_free(tcp_engine_t *engine);
+
+EXPORT int tcp_stream_recv(tcp_stream_t *stream, void *data, int length);
+EXPORT int tcp_stream_send(tcp_stream_t *stream, const void *data, int length);
+EXPORT int tcp_stream_shutdown(tcp_stream_t *stream, int rx, int tx);
+EXPORT void tcp_stream_local_addr(tcp_stream_t *stream, uint8_t addr[4], uint16_t *port);
+EXPORT void tcp_stream_remote_addr(tcp_stream_t *stream, uint8_t addr[4], uint16_t *port);
+EXPORT void tcp_stream_close(tcp_stream_t *stream);
+EXPORT void tcp_stream_free(tcp_stream_t *stream);
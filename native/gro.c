@@ -0,0 +1,137 @@
+#include "gro.h"
+
+#include "lwip/def.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+
+#include <string.h>
+
+#define GRO_HLEN (IP_HLEN + TCP_HLEN)
+
+typedef struct gro_flow_t {
+    struct pbuf *p;
+    int tcp;
+    int mergeable;
+    uint16_t length;
+} gro_flow_t;
+
+static int parse_segment(struct pbuf *p, gro_flow_t *flow) {
+    flow->p = p;
+    flow->tcp = 0;
+    flow->mergeable = 0;
+    flow->length = 0;
+
+    if (p->len < GRO_HLEN)
+        return 0;
+
+    struct ip_hdr *iphdr = (struct ip_hdr *) p->payload;
+
+    if (IPH_V(iphdr) != 4 || IPH_HL_BYTES(iphdr) != IP_HLEN || IPH_PROTO(iphdr) != IP_PROTO_TCP)
+        return 0;
+
+    if ((lwip_ntohs(IPH_OFFSET(iphdr)) & (IP_MF | IP_OFFMASK)) != 0)
+        return 0;
+
+    if (lwip_ntohs(IPH_LEN(iphdr)) != p->tot_len)
+        return 0;
+
+    struct tcp_hdr *tcphdr = (struct tcp_hdr *) ((uint8_t *) p->payload + IP_HLEN);
+
+    flow->tcp = 1;
+
+    // options such as timestamps would have to match, only merge bare headers
+    if (TCPH_HDRLEN_BYTES(tcphdr) != TCP_HLEN)
+        return 1;
+
+    if ((TCPH_FLAGS(tcphdr) & ~TCP_PSH) != TCP_ACK)
+        return 1;
+
+    flow->length = p->tot_len - GRO_HLEN;
+    flow->mergeable = flow->length > 0;
+
+    return 1;
+}
+
+static int same_flow(const gro_flow_t *a, const gro_flow_t *b) {
+    const struct ip_hdr *ia = (const struct ip_hdr *) a->p->payload;
+    const struct ip_hdr *ib = (const struct ip_hdr *) b->p->payload;
+
+    if (memcmp(&ia->src, &ib->src, sizeof(ia->src)) != 0 || memcmp(&ia->dest, &ib->dest, sizeof(ia->dest)) != 0)
+        return 0;
+
+    const struct tcp_hdr *ta = (const struct tcp_hdr *) ((const uint8_t *) a->p->payload + IP_HLEN);
+    const struct tcp_hdr *tb = (const struct tcp_hdr *) ((const uint8_t *) b->p->payload + IP_HLEN);
+
+    return ta->src == tb->src && ta->dest == tb->dest;
+}
+
+static int try_merge(gro_flow_t *head, gro_flow_t *next) {
+    if (!head->mergeable || !next->mergeable)
+        return 0;
+
+    struct ip_hdr *ih = (struct ip_hdr *) head->p->payload;
+    struct ip_hdr *in = (struct ip_hdr *) next->p->payload;
+    struct tcp_hdr *th = (struct tcp_hdr *) ((uint8_t *) head->p->payload + IP_HLEN);
+    struct tcp_hdr *tn = (struct tcp_hdr *) ((uint8_t *) next->p->payload + IP_HLEN);
+
+    if (TCPH_FLAGS(th) & TCP_PSH)
+        return 0;
+
+    if (IPH_TOS(ih) != IPH_TOS(in) || th->ackno != tn->ackno || th->wnd != tn->wnd)
+        return 0;
+
+    if (lwip_ntohl(th->seqno) + head->length != lwip_ntohl(tn->seqno))
+        return 0;
+
+    if (head->p->tot_len + next->length > GRO_MAX_PACKET)
+        return 0;
+
+    uint8_t flags = TCPH_FLAGS(tn);
+
+    struct pbuf *payload = pbuf_free_header(next->p, GRO_HLEN);
+    if (payload == NULL)
+        return 0;
+
+    pbuf_cat(head->p, payload);
+
+    TCPH_SET_FLAG(th, flags & TCP_PSH);
+
+    head->length += next->length;
+
+    IPH_LEN_SET(ih, lwip_htons(head->p->tot_len));
+    IPH_CHKSUM_SET(ih, 0);
+    IPH_CHKSUM_SET(ih, inet_chksum(ih, IP_HLEN));
+
+    return 1;
+}
+
+int gro_coalesce(struct pbuf *array[], int size) {
+    gro_flow_t flows[GRO_BATCH_SIZE];
+    int count = 0;
+
+    for (int i = 0; i < size; i++) {
+        gro_flow_t *next = &flows[count];
+
+        if (count < GRO_BATCH_SIZE && parse_segment(array[i], next)) {
+            // only the latest segment of a flow may absorb, anything else in between keeps ordering
+            for (int j = count - 1; j >= 0; j--) {
+                if (!flows[j].tcp || !same_flow(&flows[j], next))
+                    continue;
+
+                if (try_merge(&flows[j], next))
+                    next = NULL;
+
+                break;
+            }
+
+            if (next == NULL)
+                continue;
+        }
+
+        array[count++] = array[i];
+    }
+
+    return count;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include "lwip/pbuf.h"
+
+#define GRO_BATCH_SIZE 64
+#define GRO_MAX_PACKET 65535
+
+int gro_coalesce(struct pbuf *array[], int size);
@@ -3,21 +3,68 @@
 #include "lwip/netif.h"
 #include "lwip/ip.h"
 #include "lwip/debug.h"
+#include "lwip/def.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
 
 #include <stdio.h>
+#include <string.h>
 
 static struct netif global_if;
 
-static global_interface_output_func output_func;
-static void *output_context;
+typedef struct device_t {
+    global_interface_output_func output;
+    void *context;
+} device_t;
 
-static err_t global_if_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr) {
-    if (output_func != NULL) {
-        pbuf_ref(p);
+static device_t devices[MAX_DEVICES];
+static int devices_count;
+
+static uint32_t flow_hash(struct pbuf *p) {
+    if (p->len < IP_HLEN)
+        return 0;
+
+    const uint8_t *packet = (const uint8_t *) p->payload;
+    const struct ip_hdr *iphdr = (const struct ip_hdr *) packet;
+
+    uint16_t hlen = IPH_HL_BYTES(iphdr);
+    uint8_t proto = IPH_PROTO(iphdr);
+
+    uint32_t hash = iphdr->src.addr ^ iphdr->dest.addr ^ proto;
 
-        output_func(output_context, p);
+    // both tcp and udp start with the port pair, fragments hash on addresses only
+    if ((proto == IP_PROTO_TCP || proto == IP_PROTO_UDP) && p->len >= hlen + 4 &&
+        (lwip_ntohs(IPH_OFFSET(iphdr)) & (IP_MF | IP_OFFMASK)) == 0) {
+        uint32_t ports;
+
+        memcpy(&ports, packet + hlen, sizeof(ports));
+
+        hash ^= ports;
     }
 
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+
+    return hash;
+}
+
+static err_t global_if_output(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr) {
+    if (devices_count == 0)
+        return ERR_OK;
+
+    device_t *device = &devices[0];
+
+    // keep every flow on one queue so it is never reordered
+    if (devices_count > 1)
+        device = &devices[flow_hash(p) % devices_count];
+
+    pbuf_ref(p);
+
+    device->output(device->context, p);
+
     return ERR_OK;
 }
 
@@ -52,22 +99,61 @@ void global_interface_inject_packet(struct pbuf *buf) {
     }
 }
 
-void global_interface_attach_device(global_interface_output_func output, void *state, int mtu) {
+int global_interface_attach_device(global_interface_output_func output, void *state, int mtu, int offload) {
     LWIP_ASSERT_CORE_LOCKED();
 
-    output_func = output;
-    output_context = state;
-
     if (mtu <= 0)
         mtu = DEFAULT_MTU;
+    else if (mtu > MAX_MTU)
+        mtu = MAX_MTU;
+
+    // every queue of a multi-queue device shares its mtu and offloads
+    if (devices_count > 0) {
+        int attached_offload = (global_if.flags & NETIF_FLAG_TSO) != 0;
+
+        if (devices_count >= MAX_DEVICES || global_if.mtu != mtu || attached_offload != (offload != 0))
+            return -1;
+    }
+
+    devices[devices_count].output = output;
+    devices[devices_count].context = state;
+    devices_count++;
 
     global_if.mtu = mtu;
+
+    if (offload) {
+        global_if.flags |= NETIF_FLAG_TSO;
+
+        NETIF_SET_CHECKSUM_CTRL(&global_if, NETIF_CHECKSUM_ENABLE_ALL & ~NETIF_CHECKSUM_GEN_TCP);
+    } else {
+        global_if.flags &= ~NETIF_FLAG_TSO;
+
+        NETIF_SET_CHECKSUM_CTRL(&global_if, NETIF_CHECKSUM_ENABLE_ALL);
+    }
+
+    return 0;
 }
 
-int global_interface_is_attached() {
+void global_interface_detach_device(void *state) {
     LWIP_ASSERT_CORE_LOCKED();
 
-    return output_func != NULL || output_context != NULL;
+    for (int i = 0; i < devices_count; i++) {
+        if (devices[i].context != state)
+            continue;
+
+        devices_count--;
+
+        memmove(&devices[i], &devices[i + 1], (devices_count - i) * sizeof(device_t));
+
+        break;
+    }
+
+    if (devices_count == 0) {
+        global_if.mtu = DEFAULT_MTU;
+        global_if.flags &= ~NETIF_FLAG_TSO;
+
+        NETIF_SET_CHECKSUM_CTRL(&global_if, NETIF_CHECKSUM_ENABLE_ALL);
+    }
 }
 
 struct netif *global_interface_get() {
@@ -6,12 +6,14 @@
 #include "lwip/netif.h"
 
 #define DEFAULT_MTU 1500
+#define MAX_MTU 65535
+#define MAX_DEVICES 16
 
 typedef void (*global_interface_output_func)(void *ctx, struct pbuf *p);
 
 void global_interface_init();
 void global_interface_inject_packet(struct pbuf *buf);
-void global_interface_attach_device(global_interface_output_func output, void *state, int mtu);
+int global_interface_attach_device(global_interface_output_func output, void *state, int mtu, int offload);
+void global_interface_detach_device(void *state);
 
-int global_interface_is_attached();
 struct netif *global_interface_get();
\ No newline at end of file
@@ -2,95 +2,586 @@
 
 #include "utils.h"
 #include "interface.h"
+#include "gro.h"
 #include "queues.h"
+#include "scheduler.h"
+#include "vnet.h"
 
 #include "lwip/tcpip.h"
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+
+#define LINK_BATCH_SIZE 64
+#define LINK_IOV_SIZE 64
 
 struct link_t {
     struct pbuf_queue_t rx;
     struct pbuf_queue_t tx;
 
-    pthread_mutex_t rx_mutex;
-    pthread_cond_t rx_cond;
-
-    pthread_mutex_t tx_mutex;
-    int tx_polling;
-
-    int closed;
+    scheduler_source_t tx_source;
+    atomic_int closed;
     int mtu;
+    int flags;
+    int frame_size;
+
+    int readable[2];
+    atomic_int armed;
+
+    int fd;
+    // flags of fd before attaching, restored once the threads stop using it
+    int fd_flags;
+    int wakeup[2];
+    int threads_running;
+    pthread_t reader;
+    pthread_t writer;
 };
 
-static void poll_tx(void *ctx) {
-    link_t *context = (link_t *) ctx;
-
-    struct pbuf *array[32];
-    int size;
+static void readable_notify(link_t *ctx) {
+    atomic_thread_fence(memory_order_seq_cst);
 
-    {
-        WITH_MUTEX_LOCKED(lock, &context->tx_mutex);
+    if (atomic_load(&ctx->armed) && atomic_exchange(&ctx->armed, 0))
+        event_fd_signal(ctx->readable);
+}
 
-        context->tx_polling = 0;
+static void inject_packets(void *ctx, struct pbuf *array[], int size) {
+    (void) ctx;
 
-        size = pbuf_queue_pop(&context->tx, array, 32);
-    }
+    size = gro_coalesce(array, size);
 
     for (int i = 0; i < size; i++) {
         global_interface_inject_packet(array[i]);
     }
 }
 
+static int enqueue_tx(link_t *ctx, struct pbuf *in[], int size) {
+    if (atomic_load(&ctx->closed)) {
+        for (int i = 0; i < size; i++) {
+            pbuf_free(in[i]);
+        }
+
+        return -1;
+    }
+
+    pbuf_queue_append(&ctx->tx, in, size);
+
+    scheduler_kick(&ctx->tx_source);
+
+    return size;
+}
+
+static struct pbuf *packet_from_buffer(link_t *ctx, const uint8_t *buffer, int size) {
+    vnet_hdr_t header;
+    const vnet_hdr_t *hdr = NULL;
+
+    if (ctx->flags & LINK_FLAG_VNET_HDR) {
+        if (size < VNET_HDR_LEN)
+            return NULL;
+
+        // packed batch buffers are not aligned for the header fields
+        memcpy(&header, buffer, VNET_HDR_LEN);
+
+        hdr = &header;
+
+        buffer += VNET_HDR_LEN;
+        size -= VNET_HDR_LEN;
+    }
+
+    if (size <= 0 || size > VNET_MAX_PACKET)
+        return NULL;
+
+    // one contiguous buffer, a jumbo packet would be a chain of dozens of pool pbufs
+    struct pbuf *target = pbuf_alloc(PBUF_IP, size, PBUF_RAM);
+    if (target == NULL)
+        return NULL;
+
+    if (pbuf_take(target, buffer, size) != ERR_OK) {
+        pbuf_free(target);
+
+        return NULL;
+    }
+
+    if (hdr != NULL && vnet_input(hdr, target) < 0) {
+        pbuf_free(target);
+
+        return NULL;
+    }
+
+    return target;
+}
+
+static int copy_packet(struct pbuf *source, void *buffer, int size) {
+    if (source == NULL)
+        return 0;
+
+    if (size >= source->tot_len) {
+        pbuf_copy_partial(source, buffer, source->tot_len, 0);
+
+        size = source->tot_len;
+    } else {
+        size = LINK_SHORT_BUFFER;
+    }
+
+    pbuf_free(source);
+
+    return size;
+}
+
+static int copy_batch(struct pbuf *sources[], int count, void *buffer, int size, int lengths[]) {
+    uint8_t *cursor = (uint8_t *) buffer;
+
+    for (int i = 0; i < count; i++) {
+        int copied = copy_packet(sources[i], cursor, size);
+
+        if (copied < 0) {
+            for (int j = i + 1; j < count; j++) {
+                pbuf_free(sources[j]);
+            }
+
+            return i > 0 ? i : copied;
+        }
+
+        lengths[i] = copied;
+
+        cursor += copied;
+        size -= copied;
+    }
+
+    return count;
+}
+
+// every packet fits in a frame, so only take as many as the buffer can hold
+static int batch_count(link_t *ctx, int size, int count) {
+    if (count > size / ctx->frame_size)
+        count = size / ctx->frame_size;
+    if (count > LINK_BATCH_SIZE)
+        count = LINK_BATCH_SIZE;
+
+    return count;
+}
+
+static int lease_packet(struct pbuf *source, segment_t segments[], int count, link_lease_t **lease) {
+    if (source == NULL)
+        return -1;
+
+    // too many segments for the caller, fall back to a single copy
+    if (pbuf_clen(source) > count) {
+        source = pbuf_coalesce(source, PBUF_RAW);
+
+        if (source->next != NULL) {
+            pbuf_free(source);
+
+            return -1;
+        }
+    }
+
+    int size = 0;
+
+    for (struct pbuf *p = source; p != NULL; p = p->next) {
+        segments[size].data = p->payload;
+        segments[size].length = p->len;
+
+        size++;
+    }
+
+    *lease = (link_lease_t *) source;
+
+    return size;
+}
+
+// pops without blocking, 0 once the link is armed to signal the readiness fd
+static int try_pop(link_t *ctx, struct pbuf *out[], int count) {
+    event_fd_drain(ctx->readable);
+
+    while (1) {
+        int popped = pbuf_queue_pop(&ctx->rx, out, count);
+        if (popped > 0)
+            return popped;
+
+        if (atomic_load(&ctx->closed))
+            return -1;
+
+        // arm before checking again, producers only signal an armed link
+        atomic_store(&ctx->armed, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+
+        if (pbuf_queue_length(&ctx->rx) == 0 && !atomic_load(&ctx->closed))
+            return 0;
+
+        atomic_store(&ctx->armed, 0);
+    }
+}
+
 static void if_output(void *context, struct pbuf *p) {
     link_t *ctx = (link_t *) context;
 
-    WITH_MUTEX_LOCKED(lock, &ctx->rx_mutex);
+    if (ctx->flags & LINK_FLAG_VNET_HDR) {
+        p = vnet_output(p);
+        if (p == NULL)
+            return;
+    }
 
     pbuf_queue_append(&ctx->rx, &p, 1);
 
-    pthread_cond_signal(&ctx->rx_cond);
+    readable_notify(ctx);
 }
 
-EXPORT
-link_t *link_attach(int mtu) {
-    WITH_LWIP_LOCKED();
+static int wait_fd(link_t *ctx, short events) {
+    struct pollfd fds[2] = {
+            {.fd = ctx->fd, .events = events},
+            {.fd = ctx->wakeup[0], .events = POLLIN},
+    };
+
+    while (poll(fds, 2, -1) < 0) {
+        if (errno != EINTR)
+            return -1;
+    }
+
+    if (fds[1].revents != 0)
+        return -1;
+
+    return 0;
+}
+
+static struct pbuf *fd_read_packet(link_t *ctx, uint8_t *overflow, ssize_t *result) {
+    vnet_hdr_t hdr;
+    struct iovec iov[3];
+    int count = 0;
+
+    struct pbuf *p = pbuf_alloc(PBUF_RAW, ctx->mtu, PBUF_RAM);
+    if (p == NULL) {
+        uint8_t discard;
+
+        // out of memory, drop the packet rather than stop reading, a short read truncates it
+        *result = read(ctx->fd, &discard, sizeof(discard));
 
-    if (global_interface_is_attached())
         return NULL;
+    }
+
+    if (ctx->flags & LINK_FLAG_VNET_HDR) {
+        iov[count].iov_base = &hdr;
+        iov[count].iov_len = VNET_HDR_LEN;
+        count++;
+    }
+
+    iov[count].iov_base = p->payload;
+    iov[count].iov_len = ctx->mtu;
+    count++;
+
+    if (overflow != NULL) {
+        iov[count].iov_base = overflow;
+        iov[count].iov_len = VNET_MAX_PACKET - ctx->mtu;
+        count++;
+    }
+
+    ssize_t n = readv(ctx->fd, iov, count);
+
+    *result = n;
+
+    if (ctx->flags & LINK_FLAG_VNET_HDR)
+        n -= VNET_HDR_LEN;
+
+    if (n <= 0) {
+        pbuf_free(p);
+
+        return NULL;
+    }
+
+    // gso super packet, larger than the mtu sized buffer
+    if (n > ctx->mtu) {
+        struct pbuf *large = pbuf_alloc(PBUF_RAW, n, PBUF_RAM);
+
+        if (large != NULL) {
+            pbuf_take(large, p->payload, ctx->mtu);
+            pbuf_take_at(large, overflow, n - ctx->mtu, ctx->mtu);
+        }
+
+        pbuf_free(p);
+
+        p = large;
+    } else {
+        pbuf_realloc(p, n);
+    }
+
+    if (p != NULL && (ctx->flags & LINK_FLAG_VNET_HDR) && vnet_input(&hdr, p) < 0) {
+        pbuf_free(p);
+
+        p = NULL;
+    }
+
+    return p;
+}
+
+static void *fd_reader(void *arg) {
+    link_t *ctx = (link_t *) arg;
+
+    struct pbuf *array[LINK_BATCH_SIZE];
+    int size = 0;
+
+    uint8_t *overflow = NULL;
+
+    if ((ctx->flags & LINK_FLAG_VNET_HDR) && ctx->mtu < VNET_MAX_PACKET)
+        overflow = malloc(VNET_MAX_PACKET - ctx->mtu);
+
+    while (1) {
+        ssize_t n;
+        struct pbuf *p = fd_read_packet(ctx, overflow, &n);
+        int error = errno;
+
+        if (p != NULL) {
+            array[size++] = p;
+
+            if (size < LINK_BATCH_SIZE)
+                continue;
+        }
+
+        if (size > 0) {
+            if (enqueue_tx(ctx, array, size) < 0)
+                break;
+
+            size = 0;
+        }
+
+        if (n > 0 || (n < 0 && error == EINTR))
+            continue;
+
+        if (n == 0 || (error != EAGAIN && error != EWOULDBLOCK))
+            break;
+
+        if (wait_fd(ctx, POLLIN) < 0)
+            break;
+    }
+
+    if (size > 0)
+        enqueue_tx(ctx, array, size);
+
+    free(overflow);
+
+    return NULL;
+}
+
+static int write_packet(link_t *ctx, struct pbuf *p) {
+    struct iovec iov[LINK_IOV_SIZE];
+    int count = 0;
+
+    for (struct pbuf *q = p; q != NULL && count < LINK_IOV_SIZE; q = q->next) {
+        iov[count].iov_base = q->payload;
+        iov[count].iov_len = q->len;
+
+        count++;
+    }
+
+    while (writev(ctx->fd, iov, count) < 0) {
+        if (errno == EINTR)
+            continue;
+
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return 0;
+
+        if (wait_fd(ctx, POLLOUT) < 0)
+            return -1;
+    }
 
-    link_t *ctx = (link_t *) malloc(sizeof(link_t));
+    return 0;
+}
+
+static void *fd_writer(void *arg) {
+    link_t *ctx = (link_t *) arg;
+
+    struct pbuf *array[LINK_BATCH_SIZE];
+    int size;
+
+    while (1) {
+        size = pbuf_queue_pop_wait(&ctx->rx, array, LINK_BATCH_SIZE);
+        if (size < 0)
+            return NULL;
+
+        int i;
+
+        for (i = 0; i < size; i++) {
+            // gso packets may be chained deeper than a single writev
+            if (pbuf_clen(array[i]) > LINK_IOV_SIZE)
+                array[i] = pbuf_coalesce(array[i], PBUF_RAW);
+
+            if (write_packet(ctx, array[i]) < 0)
+                break;
+
+            pbuf_free(array[i]);
+        }
+
+        for (; i < size; i++) {
+            pbuf_free(array[i]);
+        }
+    }
+}
+
+static link_t *link_new(int mtu, int flags) {
+    link_t *ctx = NULL;
+
+    if (posix_memalign((void **) &ctx, CACHE_LINE_SIZE, sizeof(link_t)) != 0)
+        return NULL;
 
     memset(ctx, 0, sizeof(link_t));
 
-    pthread_mutex_init(&ctx->rx_mutex, NULL);
-    pthread_mutex_init(&ctx->tx_mutex, NULL);
+    if (event_fd_open(ctx->readable) < 0) {
+        free(ctx);
+
+        return NULL;
+    }
+
+    ctx->fd = -1;
+    ctx->fd_flags = -1;
+    ctx->wakeup[0] = -1;
+    ctx->wakeup[1] = -1;
+
+    // rx is fed by if_output on the tcpip thread
+    if (pbuf_queue_init(&ctx->rx, 0) < 0 || pbuf_queue_init(&ctx->tx, 1) < 0) {
+        link_free(ctx);
+
+        return NULL;
+    }
+
+    scheduler_source_init(&ctx->tx_source, &ctx->tx, &inject_packets, ctx);
 
-    pthread_cond_init(&ctx->rx_cond, NULL);
+    if (mtu <= 0)
+        mtu = DEFAULT_MTU;
+    else if (mtu > MAX_MTU)
+        mtu = MAX_MTU;
 
     ctx->mtu = mtu;
+    ctx->flags = flags;
+    ctx->frame_size = (flags & LINK_FLAG_VNET_HDR) ? VNET_HDR_LEN + VNET_MAX_PACKET : mtu;
 
-    global_interface_attach_device(&if_output, ctx, ctx->mtu);
+    if (global_interface_attach_device(&if_output, ctx, ctx->mtu, flags & LINK_FLAG_VNET_HDR) < 0) {
+        link_free(ctx);
+
+        return NULL;
+    }
 
     return ctx;
 }
 
 EXPORT
-void link_close(link_t *ctx) {
+link_t *link_attach(int mtu, int flags) {
     WITH_LWIP_LOCKED();
 
-    global_interface_attach_device(NULL, NULL, DEFAULT_MTU);
+    return link_new(mtu, flags);
+}
+
+EXPORT
+link_t *link_attach_fd(int fd, int mtu, int flags) {
+    int fd_flags = fcntl(fd, F_GETFL);
+    if (fd_flags < 0 || fcntl(fd, F_SETFL, fd_flags | O_NONBLOCK) < 0)
+        return NULL;
+
+    int wakeup[2];
+    if (pipe(wakeup) < 0) {
+        fcntl(fd, F_SETFL, fd_flags);
 
-    WITH_MUTEX_LOCKED(rx, &ctx->rx_mutex);
-    WITH_MUTEX_LOCKED(tx, &ctx->tx_mutex);
+        return NULL;
+    }
 
-    ctx->closed = 1;
+    link_t *ctx;
 
-    pthread_cond_broadcast(&ctx->rx_cond);
+    {
+        WITH_LWIP_LOCKED();
+
+        ctx = link_new(mtu, flags);
+    }
+
+    if (ctx == NULL) {
+        close(wakeup[0]);
+        close(wakeup[1]);
+
+        fcntl(fd, F_SETFL, fd_flags);
+
+        return NULL;
+    }
+
+    ctx->fd = fd;
+    ctx->fd_flags = fd_flags;
+    ctx->wakeup[0] = wakeup[0];
+    ctx->wakeup[1] = wakeup[1];
+
+    if (pthread_create(&ctx->reader, NULL, &fd_reader, ctx) != 0) {
+        link_close(ctx);
+        link_free(ctx);
+
+        return NULL;
+    }
+
+    if (pthread_create(&ctx->writer, NULL, &fd_writer, ctx) != 0) {
+        write(ctx->wakeup[1], "", 1);
+
+        pthread_join(ctx->reader, NULL);
+
+        link_close(ctx);
+        link_free(ctx);
+
+        return NULL;
+    }
+
+    ctx->threads_running = 1;
+
+    return ctx;
+}
+
+EXPORT
+void link_close(link_t *ctx) {
+    {
+        WITH_LWIP_LOCKED();
+
+        global_interface_detach_device(ctx);
+
+        scheduler_detach(&ctx->tx_source);
+
+        atomic_store(&ctx->closed, 1);
+
+        pbuf_queue_close(&ctx->rx);
+        pbuf_queue_close(&ctx->tx);
+    }
+
+    // wake readers parked on the readiness fd, they observe the close
+    event_fd_signal(ctx->readable);
+
+    if (ctx->threads_running) {
+        ctx->threads_running = 0;
+
+        write(ctx->wakeup[1], "", 1);
+
+        pthread_join(ctx->reader, NULL);
+        pthread_join(ctx->writer, NULL);
+    }
+
+    if (ctx->fd_flags >= 0) {
+        fcntl(ctx->fd, F_SETFL, ctx->fd_flags);
+
+        ctx->fd_flags = -1;
+    }
 }
 
 EXPORT
 void link_free(link_t *ctx) {
+    if (ctx->threads_running)
+        link_close(ctx);
+
+    if (ctx->wakeup[0] >= 0) {
+        close(ctx->wakeup[0]);
+        close(ctx->wakeup[1]);
+    }
+
+    event_fd_close(ctx->readable);
+
+    pbuf_queue_destroy(&ctx->rx);
+    pbuf_queue_destroy(&ctx->tx);
+
     free(ctx);
 }
 
@@ -98,57 +589,159 @@ EXPORT
 int link_read(link_t *ctx, void *buffer, int size) {
     struct pbuf *source = NULL;
 
-    {
-        WITH_MUTEX_LOCKED(lock, &ctx->rx_mutex);
+    if (ctx->fd >= 0)
+        return -1;
 
-        while (pbuf_queue_length(&ctx->rx) == 0) {
-            if (ctx->closed)
-                return -1;
+    if (pbuf_queue_pop_wait(&ctx->rx, &source, 1) < 0)
+        return -1;
 
-            pthread_cond_wait(&ctx->rx_cond, &ctx->rx_mutex);
-        }
+    return copy_packet(source, buffer, size);
+}
 
-        pbuf_queue_pop(&ctx->rx, &source, 1);
-    }
+EXPORT
+int link_readable_fd(link_t *ctx) {
+    if (ctx->fd >= 0)
+        return -1;
 
-    if (source == NULL)
-        return 0;
+    return ctx->readable[0];
+}
 
-    if (size >= source->tot_len) {
-        pbuf_copy_partial(source, buffer, source->tot_len, 0);
+EXPORT
+int link_try_read(link_t *ctx, void *buffer, int size) {
+    struct pbuf *source = NULL;
 
-        size = source->tot_len;
-    } else {
-        size = 0;
-    }
+    if (ctx->fd >= 0)
+        return -1;
 
-    pbuf_free(source);
+    int popped = try_pop(ctx, &source, 1);
+    if (popped <= 0)
+        return popped;
 
-    return size;
+    return copy_packet(source, buffer, size);
 }
 
 EXPORT
-int link_write(link_t *ctx, void *buffer, int size) {
-    struct pbuf *target = pbuf_alloc(PBUF_IP, size, PBUF_POOL);
+int link_read_batch(link_t *ctx, void *buffer, int size, int lengths[], int count) {
+    struct pbuf *sources[LINK_BATCH_SIZE];
 
-    pbuf_take(target, buffer, size);
+    if (ctx->fd >= 0)
+        return -1;
 
-    WITH_MUTEX_LOCKED(lock, &ctx->tx_mutex);
+    // a batch must hold at least one frame, nothing is popped that could not be copied
+    count = batch_count(ctx, size, count);
+    if (count <= 0)
+        return LINK_SHORT_BUFFER;
 
-    if (ctx->closed) {
-        pbuf_free(target);
+    int popped = pbuf_queue_pop_wait(&ctx->rx, sources, count);
+    if (popped < 0)
+        return -1;
+
+    return copy_batch(sources, popped, buffer, size, lengths);
+}
 
+EXPORT
+int link_try_read_batch(link_t *ctx, void *buffer, int size, int lengths[], int count) {
+    struct pbuf *sources[LINK_BATCH_SIZE];
+
+    if (ctx->fd >= 0)
         return -1;
-    }
 
-    pbuf_queue_append(&ctx->tx, &target, 1);
+    count = batch_count(ctx, size, count);
+    if (count <= 0)
+        return LINK_SHORT_BUFFER;
+
+    int popped = try_pop(ctx, sources, count);
+    if (popped <= 0)
+        return popped;
+
+    return copy_batch(sources, popped, buffer, size, lengths);
+}
+
+EXPORT
+int link_read_lease(link_t *ctx, segment_t segments[], int count, link_lease_t **lease) {
+    struct pbuf *source = NULL;
+
+    if (ctx->fd >= 0 || count <= 0)
+        return -1;
+
+    if (pbuf_queue_pop_wait(&ctx->rx, &source, 1) < 0)
+        return -1;
+
+    return lease_packet(source, segments, count, lease);
+}
+
+EXPORT
+int link_try_read_lease(link_t *ctx, segment_t segments[], int count, link_lease_t **lease) {
+    struct pbuf *source = NULL;
+
+    if (ctx->fd >= 0 || count <= 0)
+        return -1;
+
+    int popped = try_pop(ctx, &source, 1);
+    if (popped <= 0)
+        return popped;
+
+    return lease_packet(source, segments, count, lease);
+}
+
+EXPORT
+void link_release(link_lease_t *lease) {
+    pbuf_free((struct pbuf *) lease);
+}
 
-    if (!ctx->tx_polling) {
-        if (tcpip_try_callback(&poll_tx, ctx) == ERR_OK) {
-            ctx->tx_polling = 1;
+EXPORT
+int link_write(link_t *ctx, void *buffer, int size) {
+    struct pbuf *target = packet_from_buffer(ctx, buffer, size);
+    if (target == NULL)
+        return -1;
+
+    return enqueue_tx(ctx, &target, 1) < 0 ? -1 : size;
+}
+
+EXPORT
+int link_write_batch(link_t *ctx, void *buffer, int lengths[], int count) {
+    struct pbuf *targets[LINK_BATCH_SIZE];
+
+    const uint8_t *cursor = (const uint8_t *) buffer;
+    int written = 0;
+
+    // enqueued in chunks of LINK_BATCH_SIZE, stops short at the first packet that fails
+    while (written < count) {
+        int size = 0;
+        int failed = 0;
+
+        while (size < LINK_BATCH_SIZE && written + size < count) {
+            struct pbuf *target = packet_from_buffer(ctx, cursor, lengths[written + size]);
+            if (target == NULL) {
+                failed = 1;
+
+                break;
+            }
+
+            targets[size] = target;
+            cursor += lengths[written + size];
+
+            size++;
         }
+
+        if (size > 0 && enqueue_tx(ctx, targets, size) < 0)
+            break;
+
+        written += size;
+
+        if (failed)
+            break;
     }
 
-    return size;
+    return written > 0 ? written : -1;
 }
 
+EXPORT
+void link_set_queue_policy(link_t *ctx, queue_direction_t direction, queue_policy_t policy, int limit, int timeout) {
+    pbuf_queue_configure(direction == QUEUE_RX ? &ctx->rx : &ctx->tx, policy, limit, timeout);
+}
+
+EXPORT
+void link_queue_stats(link_t *ctx, queue_direction_t direction, queue_stats_t *stats) {
+    pbuf_queue_stats(direction == QUEUE_RX ? &ctx->rx : &ctx->tx, stats);
+}
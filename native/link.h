@@ -6,10 +6,27 @@
 #include <stddef.h>
 #include <pthread.h>
 
+#define LINK_FLAG_VNET_HDR 1
+
+// the next packet does not fit in the caller's buffer and was dropped
+#define LINK_SHORT_BUFFER -2
+
 typedef struct link_t link_t;
+typedef struct link_lease_t link_lease_t;
 
-EXPORT link_t *link_attach(int mtu);
+EXPORT link_t *link_attach(int mtu, int flags);
+EXPORT link_t *link_attach_fd(int fd, int mtu, int flags);
 EXPORT void link_close(link_t *ctx);
 EXPORT void link_free(link_t *ctx);
 EXPORT int link_read(link_t *ctx, void *buffer, int size);
-EXPORT int link_write(link_t *ctx, void *buffer, int size);
\ No newline at end of file
+EXPORT int link_write(link_t *ctx, void *buffer, int size);
+EXPORT int link_readable_fd(link_t *ctx);
+EXPORT int link_try_read(link_t *ctx, void *buffer, int size);
+EXPORT int link_read_batch(link_t *ctx, void *buffer, int size, int lengths[], int count);
+EXPORT int link_try_read_batch(link_t *ctx, void *buffer, int size, int lengths[], int count);
+EXPORT int link_write_batch(link_t *ctx, void *buffer, int lengths[], int count);
+EXPORT int link_read_lease(link_t *ctx, segment_t segments[], int count, link_lease_t **lease);
+EXPORT int link_try_read_lease(link_t *ctx, segment_t segments[], int count, link_lease_t **lease);
+EXPORT void link_release(link_lease_t *lease);
+EXPORT void link_set_queue_policy(link_t *ctx, queue_direction_t direction, queue_policy_t policy, int limit, int timeout);
+EXPORT void link_queue_stats(link_t *ctx, queue_direction_t direction, queue_stats_t *stats);
\ No newline at end of file
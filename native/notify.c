@@ -0,0 +1,109 @@
+#include "notify.h"
+
+#include <time.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+void notify_init(notify_t *notify) {
+    atomic_init(&notify->sequence, 0);
+    atomic_init(&notify->waiters, 0);
+
+#ifndef __linux__
+    pthread_mutex_init(&notify->mutex, NULL);
+    pthread_cond_init(&notify->cond, NULL);
+#endif
+}
+
+void notify_destroy(notify_t *notify) {
+#ifndef __linux__
+    pthread_mutex_destroy(&notify->mutex);
+    pthread_cond_destroy(&notify->cond);
+#else
+    (void) notify;
+#endif
+}
+
+uint32_t notify_prepare(notify_t *notify) {
+    atomic_fetch_add(&notify->waiters, 1);
+
+    return atomic_load(&notify->sequence);
+}
+
+void notify_cancel(notify_t *notify) {
+    atomic_fetch_sub(&notify->waiters, 1);
+}
+
+int notify_wait(notify_t *notify, uint32_t sequence, int timeout) {
+    int result = 0;
+
+#ifdef __linux__
+    struct timespec duration = {.tv_sec = timeout / 1000, .tv_nsec = (timeout % 1000) * 1000000L};
+
+    if (atomic_load(&notify->sequence) == sequence) {
+        long r = syscall(SYS_futex, &notify->sequence, FUTEX_WAIT_PRIVATE, sequence,
+                         timeout < 0 ? NULL : &duration, NULL, 0);
+        if (r < 0 && errno == ETIMEDOUT)
+            result = -1;
+    }
+#else
+    struct timespec deadline;
+
+    if (timeout >= 0) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (timeout % 1000) * 1000000L;
+
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+    }
+
+    pthread_mutex_lock(&notify->mutex);
+
+    while (atomic_load(&notify->sequence) == sequence) {
+        if (timeout < 0) {
+            pthread_cond_wait(&notify->cond, &notify->mutex);
+        } else if (pthread_cond_timedwait(&notify->cond, &notify->mutex, &deadline) == ETIMEDOUT) {
+            result = -1;
+
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&notify->mutex);
+#endif
+
+    atomic_fetch_sub(&notify->waiters, 1);
+
+    return result;
+}
+
+void notify_signal(notify_t *notify) {
+    // pairs with the waiter registering itself before re-checking its condition
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_load(&notify->waiters) == 0)
+        return;
+
+#ifdef __linux__
+    atomic_fetch_add(&notify->sequence, 1);
+
+    syscall(SYS_futex, &notify->sequence, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&notify->mutex);
+
+    atomic_fetch_add(&notify->sequence, 1);
+
+    pthread_cond_broadcast(&notify->cond);
+
+    pthread_mutex_unlock(&notify->mutex);
+#endif
+}
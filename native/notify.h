@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+typedef struct notify_t {
+    atomic_uint sequence;
+    atomic_int waiters;
+
+#ifndef __linux__
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+} notify_t;
+
+void notify_init(notify_t *notify);
+void notify_destroy(notify_t *notify);
+
+uint32_t notify_prepare(notify_t *notify);
+void notify_cancel(notify_t *notify);
+int notify_wait(notify_t *notify, uint32_t sequence, int timeout);
+
+void notify_signal(notify_t *notify);
@@ -1,52 +1,406 @@
 #include "queues.h"
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <sched.h>
+
+_Static_assert((PBUF_QUEUE_CAPACITY & (PBUF_QUEUE_CAPACITY - 1)) == 0, "PBUF_QUEUE_CAPACITY must be power of 2");
+_Static_assert(PBUF_QUEUE_LENGTH <= PBUF_QUEUE_CAPACITY, "PBUF_QUEUE_LENGTH must fit in PBUF_QUEUE_CAPACITY");
+
+// a single slot would read the same sequence for full and for empty on the next lap
+static size_t ring_capacity(size_t limit) {
+    size_t capacity = 2;
+
+    while (capacity < limit)
+        capacity <<= 1;
+
+    return capacity;
+}
+
+static void ring_enter(pbuf_queue_t *queue, atomic_int *users) {
+    while (1) {
+        atomic_fetch_add(users, 1);
+
+        if (!atomic_load(&queue->resizing))
+            return;
+
+        atomic_fetch_sub(users, 1);
+
+        while (atomic_load_explicit(&queue->resizing, memory_order_relaxed))
+            sched_yield();
+    }
+}
+
+static void ring_leave(atomic_int *users) {
+    atomic_fetch_sub_explicit(users, 1, memory_order_release);
+}
+
+// callers must not be inside the ring, returns the capacity in use afterwards
+static int ring_resize(pbuf_queue_t *queue, int limit) {
+    while (atomic_exchange(&queue->resizing, 1))
+        sched_yield();
+
+    while (atomic_load(&queue->producers) > 0 || atomic_load(&queue->consumers) > 0)
+        sched_yield();
+
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    size_t length = tail - head;
+
+    // never shrink below what is still queued
+    size_t capacity = ring_capacity(length > (size_t) limit ? length : (size_t) limit);
+
+    if (capacity != queue->mask + 1) {
+        pbuf_queue_slot_t *slots = malloc(sizeof(pbuf_queue_slot_t) * capacity);
+
+        if (slots != NULL) {
+            for (size_t i = 0; i < capacity; i++) {
+                size_t pos = head + i;
+                pbuf_queue_slot_t *slot = &slots[pos & (capacity - 1)];
+
+                if (i < length) {
+                    atomic_init(&slot->sequence, pos + 1);
+
+                    slot->data = queue->slots[pos & queue->mask].data;
+                } else {
+                    atomic_init(&slot->sequence, pos);
+
+                    slot->data = NULL;
+                }
+            }
+
+            free(queue->slots);
+
+            queue->slots = slots;
+            queue->mask = capacity - 1;
+        }
+    }
+
+    capacity = queue->mask + 1;
+
+    atomic_store(&queue->resizing, 0);
+
+    return (int) capacity;
+}
+
+static int queue_push(pbuf_queue_t *queue, struct pbuf *p) {
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    while (1) {
+        pbuf_queue_slot_t *slot = &queue->slots[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                slot->data = p;
+
+                atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+
+                return 0;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+}
+
+static struct pbuf *queue_shift(pbuf_queue_t *queue) {
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    while (1) {
+        pbuf_queue_slot_t *slot = &queue->slots[pos & queue->mask];
+        size_t sequence = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) (pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                struct pbuf *p = slot->data;
+
+                slot->data = NULL;
+
+                atomic_store_explicit(&slot->sequence, pos + queue->mask + 1, memory_order_release);
+
+                return p;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+}
+
+static void queue_dropped(pbuf_queue_t *queue, struct pbuf *p) {
+    pbuf_free(p);
+
+    atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+}
+
+static int queue_wait_writable(pbuf_queue_t *queue, int limit) {
+    int timeout = atomic_load_explicit(&queue->timeout, memory_order_relaxed);
+
+    while (pbuf_queue_length(queue) >= limit) {
+        uint32_t sequence = notify_prepare(&queue->writable);
+
+        if (pbuf_queue_length(queue) < limit) {
+            notify_cancel(&queue->writable);
+
+            break;
+        }
+
+        if (atomic_load(&queue->closed)) {
+            notify_cancel(&queue->writable);
+
+            return -1;
+        }
+
+        if (notify_wait(&queue->writable, sequence, timeout) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int queue_admit(pbuf_queue_t *queue) {
+    int limit = atomic_load_explicit(&queue->limit, memory_order_relaxed);
+
+    if (pbuf_queue_length(queue) < limit)
+        return 0;
+
+    switch ((queue_policy_t) atomic_load_explicit(&queue->policy, memory_order_relaxed)) {
+        case QUEUE_POLICY_DROP_HEAD: {
+            ring_enter(queue, &queue->consumers);
+
+            struct pbuf *oldest = queue_shift(queue);
+
+            ring_leave(&queue->consumers);
+
+            if (oldest != NULL) {
+                queue_dropped(queue, oldest);
+            }
+
+            return 0;
+        }
+        case QUEUE_POLICY_DROP_TAIL:
+            return -1;
+        case QUEUE_POLICY_BLOCK:
+            // waiting would hold the core lock, which closing the queue needs, so drop instead
+            if (!queue->may_block)
+                return -1;
+
+            return queue_wait_writable(queue, limit);
+        case QUEUE_POLICY_GROW:
+            if (limit >= PBUF_QUEUE_CAPACITY || ring_resize(queue, limit * 2) < limit * 2)
+                return -1;
+
+            atomic_compare_exchange_strong(&queue->limit, &limit, limit * 2);
+
+            return 0;
+    }
+
+    return -1;
+}
+
+static void queue_update_watermark(pbuf_queue_t *queue) {
+    int length = pbuf_queue_length(queue);
+    int watermark = atomic_load_explicit(&queue->high_watermark, memory_order_relaxed);
+
+    while (length > watermark) {
+        if (atomic_compare_exchange_weak_explicit(&queue->high_watermark, &watermark, length,
+                                                  memory_order_relaxed, memory_order_relaxed))
+            break;
+    }
+}
+
+int pbuf_queue_init(pbuf_queue_t *queue, int may_block) {
+    size_t capacity = ring_capacity(PBUF_QUEUE_LENGTH);
+
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->consumers, 0);
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->producers, 0);
+    atomic_init(&queue->closed, 0);
+    atomic_init(&queue->resizing, 0);
+
+    atomic_init(&queue->policy, QUEUE_POLICY_DROP_HEAD);
+    atomic_init(&queue->limit, PBUF_QUEUE_LENGTH);
+    atomic_init(&queue->timeout, -1);
+
+    atomic_init(&queue->enqueued, 0);
+    atomic_init(&queue->dropped, 0);
+    atomic_init(&queue->high_watermark, 0);
+
+    queue->may_block = may_block;
+
+    queue->mask = capacity - 1;
+    queue->slots = malloc(sizeof(pbuf_queue_slot_t) * capacity);
+    if (queue->slots == NULL)
+        return -1;
+
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&queue->slots[i].sequence, i);
+
+        queue->slots[i].data = NULL;
+    }
+
+    notify_init(&queue->readable);
+    notify_init(&queue->writable);
+
+    return 0;
+}
+
+void pbuf_queue_destroy(pbuf_queue_t *queue) {
+    struct pbuf *p;
+
+    if (queue->slots == NULL)
+        return;
+
+    while ((p = queue_shift(queue)) != NULL) {
+        pbuf_free(p);
+    }
+
+    notify_destroy(&queue->readable);
+    notify_destroy(&queue->writable);
+
+    free(queue->slots);
+}
+
+void pbuf_queue_close(pbuf_queue_t *queue) {
+    atomic_store(&queue->closed, 1);
+
+    notify_signal(&queue->readable);
+    notify_signal(&queue->writable);
+}
+
+void pbuf_queue_configure(pbuf_queue_t *queue, queue_policy_t policy, int limit, int timeout) {
+    if (limit <= 0)
+        limit = PBUF_QUEUE_LENGTH;
+    if (limit > PBUF_QUEUE_CAPACITY)
+        limit = PBUF_QUEUE_CAPACITY;
+
+    // a lower limit applies before the ring shrinks, a higher one once it has grown
+    if (limit < atomic_load(&queue->limit))
+        atomic_store(&queue->limit, limit);
+
+    int capacity = ring_resize(queue, limit);
+    if (limit > capacity)
+        limit = capacity;
+
+    atomic_store(&queue->policy, policy);
+    atomic_store(&queue->limit, limit);
+    atomic_store(&queue->timeout, timeout);
+
+    notify_signal(&queue->writable);
+}
+
+void pbuf_queue_stats(pbuf_queue_t *queue, queue_stats_t *stats) {
+    stats->enqueued = atomic_load_explicit(&queue->enqueued, memory_order_relaxed);
+    stats->dropped = atomic_load_explicit(&queue->dropped, memory_order_relaxed);
+    stats->length = pbuf_queue_length(queue);
+    stats->limit = atomic_load_explicit(&queue->limit, memory_order_relaxed);
+    stats->high_watermark = atomic_load_explicit(&queue->high_watermark, memory_order_relaxed);
+}
+
 int pbuf_queue_append(pbuf_queue_t *queue, struct pbuf *in[], int size) {
+    int appended = 0;
+
     for (int i = 0; i < size; i++) {
-        int tail = queue->tail;
+        if (queue_admit(queue) < 0) {
+            queue_dropped(queue, in[i]);
 
-        if (queue->data[tail] != NULL) {
-            pbuf_free(queue->data[tail]);
+            continue;
         }
 
-        queue->data[tail] = in[i];
+        ring_enter(queue, &queue->producers);
+
+        int pushed = queue_push(queue, in[i]);
+
+        ring_leave(&queue->producers);
 
-        queue->tail = (tail + 1) % PBUF_QUEUE_LENGTH;
+        if (pushed < 0) {
+            queue_dropped(queue, in[i]);
 
-        if (queue->full) {
-            queue->head = queue->tail;
+            continue;
         }
 
-        queue->full = (queue->head == queue->tail);
+        appended++;
+    }
+
+    if (appended > 0) {
+        atomic_fetch_add_explicit(&queue->enqueued, appended, memory_order_relaxed);
+
+        queue_update_watermark(queue);
+
+        notify_signal(&queue->readable);
     }
 
-    return size;
+    return appended;
 }
 
 int pbuf_queue_length(pbuf_queue_t *queue) {
-    int size = (queue->tail - queue->head + PBUF_QUEUE_LENGTH) % PBUF_QUEUE_LENGTH;
+    size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    intptr_t size = (intptr_t) (tail - head);
 
-    if (size == 0 && queue->full)
-        return PBUF_QUEUE_LENGTH;
+    if (size < 0)
+        return 0;
 
-    return size;
+    if (size > PBUF_QUEUE_CAPACITY)
+        return PBUF_QUEUE_CAPACITY;
+
+    return (int) size;
 }
 
 int pbuf_queue_pop(pbuf_queue_t *queue, struct pbuf *out[], int size) {
     int i;
 
+    ring_enter(queue, &queue->consumers);
+
     for (i = 0; i < size; i++) {
-        if (queue->head == queue->tail && !queue->full)
+        struct pbuf *p = queue_shift(queue);
+        if (p == NULL)
             break;
 
-        int head = queue->head;
-
-        out[i] = queue->data[head];
+        out[i] = p;
+    }
 
-        queue->data[head] = NULL;
+    ring_leave(&queue->consumers);
 
-        queue->head = (head + 1) % PBUF_QUEUE_LENGTH;
-        queue->full = 0;
-    }
+    if (i > 0)
+        notify_signal(&queue->writable);
 
     return i;
 }
+
+int pbuf_queue_pop_wait(pbuf_queue_t *queue, struct pbuf *out[], int size) {
+    while (1) {
+        int popped = pbuf_queue_pop(queue, out, size);
+        if (popped > 0)
+            return popped;
+
+        if (atomic_load(&queue->closed))
+            return -1;
+
+        uint32_t sequence = notify_prepare(&queue->readable);
+
+        popped = pbuf_queue_pop(queue, out, size);
+        if (popped > 0) {
+            notify_cancel(&queue->readable);
+
+            return popped;
+        }
+
+        if (atomic_load(&queue->closed)) {
+            notify_cancel(&queue->readable);
+
+            return -1;
+        }
+
+        notify_wait(&queue->readable, sequence, -1);
+    }
+}
@@ -1,17 +1,58 @@
 #pragma once
 
+#include "utils.h"
+#include "notify.h"
+
 #include "lwip/pbuf.h"
 
+#include <stddef.h>
+#include <stdatomic.h>
+
 #define PBUF_QUEUE_LENGTH 256
+#define PBUF_QUEUE_CAPACITY 4096
+#define CACHE_LINE_SIZE 64
+
+typedef struct pbuf_queue_slot_t {
+    atomic_size_t sequence;
+    struct pbuf *data;
+} pbuf_queue_slot_t;
 
 typedef struct pbuf_queue_t {
-    int head;
-    int tail;
-    int full;
+    // consumers and producers inside the ring, each on its own side's line
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t head;
+    atomic_int consumers;
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t tail;
+    atomic_int producers;
+    _Alignas(CACHE_LINE_SIZE) notify_t readable;
+    notify_t writable;
+    atomic_int closed;
+
+    _Alignas(CACHE_LINE_SIZE) atomic_int policy;
+    atomic_int limit;
+    atomic_int timeout;
 
-    struct pbuf *data[PBUF_QUEUE_LENGTH];
+    atomic_ullong enqueued;
+    atomic_ullong dropped;
+    atomic_int high_watermark;
+
+    // producers on the tcpip thread hold the core lock and must not wait
+    int may_block;
+
+    // the ring holds the limit rounded up to a power of two and is only
+    // replaced while resizing keeps every producer and consumer out
+    atomic_int resizing;
+    pbuf_queue_slot_t *slots;
+    size_t mask;
 } pbuf_queue_t;
 
+int pbuf_queue_init(pbuf_queue_t *queue, int may_block);
+void pbuf_queue_destroy(pbuf_queue_t *queue);
+void pbuf_queue_close(pbuf_queue_t *queue);
+
+void pbuf_queue_configure(pbuf_queue_t *queue, queue_policy_t policy, int limit, int timeout);
+void pbuf_queue_stats(pbuf_queue_t *queue, queue_stats_t *stats);
+
 int pbuf_queue_append(pbuf_queue_t *queue, struct pbuf *in[], int size);
 int pbuf_queue_length(pbuf_queue_t *queue);
 int pbuf_queue_pop(pbuf_queue_t *queue, struct pbuf *out[], int size);
+int pbuf_queue_pop_wait(pbuf_queue_t *queue, struct pbuf *out[], int size);
@@ -0,0 +1,180 @@
+#include "scheduler.h"
+
+#include "utils.h"
+
+#include "lwip/tcpip.h"
+#include "lwip/timeouts.h"
+
+#include <time.h>
+#include <stdint.h>
+
+static pthread_mutex_t scheduler_lock = PTHREAD_MUTEX_INITIALIZER;
+static scheduler_source_t *ready_head;
+static scheduler_source_t *ready_tail;
+static int scheduled;
+
+static void scheduler_run(void *arg);
+
+static uint64_t now_us() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void ready_append(scheduler_source_t *source) {
+    source->next = NULL;
+
+    if (ready_tail != NULL) {
+        ready_tail->next = source;
+    } else {
+        ready_head = source;
+    }
+
+    ready_tail = source;
+}
+
+static scheduler_source_t *ready_shift() {
+    scheduler_source_t *source = ready_head;
+
+    if (source != NULL) {
+        ready_head = source->next;
+
+        if (ready_head == NULL)
+            ready_tail = NULL;
+
+        source->next = NULL;
+    }
+
+    return source;
+}
+
+static void scheduler_enqueue(scheduler_source_t *source) {
+    int post = 0;
+
+    {
+        WITH_MUTEX_LOCKED(lock, &scheduler_lock);
+
+        if (source->detached)
+            return;
+
+        ready_append(source);
+
+        if (!scheduled) {
+            scheduled = 1;
+            post = 1;
+        }
+    }
+
+    // mbox full, wait for room instead of leaving the packets stalled
+    if (post && tcpip_try_callback(&scheduler_run, NULL) != ERR_OK) {
+        tcpip_callback(&scheduler_run, NULL);
+    }
+}
+
+static int source_poll(scheduler_source_t *source, int budget) {
+    struct pbuf *array[SCHEDULER_QUANTUM];
+
+    if (budget > SCHEDULER_QUANTUM)
+        budget = SCHEDULER_QUANTUM;
+
+    int size = pbuf_queue_pop(source->queue, array, budget);
+
+    if (size > 0)
+        source->handler(source->ctx, array, size);
+
+    return size;
+}
+
+static void scheduler_run(void *arg) {
+    (void) arg;
+
+    uint64_t deadline = now_us() + SCHEDULER_TIME_BUDGET_US;
+    int budget = SCHEDULER_PACKET_BUDGET;
+
+    while (budget > 0 && now_us() < deadline) {
+        scheduler_source_t *source;
+
+        {
+            WITH_MUTEX_LOCKED(lock, &scheduler_lock);
+
+            source = ready_shift();
+
+            if (source == NULL) {
+                scheduled = 0;
+
+                return;
+            }
+        }
+
+        int polled = source_poll(source, budget);
+
+        budget -= polled;
+
+        if (polled < SCHEDULER_QUANTUM) {
+            atomic_store(&source->queued, 0);
+            atomic_thread_fence(memory_order_seq_cst);
+
+            if (pbuf_queue_length(source->queue) == 0 || atomic_exchange(&source->queued, 1))
+                continue;
+        }
+
+        {
+            WITH_MUTEX_LOCKED(lock, &scheduler_lock);
+
+            if (!source->detached)
+                ready_append(source);
+        }
+    }
+
+    // budget exhausted, yield to other tcpip messages before continuing
+    if (tcpip_try_callback(&scheduler_run, NULL) != ERR_OK) {
+        sys_timeout(0, &scheduler_run, NULL);
+    }
+}
+
+void scheduler_source_init(scheduler_source_t *source, pbuf_queue_t *queue, scheduler_handler_func handler, void *ctx) {
+    source->queue = queue;
+    source->handler = handler;
+    source->ctx = ctx;
+    source->next = NULL;
+    source->detached = 0;
+
+    atomic_init(&source->queued, 0);
+}
+
+void scheduler_kick(scheduler_source_t *source) {
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if (atomic_exchange(&source->queued, 1))
+        return;
+
+    scheduler_enqueue(source);
+}
+
+void scheduler_detach(scheduler_source_t *source) {
+    LWIP_ASSERT_CORE_LOCKED();
+
+    WITH_MUTEX_LOCKED(lock, &scheduler_lock);
+
+    source->detached = 1;
+
+    atomic_store(&source->queued, 1);
+
+    scheduler_source_t **cursor = &ready_head;
+
+    ready_tail = NULL;
+
+    while (*cursor != NULL) {
+        if (*cursor == source) {
+            *cursor = source->next;
+        } else {
+            ready_tail = *cursor;
+
+            cursor = &(*cursor)->next;
+        }
+    }
+
+    source->next = NULL;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "queues.h"
+
+#include <stdatomic.h>
+
+#define SCHEDULER_QUANTUM 16
+#define SCHEDULER_PACKET_BUDGET 256
+#define SCHEDULER_TIME_BUDGET_US 2000
+
+typedef void (*scheduler_handler_func)(void *ctx, struct pbuf *array[], int size);
+
+typedef struct scheduler_source_t {
+    pbuf_queue_t *queue;
+    scheduler_handler_func handler;
+    void *ctx;
+
+    struct scheduler_source_t *next;
+    atomic_int queued;
+    int detached;
+} scheduler_source_t;
+
+void scheduler_source_init(scheduler_source_t *source, pbuf_queue_t *queue, scheduler_handler_func handler, void *ctx);
+void scheduler_kick(scheduler_source_t *source);
+void scheduler_detach(scheduler_source_t *source);
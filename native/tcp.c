@@ -1,10 +1,33 @@
 #include "tcp.h"
 
 #include "interface.h"
+#include "notify.h"
 
 #include "lwip/api.h"
+#include "lwip/priv/api_msg.h"
+#include "lwip/tcp.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/timeouts.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define TCP_RELAY_BUFFER_SIZE 65536
+#define TCP_RELAY_IOV_SIZE 16
+#define TCP_NO_DEADLINE INT64_MAX
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
 
 struct tcp_listener_t {
     struct netconn *conn;
@@ -20,11 +43,261 @@ struct tcp_conn_t {
 
     struct netbuf *pending;
     int offset;
+    // received by tcp_conn_peek after pending, which could not take it without overflowing
+    struct pbuf *peeked;
+
+    pthread_mutex_t sent_lock;
+    notify_t sent_notify;
+    uint64_t *sent;
+    int sent_length;
+    int sent_capacity;
+    // write references not yet completed, Completed waits for these
+    int refs_pending;
+    // write references and receive leases, the last one frees a freed conn
+    int outstanding;
+    int freed;
+
+    int events[2];
+
+    _Atomic int64_t read_deadline;
+    atomic_int reading;
+
+    // read without the core lock by writers without a deadline
+    _Atomic int64_t write_deadline;
+    _Atomic int64_t write_started;
+    atomic_int writing;
+    atomic_int write_waiting;
+
+    // guarded by the lwIP core lock
+    tcp_conn_t *waiter_next;
+    tcp_conn_t **waiter_pprev;
+    int deleted;
+
+    atomic_int rx_closed;
 };
 
+typedef struct tcp_ref_t {
+    atomic_int refs;
+    tcp_conn_t *conn;
+    uint64_t token;
+} tcp_ref_t;
+
+typedef struct tcp_ref_pbuf_t {
+    struct pbuf_custom custom;
+    tcp_ref_t *ref;
+} tcp_ref_pbuf_t;
+
+// leased data stays in the receive window until released
+struct tcp_lease_t {
+    struct pbuf *head;
+    tcp_conn_t *conn;
+    int length;
+};
+
+static int64_t now_millis() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (int64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// -1 without a deadline, 0 once it has passed
+static int deadline_remaining(int64_t deadline) {
+    if (deadline == TCP_NO_DEADLINE)
+        return -1;
+
+    int64_t remaining = deadline - now_millis();
+    if (remaining <= 0)
+        return 0;
+
+    return remaining > INT32_MAX ? INT32_MAX : (int) remaining;
+}
+
+// lwIP measures send_timeout from the start of the write, so it is updated in place when the deadline moves
+static s32_t write_timeout(int64_t deadline, int64_t started) {
+    if (deadline == TCP_NO_DEADLINE)
+        return INT32_MAX;
+
+    int64_t timeout = deadline - started;
+    if (timeout < 1)
+        return 1;
+
+    return timeout > INT32_MAX ? INT32_MAX : (s32_t) timeout;
+}
+
+// writers blocked with a deadline, guarded by the core lock. One timer serves them all,
+// the sent and poll callbacks alone would notice a passed deadline up to a second late
+static tcp_conn_t *write_waiters;
+static int64_t write_timer_deadline = TCP_NO_DEADLINE;
+
+static void write_waiters_expired(void *arg);
+
+static void write_timer_arm(int64_t deadline) {
+    if (write_timer_deadline != TCP_NO_DEADLINE)
+        sys_untimeout(&write_waiters_expired, NULL);
+
+    write_timer_deadline = deadline;
+
+    if (deadline != TCP_NO_DEADLINE)
+        sys_timeout((u32_t) deadline_remaining(deadline), &write_waiters_expired, NULL);
+}
+
+static void write_waiter_remove(tcp_conn_t *conn) {
+    if (conn->waiter_pprev == NULL)
+        return;
+
+    *conn->waiter_pprev = conn->waiter_next;
+    if (conn->waiter_next != NULL)
+        conn->waiter_next->waiter_pprev = conn->waiter_pprev;
+
+    conn->waiter_next = NULL;
+    conn->waiter_pprev = NULL;
+}
+
+static void write_waiter_add(tcp_conn_t *conn) {
+    int64_t deadline = atomic_load(&conn->write_deadline);
+
+    // lwIP measures send_timeout from the start of the write, so it is updated in place when the deadline moves
+    netconn_set_sendtimeout(conn->conn, write_timeout(deadline, atomic_load(&conn->write_started)));
+
+    if (deadline == TCP_NO_DEADLINE) {
+        write_waiter_remove(conn);
+
+        return;
+    }
+
+    if (conn->waiter_pprev == NULL) {
+        conn->waiter_next = write_waiters;
+        if (write_waiters != NULL)
+            write_waiters->waiter_pprev = &conn->waiter_next;
+
+        conn->waiter_pprev = &write_waiters;
+        write_waiters = conn;
+    }
+
+    if (deadline < write_timer_deadline)
+        write_timer_arm(deadline);
+}
+
+static void write_waiters_expired(void *arg) {
+    (void) arg;
+
+    int64_t next = TCP_NO_DEADLINE;
+
+    write_timer_deadline = TCP_NO_DEADLINE;
+
+    for (tcp_conn_t *conn = write_waiters, *following; conn != NULL; conn = following) {
+        following = conn->waiter_next;
+
+        // finished, the writer unregisters itself
+        if (!atomic_load(&conn->writing))
+            continue;
+
+        int64_t deadline = atomic_load(&conn->write_deadline);
+
+        if (deadline_remaining(deadline) == 0) {
+            lwip_netconn_check_write(conn->conn);
+
+            // lwIP counts from its own start of the write and may still be a millisecond short
+            deadline = now_millis() + 1;
+        }
+
+        if (deadline < next)
+            next = deadline;
+    }
+
+    if (next != TCP_NO_DEADLINE)
+        write_timer_arm(next);
+}
+
+static void tcp_conn_event(struct netconn *netconn, enum netconn_evt evt, u16_t len) {
+    (void) len;
+
+    // minus events may come from application threads, only plus events are raised with the core locked
+    if (evt == NETCONN_EVT_RCVMINUS || evt == NETCONN_EVT_SENDMINUS)
+        return;
+
+    tcp_conn_t *conn = (tcp_conn_t *) netconn_get_callback_arg(netconn);
+
+    if (conn != NULL && conn->events[0] >= 0)
+        event_fd_signal(conn->events);
+}
+
+static void tcp_conn_destroy(tcp_conn_t *conn) {
+    pthread_mutex_destroy(&conn->sent_lock);
+    notify_destroy(&conn->sent_notify);
+
+    free(conn->sent);
+    free(conn);
+}
+
+static void ref_put(tcp_ref_t *ref) {
+    if (atomic_fetch_sub(&ref->refs, 1) != 1)
+        return;
+
+    tcp_conn_t *conn = ref->conn;
+    int release;
+
+    {
+        WITH_MUTEX_LOCKED(lock, &conn->sent_lock);
+
+        if (!conn->freed) {
+            if (conn->sent_length == conn->sent_capacity) {
+                int capacity = conn->sent_capacity ? conn->sent_capacity * 2 : 16;
+                uint64_t *sent = realloc(conn->sent, capacity * sizeof(uint64_t));
+
+                if (sent != NULL) {
+                    conn->sent = sent;
+                    conn->sent_capacity = capacity;
+                }
+            }
+
+            if (conn->sent_length < conn->sent_capacity)
+                conn->sent[conn->sent_length++] = ref->token;
+        }
+
+        conn->refs_pending--;
+        conn->outstanding--;
+
+        release = conn->freed && conn->outstanding == 0;
+    }
+
+    notify_signal(&conn->sent_notify);
+
+    free(ref);
+
+    if (release)
+        tcp_conn_destroy(conn);
+}
+
+static void ref_pbuf_free(struct pbuf *p) {
+    tcp_ref_pbuf_t *pbuf = (tcp_ref_pbuf_t *) p;
+    tcp_ref_t *ref = pbuf->ref;
+
+    free(pbuf);
+
+    ref_put(ref);
+}
+
+struct pbuf *tcp_write_ref_pbuf(void *arg, const void *data, u16_t length) {
+    tcp_ref_t *ref = (tcp_ref_t *) arg;
+
+    tcp_ref_pbuf_t *pbuf = malloc(sizeof(tcp_ref_pbuf_t));
+    if (pbuf == NULL)
+        return NULL;
+
+    pbuf->custom.custom_free_function = &ref_pbuf_free;
+    pbuf->ref = ref;
+
+    atomic_fetch_add(&ref->refs, 1);
+
+    return pbuf_alloced_custom(PBUF_RAW, length, PBUF_REF, &pbuf->custom, (void *) data, length);
+}
+
 EXPORT
 tcp_listener_t *tcp_listener_listen() {
-    struct netconn *conn = netconn_new(NETCONN_TCP);
+    struct netconn *conn = netconn_new_with_callback(NETCONN_TCP, &tcp_conn_event);
 
     if (netconn_bind(conn, IP4_ADDR_ANY, TCP_ACCEPT_ANY_PORT) != ERR_OK)
         goto abort;
@@ -49,46 +322,97 @@ tcp_listener_t *tcp_listener_listen() {
     return NULL;
 }
 
+static tcp_conn_t *conn_new(struct netconn *new_conn) {
+    tcp_conn_t *conn = malloc(sizeof(tcp_conn_t));
+    if (conn == NULL)
+        return NULL;
+
+    // the listener accepts any address, lwIP's remote end is the TUN client and local end its destination
+    conn->conn = new_conn;
+    conn->pending = NULL;
+    conn->offset = 0;
+    conn->peeked = NULL;
+    conn->local = new_conn->remote_ip;
+    conn->remote = new_conn->local_ip;
+    conn->local_port = new_conn->remote_port;
+    conn->remote_port = new_conn->local_port;
+    conn->sent = NULL;
+    conn->sent_length = 0;
+    conn->sent_capacity = 0;
+    conn->refs_pending = 0;
+    conn->outstanding = 0;
+    conn->freed = 0;
+    conn->events[0] = -1;
+    conn->events[1] = -1;
+    conn->waiter_next = NULL;
+    conn->waiter_pprev = NULL;
+    conn->deleted = 0;
+
+    atomic_init(&conn->read_deadline, TCP_NO_DEADLINE);
+    atomic_init(&conn->write_deadline, TCP_NO_DEADLINE);
+    atomic_init(&conn->write_started, 0);
+    atomic_init(&conn->writing, 0);
+    atomic_init(&conn->write_waiting, 0);
+    atomic_init(&conn->reading, 0);
+    atomic_init(&conn->rx_closed, 0);
+
+    pthread_mutex_init(&conn->sent_lock, NULL);
+    notify_init(&conn->sent_notify);
+
+    return conn;
+}
+
 EXPORT
 tcp_conn_t *tcp_listener_accept(tcp_listener_t *listener) {
-    struct netconn *new_conn = NULL;
+    tcp_conn_t *conn;
 
-    while (1) {
-        if (netconn_accept(listener->conn, &new_conn) != ERR_OK) {
-            break;
-        }
+    if (tcp_listener_accept_batch(listener, &conn, 1) != 1)
+        return NULL;
 
-        ip_addr_t local;
-        ip_addr_t remote;
-        uint16_t local_port;
-        uint16_t remote_port;
+    return conn;
+}
 
-        if (netconn_getaddr(new_conn, &local, &local_port, 0) != ERR_OK) {
-            netconn_delete(new_conn);
+EXPORT
+int tcp_listener_accept_batch(tcp_listener_t *listener, tcp_conn_t *out[], int count) {
+    int accepted = 0;
 
-            continue;
-        }
+    // block for the first connection only, then take whatever else is pending
+    while (accepted < count) {
+        struct netconn *new_conn = NULL;
 
-        if (netconn_getaddr(new_conn, &remote, &remote_port, 1) != ERR_OK) {
+        err_t err = netconn_accept_flags(listener->conn, &new_conn, accepted > 0 ? NETCONN_DONTBLOCK : 0);
+        if (err != ERR_OK)
+            break;
+
+        tcp_conn_t *conn = conn_new(new_conn);
+        if (conn == NULL) {
             netconn_delete(new_conn);
 
             continue;
         }
 
-        tcp_conn_t *conn = malloc(sizeof(tcp_conn_t));
+        out[accepted++] = conn;
+    }
+
+    if (accepted == 0)
+        return -1;
 
-        conn->conn = new_conn;
-        conn->pending = NULL;
-        conn->offset = 0;
-        conn->local = local;
-        conn->remote = remote;
-        conn->local_port = local_port;
-        conn->remote_port = remote_port;
+    {
+        WITH_LWIP_LOCKED();
 
-        return conn;
+        for (int i = 0; i < accepted; i++) {
+            netconn_set_callback_arg(out[i]->conn, out[i]);
+        }
     }
 
-    return NULL;
+    return accepted;
+}
+
+EXPORT
+void tcp_listener_set_defer_accept(tcp_listener_t *listener, int timeout) {
+    WITH_LWIP_LOCKED();
+
+    netconn_set_defer_accept(listener->conn, timeout > 0 ? (u32_t) timeout : 0);
 }
 
 EXPORT
@@ -104,27 +428,132 @@ void tcp_listener_free(tcp_listener_t *listener) {
     free(listener);
 }
 
+// drop the consumed pending netbuf, a pbuf held back by tcp_conn_peek takes its place
+static void pending_release(tcp_conn_t *conn) {
+    netbuf_free(conn->pending);
+
+    conn->offset = 0;
+
+    if (conn->peeked != NULL) {
+        conn->pending->p = conn->peeked;
+        conn->pending->ptr = conn->peeked;
+
+        conn->peeked = NULL;
+    } else {
+        netbuf_delete(conn->pending);
+
+        conn->pending = NULL;
+    }
+}
+
+// data is received with NETCONN_NOAUTORCVD, the window reopens once the reader is done with it
+static void conn_recved(tcp_conn_t *conn, int length) {
+    WITH_LWIP_LOCKED();
+
+    if (conn->deleted || conn->conn->pcb.tcp == NULL)
+        return;
+
+    while (length > 0) {
+        u16_t chunk = (u16_t) LWIP_MIN(length, 0xffff);
+
+        tcp_recved(conn->conn->pcb.tcp, chunk);
+
+        length -= chunk;
+    }
+}
+
+// the pending chain for the caller to free, and where reading continues in it
+static struct pbuf *pending_take(tcp_conn_t *conn, int *offset) {
+    struct pbuf *p = conn->pending->p;
+
+    *offset = conn->offset;
+
+    conn_recved(conn, p->tot_len - conn->offset);
+
+    pbuf_ref(p);
+    pending_release(conn);
+
+    return p;
+}
+
+// netconn_recv bounded by the read deadline, without updating the receive window
+static err_t conn_recv(tcp_conn_t *conn, struct netbuf **buf) {
+    struct pbuf *p = NULL;
+    err_t err;
+
+    atomic_store(&conn->reading, 1);
+
+    while (1) {
+        int timeout = deadline_remaining(atomic_load(&conn->read_deadline));
+        if (timeout == 0) {
+            err = ERR_TIMEOUT;
+
+            break;
+        }
+
+        netconn_set_recvtimeout(conn->conn, timeout < 0 ? 0 : timeout);
+
+        err = netconn_recv_tcp_pbuf_flags(conn->conn, &p, NETCONN_NOAUTORCVD);
+
+        // timed out or woken by tcp_conn_set_deadline, the deadline decides
+        if (err != ERR_TIMEOUT)
+            break;
+    }
+
+    if (err == ERR_OK) {
+        *buf = netbuf_new();
+
+        if (*buf != NULL) {
+            (*buf)->p = p;
+            (*buf)->ptr = p;
+        } else {
+            pbuf_free(p);
+
+            err = ERR_MEM;
+        }
+    }
+
+    atomic_store(&conn->reading, 0);
+
+    // lwIP has shut down the receive side itself after the FIN
+    if (err == ERR_CLSD)
+        atomic_store(&conn->rx_closed, 1);
+
+    return err;
+}
+
 EXPORT
 int tcp_conn_read(tcp_conn_t *conn, void *data, int length) {
+    if (atomic_load(&conn->rx_closed))
+        return 0;
+
+    // netbuf_copy_partial takes an u16_t length, 65536 would copy nothing and read as EOF
+    if (length > 0xffff)
+        length = 0xffff;
+
     if (conn->pending != NULL) {
         int copied = netbuf_copy_partial(conn->pending, data, length, conn->offset);
 
         conn->offset += copied;
 
-        if (conn->offset >= netbuf_len(conn->pending)) {
-            netbuf_free(conn->pending);
-            netbuf_delete(conn->pending);
+        if (conn->offset >= netbuf_len(conn->pending))
+            pending_release(conn);
 
-            conn->pending = NULL;
-            conn->offset = 0;
-        }
+        conn_recved(conn, copied);
 
         return copied;
     }
 
     struct netbuf *buf;
 
-    if (netconn_recv(conn->conn, &buf) != ERR_OK)
+    err_t err = conn_recv(conn, &buf);
+    if (err == ERR_TIMEOUT)
+        return TCP_CONN_TIMEOUT;
+
+    if (atomic_load(&conn->rx_closed))
+        return 0;
+
+    if (err != ERR_OK)
         return -1;
 
     int copied = netbuf_copy_partial(buf, data, length, 0);
@@ -137,15 +566,622 @@ int tcp_conn_read(tcp_conn_t *conn, void *data, int length) {
         netbuf_delete(buf);
     }
 
+    conn_recved(conn, copied);
+
+    return copied;
+}
+
+EXPORT
+int tcp_conn_recv_segments(tcp_conn_t *conn, segment_t segments[], int count, tcp_lease_t **lease) {
+    if (count <= 0)
+        return -1;
+
+    if (atomic_load(&conn->rx_closed))
+        return 0;
+
+    if (conn->pending == NULL) {
+        err_t err = conn_recv(conn, &conn->pending);
+        if (err == ERR_TIMEOUT)
+            return TCP_CONN_TIMEOUT;
+
+        if (atomic_load(&conn->rx_closed))
+            return 0;
+
+        if (err != ERR_OK)
+            return -1;
+
+        conn->offset = 0;
+    }
+
+    tcp_lease_t *leased = malloc(sizeof(tcp_lease_t));
+    if (leased == NULL)
+        return -1;
+
+    struct pbuf *head = conn->pending->p;
+
+    int start = conn->offset;
+    int skip = conn->offset;
+    int size = 0;
+
+    for (struct pbuf *p = head; p != NULL && size < count; p = p->next) {
+        if (skip >= p->len) {
+            skip -= p->len;
+
+            continue;
+        }
+
+        segments[size].data = (uint8_t *) p->payload + skip;
+        segments[size].length = p->len - skip;
+
+        conn->offset += segments[size].length;
+
+        skip = 0;
+        size++;
+    }
+
+    // the lease keeps the chain alive after the netbuf is gone, and the conn until released
+    pbuf_ref(head);
+
+    leased->head = head;
+    leased->conn = conn;
+    leased->length = conn->offset - start;
+
+    {
+        WITH_MUTEX_LOCKED(lock, &conn->sent_lock);
+
+        conn->outstanding++;
+    }
+
+    *lease = leased;
+
+    if (conn->offset >= netbuf_len(conn->pending))
+        pending_release(conn);
+
+    return size;
+}
+
+EXPORT
+int tcp_conn_peek(tcp_conn_t *conn, void *data, int length) {
+    if (atomic_load(&conn->rx_closed))
+        return 0;
+
+    if (length > 0xffff)
+        length = 0xffff;
+
+    if (conn->pending == NULL) {
+        err_t err = conn_recv(conn, &conn->pending);
+        if (err == ERR_TIMEOUT)
+            return TCP_CONN_TIMEOUT;
+
+        if (atomic_load(&conn->rx_closed))
+            return 0;
+
+        if (err != ERR_OK)
+            return -1;
+
+        conn->offset = 0;
+    }
+
+    // the first bytes of a stream often span several segments, gather those already received
+    while (conn->peeked == NULL && netbuf_len(conn->pending) - conn->offset < length) {
+        struct pbuf *p;
+
+        // NETCONN_NOFIN leaves a FIN for the next read
+        if (netconn_recv_tcp_pbuf_flags(conn->conn, &p, NETCONN_DONTBLOCK | NETCONN_NOFIN | NETCONN_NOAUTORCVD) != ERR_OK)
+            break;
+
+        // pbuf lengths are 16 bit, leases may share the chain so its head cannot be trimmed
+        if (netbuf_len(conn->pending) + p->tot_len > 0xffff) {
+            conn->peeked = p;
+
+            break;
+        }
+
+        pbuf_cat(conn->pending->p, p);
+    }
+
+    int copied = netbuf_copy_partial(conn->pending, data, length, conn->offset);
+
+    if (copied < length && conn->peeked != NULL)
+        copied += pbuf_copy_partial(conn->peeked, (uint8_t *) data + copied, length - copied, 0);
+
     return copied;
 }
 
+EXPORT
+void tcp_conn_release(tcp_lease_t *lease) {
+    tcp_conn_t *conn = lease->conn;
+    int release;
+
+    pbuf_free(lease->head);
+
+    conn_recved(conn, lease->length);
+
+    {
+        WITH_MUTEX_LOCKED(lock, &conn->sent_lock);
+
+        conn->outstanding--;
+
+        release = conn->freed && conn->outstanding == 0;
+    }
+
+    free(lease);
+
+    if (release)
+        tcp_conn_destroy(conn);
+}
+
 EXPORT
 int tcp_conn_write(tcp_conn_t *conn, void *data, int length) {
-    if (netconn_write(conn->conn, data, length, NETCONN_COPY) != ERR_OK)
+    if (deadline_remaining(atomic_load(&conn->write_deadline)) == 0)
+        return TCP_CONN_TIMEOUT;
+
+    atomic_store(&conn->write_started, now_millis());
+
+    // tcp_conn_set_deadline registers a writer it sees, a writer that sees a deadline registers itself
+    atomic_store(&conn->writing, 1);
+
+    if (atomic_load(&conn->write_deadline) != TCP_NO_DEADLINE) {
+        WITH_LWIP_LOCKED();
+
+        atomic_store(&conn->write_waiting, 1);
+
+        write_waiter_add(conn);
+    }
+
+    size_t written = 0;
+    err_t err = netconn_write_partly(conn->conn, data, length, NETCONN_COPY, &written);
+
+    atomic_store(&conn->writing, 0);
+
+    if (atomic_load(&conn->write_waiting)) {
+        WITH_LWIP_LOCKED();
+
+        atomic_store(&conn->write_waiting, 0);
+
+        write_waiter_remove(conn);
+
+        // send_timeout also bounds close, keep it for writes only
+        netconn_set_sendtimeout(conn->conn, 0);
+    }
+
+    if (err == ERR_WOULDBLOCK)
+        return TCP_CONN_TIMEOUT;
+
+    if (err != ERR_OK)
+        return -1;
+
+    // short only when the deadline passed midway
+    return (int) written;
+}
+
+EXPORT
+int tcp_conn_write_ref(tcp_conn_t *conn, const void *data, int length, uint64_t token) {
+    tcp_ref_t *ref = malloc(sizeof(tcp_ref_t));
+    if (ref == NULL)
+        return -1;
+
+    ref->conn = conn;
+    ref->token = token;
+
+    // the writer holds one reference until every segment has been queued
+    atomic_init(&ref->refs, 1);
+
+    {
+        WITH_MUTEX_LOCKED(lock, &conn->sent_lock);
+
+        conn->refs_pending++;
+        conn->outstanding++;
+    }
+
+    size_t written = 0;
+    err_t err = netconn_write_ref_partly(conn->conn, data, length, ref, &written);
+
+    ref_put(ref);
+
+    if (err != ERR_OK)
+        return -1;
+
+    return (int) written;
+}
+
+EXPORT
+int tcp_conn_completed(tcp_conn_t *conn, uint64_t tokens[], int count, int timeout) {
+    while (1) {
+        uint32_t sequence = notify_prepare(&conn->sent_notify);
+
+        {
+            WITH_MUTEX_LOCKED(lock, &conn->sent_lock);
+
+            if (conn->sent_length > 0 || conn->refs_pending == 0 || timeout == 0) {
+                if (count > conn->sent_length)
+                    count = conn->sent_length;
+
+                memcpy(tokens, conn->sent, count * sizeof(uint64_t));
+                memmove(conn->sent, conn->sent + count, (conn->sent_length - count) * sizeof(uint64_t));
+
+                conn->sent_length -= count;
+
+                notify_cancel(&conn->sent_notify);
+
+                return count;
+            }
+        }
+
+        if (notify_wait(&conn->sent_notify, sequence, timeout) < 0)
+            return 0;
+    }
+}
+
+static int relay_events_open(tcp_conn_t *conn) {
+    if (conn->events[0] >= 0)
+        return 0;
+
+    int events[2];
+    if (event_fd_open(events) < 0)
+        return -1;
+
+    WITH_LWIP_LOCKED();
+
+    conn->events[0] = events[0];
+    conn->events[1] = events[1];
+
+    return 0;
+}
+
+// returns bytes written, 0 when fd is not writable, -1 on error
+static ssize_t relay_send(int fd, struct pbuf *p, int offset) {
+    struct iovec iov[TCP_RELAY_IOV_SIZE];
+    int count = 0;
+
+    for (; p != NULL && count < TCP_RELAY_IOV_SIZE; p = p->next) {
+        if (offset >= p->len) {
+            offset -= p->len;
+
+            continue;
+        }
+
+        iov[count].iov_base = (uint8_t *) p->payload + offset;
+        iov[count].iov_len = p->len - offset;
+
+        offset = 0;
+        count++;
+    }
+
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = count};
+
+    while (1) {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n >= 0)
+            return n;
+
+        if (errno == EINTR)
+            continue;
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+
+        // not a socket, fall back to a plain write
+        if (errno == ENOTSOCK) {
+            n = writev(fd, iov, count);
+            if (n >= 0)
+                return n;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+        }
+
+        return -1;
+    }
+}
+
+EXPORT
+int tcp_conn_relay(tcp_conn_t *conn, int fd, tcp_relay_result_t *result) {
+    memset(result, 0, sizeof(tcp_relay_result_t));
+
+    int fd_flags = fcntl(fd, F_GETFL);
+    if (fd_flags < 0 || fcntl(fd, F_SETFL, fd_flags | O_NONBLOCK) < 0)
+        return -1;
+
+    uint8_t *buffer = malloc(TCP_RELAY_BUFFER_SIZE);
+    if (buffer == NULL || relay_events_open(conn) < 0) {
+        free(buffer);
+
+        return -1;
+    }
+
+    // conn -> fd, continuing from anything left by tcp_conn_read
+    struct pbuf *chunk = NULL;
+    int chunk_offset = 0;
+    int upstream_open = !atomic_load(&conn->rx_closed);
+
+    if (conn->pending != NULL)
+        chunk = pending_take(conn, &chunk_offset);
+
+    if (!upstream_open)
+        shutdown(fd, SHUT_WR);
+
+    // fd -> conn
+    int buffered = 0;
+    int buffer_offset = 0;
+    int downstream_open = 1;
+
+    tcp_relay_status_t status = TCP_RELAY_CLOSED;
+
+    while (upstream_open || downstream_open) {
+        short events = 0;
+
+        event_fd_drain(conn->events);
+
+        while (upstream_open) {
+            // a segment held back by tcp_conn_peek
+            if (chunk == NULL && conn->pending != NULL)
+                chunk = pending_take(conn, &chunk_offset);
+
+            if (chunk == NULL) {
+                err_t err = netconn_recv_tcp_pbuf_flags(conn->conn, &chunk, NETCONN_DONTBLOCK);
+
+                // ERR_TIMEOUT is a wakeup left by tcp_conn_set_deadline, data may be queued behind it
+                if (err == ERR_TIMEOUT)
+                    continue;
+
+                if (err == ERR_WOULDBLOCK) {
+                    chunk = NULL;
+
+                    break;
+                }
+
+                if (err != ERR_OK) {
+                    chunk = NULL;
+
+                    if (err != ERR_CLSD) {
+                        status = TCP_RELAY_CONN_ERROR;
+
+                        goto done;
+                    }
+
+                    shutdown(fd, SHUT_WR);
+
+                    upstream_open = 0;
+
+                    break;
+                }
+
+                chunk_offset = 0;
+            }
+
+            ssize_t n = relay_send(fd, chunk, chunk_offset);
+            if (n < 0) {
+                status = TCP_RELAY_FD_ERROR;
+
+                goto done;
+            }
+
+            if (n == 0) {
+                events |= POLLOUT;
+
+                break;
+            }
+
+            chunk_offset += n;
+            result->received += n;
+
+            if (chunk_offset >= chunk->tot_len) {
+                pbuf_free(chunk);
+
+                chunk = NULL;
+            }
+        }
+
+        while (downstream_open) {
+            if (buffer_offset == buffered) {
+                ssize_t n = read(fd, buffer, TCP_RELAY_BUFFER_SIZE);
+                if (n < 0 && errno == EINTR)
+                    continue;
+
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    events |= POLLIN;
+
+                    break;
+                }
+
+                if (n < 0) {
+                    status = TCP_RELAY_FD_ERROR;
+
+                    goto done;
+                }
+
+                if (n == 0) {
+                    netconn_shutdown(conn->conn, 0, 1);
+
+                    downstream_open = 0;
+
+                    break;
+                }
+
+                buffered = (int) n;
+                buffer_offset = 0;
+            }
+
+            size_t written = 0;
+            err_t err = netconn_write_partly(conn->conn, buffer + buffer_offset, buffered - buffer_offset,
+                                             NETCONN_COPY | NETCONN_DONTBLOCK, &written);
+            if (err != ERR_OK && err != ERR_WOULDBLOCK) {
+                status = TCP_RELAY_CONN_ERROR;
+
+                goto done;
+            }
+
+            buffer_offset += (int) written;
+            result->sent += written;
+
+            // send buffer full, sent_tcp raises an event once there is room
+            if (written == 0)
+                break;
+        }
+
+        if (!upstream_open && !downstream_open)
+            break;
+
+        // with only the conn side pending, a hangup would wake poll over and over
+        struct pollfd fds[2] = {
+                {.fd = events == 0 && downstream_open ? -1 : fd, .events = events},
+                {.fd = conn->events[0], .events = POLLIN},
+        };
+
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            status = TCP_RELAY_FD_ERROR;
+
+            break;
+        }
+
+        if (fds[0].revents & (POLLERR | POLLNVAL)) {
+            status = TCP_RELAY_FD_ERROR;
+
+            break;
+        }
+
+        // peer is gone in both directions, nothing more can be delivered to it
+        if ((fds[0].revents & POLLHUP) && !downstream_open)
+            break;
+    }
+
+    done:
+    if (chunk != NULL)
+        pbuf_free(chunk);
+
+    free(buffer);
+
+    fcntl(fd, F_SETFL, fd_flags);
+
+    result->status = status;
+
+    return 0;
+}
+
+EXPORT
+int tcp_conn_shutdown(tcp_conn_t *conn, int rx, int tx) {
+    // readers blocked on the recvmbox are woken with ERR_CONN and report EOF
+    if (rx)
+        atomic_store(&conn->rx_closed, 1);
+
+    if (netconn_shutdown(conn->conn, rx, tx) != ERR_OK)
         return -1;
 
-    return length;
+    return 0;
+}
+
+EXPORT
+void tcp_conn_set_deadline(tcp_conn_t *conn, int deadlines, int64_t timeout) {
+    int64_t deadline = timeout < 0 ? TCP_NO_DEADLINE : now_millis() + timeout;
+
+    if (deadlines & TCP_DEADLINE_READ) {
+        atomic_store(&conn->read_deadline, deadline);
+
+        WITH_LWIP_LOCKED();
+
+        // a blocked reader recomputes its timeout from the new deadline,
+        // a wakeup left behind for a reader that already returned is dropped
+        if (atomic_load(&conn->reading))
+            lwip_netconn_wake_recv(conn->conn);
+        else
+            lwip_netconn_clear_wakeup(conn->conn);
+    }
+
+    if (deadlines & TCP_DEADLINE_WRITE) {
+        WITH_LWIP_LOCKED();
+
+        atomic_store(&conn->write_deadline, deadline);
+
+        // a blocked writer sees it when the timer fires, the writer unregisters once it sees write_waiting
+        atomic_store(&conn->write_waiting, 1);
+
+        if (atomic_load(&conn->writing))
+            write_waiter_add(conn);
+        else if (conn->waiter_pprev == NULL)
+            atomic_store(&conn->write_waiting, 0);
+    }
+}
+
+EXPORT
+int tcp_conn_set_buffers(tcp_conn_t *conn, int send, int receive, int receive_max) {
+    if (send < 0 || receive < 0 || receive_max < 0)
+        return -1;
+
+    WITH_LWIP_LOCKED();
+
+    if (conn->conn->pcb.tcp == NULL)
+        return -1;
+
+    tcp_set_buffers(conn->conn->pcb.tcp, send, receive, receive_max);
+
+    return 0;
+}
+
+EXPORT
+int tcp_conn_stats(tcp_conn_t *conn, tcp_conn_stats_t *stats) {
+    WITH_LWIP_LOCKED();
+
+    struct tcp_pcb *pcb = conn->conn->pcb.tcp;
+    if (pcb == NULL)
+        return -1;
+
+    stats->bytes_received = pcb->stats_bytes_in;
+    stats->bytes_sent = pcb->stats_bytes_out;
+    stats->segments_received = pcb->stats_segs_in;
+    stats->segments_sent = pcb->stats_segs_out;
+    stats->retransmits = pcb->stats_rexmits;
+
+    // sa is 8 times and sv 4 times the estimate, both in slow timer ticks
+    stats->srtt_ms = (uint32_t) (pcb->sa >> 3) * TCP_SLOW_INTERVAL;
+    stats->rttvar_ms = (uint32_t) (pcb->sv >> 2) * TCP_SLOW_INTERVAL;
+    stats->rto_ms = (uint32_t) pcb->rto * TCP_SLOW_INTERVAL;
+
+    stats->cwnd = pcb->cwnd;
+    stats->ssthresh = pcb->ssthresh;
+    stats->send_window = pcb->snd_wnd;
+    stats->receive_window = pcb->rcv_wnd;
+    stats->send_buffer = pcb->snd_buf;
+    stats->unsent_bytes = pcb->snd_lbb - pcb->snd_nxt;
+    stats->unacked_bytes = pcb->snd_nxt - pcb->lastack;
+    stats->queued_segments = pcb->snd_queuelen;
+
+    stats->receive_queued = 0;
+    if (sys_mbox_valid(&conn->conn->recvmbox))
+        stats->receive_queued = sys_arch_mbox_count(&conn->conn->recvmbox);
+
+    return 0;
+}
+
+static const struct tcp_cc_ops *congestion_ops(tcp_congestion_t congestion) {
+    switch (congestion) {
+        case TCP_CONGESTION_CUBIC:
+            return &tcp_cc_cubic;
+        case TCP_CONGESTION_LOCAL:
+            return &tcp_cc_local;
+        default:
+            return &tcp_cc_reno;
+    }
+}
+
+EXPORT
+void tcp_set_congestion_control(tcp_congestion_t congestion) {
+    WITH_LWIP_LOCKED();
+
+    tcp_set_default_cc(congestion_ops(congestion));
+}
+
+EXPORT
+int tcp_conn_set_congestion_control(tcp_conn_t *conn, tcp_congestion_t congestion) {
+    WITH_LWIP_LOCKED();
+
+    // the pcb is gone once lwIP has closed or aborted the connection
+    if (conn->conn->pcb.tcp == NULL)
+        return -1;
+
+    tcp_set_cc(conn->conn->pcb.tcp, congestion_ops(congestion));
+
+    return 0;
 }
 
 EXPORT
@@ -177,9 +1213,36 @@ void tcp_conn_close(tcp_conn_t *conn) {
 EXPORT
 void tcp_conn_free(tcp_conn_t *conn) {
     if (conn->pending != NULL)
-        netbuf_free(conn->pending);
+        netbuf_delete(conn->pending);
+
+    if (conn->peeked != NULL)
+        pbuf_free(conn->peeked);
+
+    {
+        WITH_LWIP_LOCKED();
+
+        // leases released later must not reach the netconn
+        conn->deleted = 1;
+
+        write_waiter_remove(conn);
+    }
 
     netconn_delete(conn->conn);
 
-    free(conn);
+    if (conn->events[0] >= 0)
+        event_fd_close(conn->events);
+
+    int release;
+
+    {
+        WITH_MUTEX_LOCKED(lock, &conn->sent_lock);
+
+        conn->freed = 1;
+
+        release = conn->outstanding == 0;
+    }
+
+    // referenced segments may outlive the netconn, the last one frees the conn
+    if (release)
+        tcp_conn_destroy(conn);
 }
@@ -6,14 +6,75 @@
 
 typedef struct tcp_listener_t tcp_listener_t;
 typedef struct tcp_conn_t tcp_conn_t;
+typedef struct tcp_lease_t tcp_lease_t;
+
+#define TCP_CONN_TIMEOUT -2
+
+typedef enum tcp_deadline_t {
+    TCP_DEADLINE_READ = 1 << 0,
+    TCP_DEADLINE_WRITE = 1 << 1,
+} tcp_deadline_t;
+
+typedef enum tcp_congestion_t {
+    TCP_CONGESTION_RENO,
+    TCP_CONGESTION_CUBIC,
+    TCP_CONGESTION_LOCAL,
+} tcp_congestion_t;
+
+typedef enum tcp_relay_status_t {
+    TCP_RELAY_CLOSED,
+    TCP_RELAY_CONN_ERROR,
+    TCP_RELAY_FD_ERROR,
+} tcp_relay_status_t;
+
+typedef struct tcp_relay_result_t {
+    uint64_t received;
+    uint64_t sent;
+    tcp_relay_status_t status;
+} tcp_relay_result_t;
+
+typedef struct tcp_conn_stats_t {
+    uint64_t bytes_received;
+    uint64_t bytes_sent; // acknowledged by the peer
+    uint32_t segments_received;
+    uint32_t segments_sent;
+    uint32_t retransmits;
+    uint32_t srtt_ms;
+    uint32_t rttvar_ms;
+    uint32_t rto_ms;
+    uint32_t cwnd;
+    uint32_t ssthresh;
+    uint32_t send_window;
+    uint32_t receive_window;
+    uint32_t send_buffer; // free space
+    uint32_t unsent_bytes;
+    uint32_t unacked_bytes;
+    uint32_t queued_segments; // pbufs in the send queue
+    uint32_t receive_queued; // messages in the receive mailbox
+} tcp_conn_stats_t;
+
+EXPORT void tcp_set_congestion_control(tcp_congestion_t congestion);
 
 EXPORT tcp_listener_t *tcp_listener_listen();
 EXPORT tcp_conn_t *tcp_listener_accept(tcp_listener_t *listener);
+EXPORT int tcp_listener_accept_batch(tcp_listener_t *listener, tcp_conn_t *out[], int count);
+EXPORT void tcp_listener_set_defer_accept(tcp_listener_t *listener, int timeout);
 EXPORT void tcp_listener_close(tcp_listener_t *listener);
 EXPORT void tcp_listener_free(tcp_listener_t *listener);
 
 EXPORT int tcp_conn_read(tcp_conn_t *conn, void *data, int length);
+EXPORT int tcp_conn_peek(tcp_conn_t *conn, void *data, int length);
+EXPORT int tcp_conn_recv_segments(tcp_conn_t *conn, segment_t segments[], int count, tcp_lease_t **lease);
+EXPORT void tcp_conn_release(tcp_lease_t *lease);
 EXPORT int tcp_conn_write(tcp_conn_t *conn, void *data, int length);
+EXPORT int tcp_conn_write_ref(tcp_conn_t *conn, const void *data, int length, uint64_t token);
+EXPORT int tcp_conn_completed(tcp_conn_t *conn, uint64_t tokens[], int count, int timeout);
+EXPORT int tcp_conn_relay(tcp_conn_t *conn, int fd, tcp_relay_result_t *result);
+EXPORT int tcp_conn_shutdown(tcp_conn_t *conn, int rx, int tx);
+EXPORT void tcp_conn_set_deadline(tcp_conn_t *conn, int deadlines, int64_t timeout);
+EXPORT int tcp_conn_set_congestion_control(tcp_conn_t *conn, tcp_congestion_t congestion);
+EXPORT int tcp_conn_set_buffers(tcp_conn_t *conn, int send, int receive, int receive_max);
+EXPORT int tcp_conn_stats(tcp_conn_t *conn, tcp_conn_stats_t *stats);
 EXPORT void tcp_conn_local_addr(tcp_conn_t *conn, uint8_t addr[4], uint16_t *port);
 EXPORT void tcp_conn_remote_addr(tcp_conn_t *conn, uint8_t addr[4], uint16_t *port);
 EXPORT void tcp_conn_close(tcp_conn_t *conn);
@@ -1,6 +1,7 @@
 #include "udp.h"
 
 #include "queues.h"
+#include "scheduler.h"
 #include "interface.h"
 #include "utils.h"
 
@@ -9,6 +10,7 @@
 #include "lwip/ip.h"
 
 #include <string.h>
+#include <stdatomic.h>
 
 struct udp_conn_t {
     struct udp_pcb *pcb;
@@ -16,11 +18,8 @@ struct udp_conn_t {
     pbuf_queue_t rx;
     pbuf_queue_t tx;
 
-    pthread_mutex_t rx_lock;
-    pthread_cond_t rx_cond;
-
-    pthread_mutex_t tx_lock;
-    int tx_polling;
+    scheduler_source_t tx_source;
+    atomic_int closed;
 };
 
 static void udp_on_received(void *arg, struct udp_pcb *pcb, struct pbuf *p,
@@ -54,54 +53,41 @@ static void udp_on_received(void *arg, struct udp_pcb *pcb, struct pbuf *p,
 
     pbuf_cat(buffer, p);
 
-    WITH_MUTEX_LOCKED(lock, &conn->rx_lock);
-
     pbuf_queue_append(&conn->rx, &buffer, 1);
-
-    pthread_cond_signal(&conn->rx_cond);
 }
 
-static void udp_poll_tx(void *ctx) {
+static void udp_send_packet(void *ctx, struct pbuf *buf) {
     udp_conn_t *conn = ctx;
 
-    struct pbuf *array[32];
-    int size;
+    udp_metadata_t *metadata = (udp_metadata_t*) buf->payload;
 
-    {
-        WITH_MUTEX_LOCKED(lock, &conn->tx_lock);
+    ip_addr_t src_addr;
+    ip_addr_t dst_addr;
 
-        conn->tx_polling = 0;
+    IP4_ADDR(&src_addr, metadata->src_addr[0], metadata->src_addr[1], metadata->src_addr[2], metadata->src_addr[3]);
+    IP4_ADDR(&dst_addr, metadata->dst_addr[0], metadata->dst_addr[1], metadata->dst_addr[2], metadata->dst_addr[3]);
 
-        size = pbuf_queue_pop(&conn->tx, array, 32);
-    }
-
-    for (int i = 0; i < size; i++) {
-        struct pbuf *buf = array[i];
+    uint16_t src_port = metadata->src_port;
+    uint16_t dst_port = metadata->dst_port;
 
-        udp_metadata_t *metadata = (udp_metadata_t*) buf->payload;
-
-        ip_addr_t src_addr;
-        ip_addr_t dst_addr;
-
-        IP4_ADDR(&src_addr, metadata->src_addr[0], metadata->src_addr[1], metadata->src_addr[2], metadata->src_addr[3]);
-        IP4_ADDR(&dst_addr, metadata->dst_addr[0], metadata->dst_addr[1], metadata->dst_addr[2], metadata->dst_addr[3]);
-
-        uint16_t src_port = metadata->src_port;
-        uint16_t dst_port = metadata->dst_port;
+    if (pbuf_remove_header(buf, sizeof(udp_metadata_t))) {
+        pbuf_free(buf);
 
-        if (pbuf_remove_header(buf, sizeof(udp_metadata_t))) {
-            pbuf_free(buf);
+        return;
+    }
 
-            continue;
-        }
+    if (conn->pcb) {
+        udp_sendto_if_src_port(conn->pcb, buf, &dst_addr, dst_port,
+                                                      global_interface_get(),
+                                                      &src_addr, src_port);
+    }
 
-        if (conn->pcb) {
-            udp_sendto_if_src_port(conn->pcb, buf, &dst_addr, dst_port,
-                                                          global_interface_get(),
-                                                          &src_addr, src_port);
-        }
+    pbuf_free(buf);
+}
 
-        pbuf_free(buf);
+static void udp_send_packets(void *ctx, struct pbuf *array[], int size) {
+    for (int i = 0; i < size; i++) {
+        udp_send_packet(ctx, array[i]);
     }
 }
 
@@ -115,14 +101,23 @@ udp_conn_t *udp_conn_listen() {
     if (udp_bind(pcb, IP4_ADDR_ANY, UDP_ACCEPT_ANY_PORT) != ERR_OK)
         goto abort;
 
-    conn = malloc(sizeof(udp_conn_t));
+    if (posix_memalign((void **) &conn, CACHE_LINE_SIZE, sizeof(udp_conn_t)) != 0) {
+        conn = NULL;
+
+        goto abort;
+    }
 
     memset(conn, 0, sizeof(udp_conn_t));
 
-    pthread_mutex_init(&conn->rx_lock, NULL);
-    pthread_mutex_init(&conn->tx_lock, NULL);
+    // rx is fed by udp_on_received on the tcpip thread
+    if (pbuf_queue_init(&conn->rx, 0) < 0 || pbuf_queue_init(&conn->tx, 1) < 0) {
+        pbuf_queue_destroy(&conn->rx);
+        pbuf_queue_destroy(&conn->tx);
+
+        goto abort;
+    }
 
-    pthread_cond_init(&conn->rx_cond, NULL);
+    scheduler_source_init(&conn->tx_source, &conn->tx, &udp_send_packets, conn);
 
     udp_bind_netif(pcb, global_interface_get());
 
@@ -144,21 +139,26 @@ EXPORT
 void udp_conn_close(udp_conn_t *conn) {
     WITH_LWIP_LOCKED();
 
-    WITH_MUTEX_LOCKED(rx_lock, &conn->rx_lock);
-    WITH_MUTEX_LOCKED(tx_lock, &conn->tx_lock);
-
     if (conn->pcb != NULL)
         udp_remove(conn->pcb);
 
     conn->pcb = NULL;
 
-    pthread_cond_broadcast(&conn->rx_cond);
+    scheduler_detach(&conn->tx_source);
+
+    atomic_store(&conn->closed, 1);
+
+    pbuf_queue_close(&conn->rx);
+    pbuf_queue_close(&conn->tx);
 }
 
 EXPORT
 void udp_conn_free(udp_conn_t *udp) {
     udp_conn_close(udp);
 
+    pbuf_queue_destroy(&udp->rx);
+    pbuf_queue_destroy(&udp->tx);
+
     free(udp);
 }
 
@@ -166,18 +166,8 @@ EXPORT
 int udp_conn_recv(udp_conn_t *conn, udp_metadata_t *metadata, void *buffer, int size) {
     struct pbuf *buf = NULL;
 
-    {
-        WITH_MUTEX_LOCKED(lock, &conn->rx_lock);
-
-        while (pbuf_queue_length(&conn->rx) == 0) {
-            if (conn->pcb == NULL)
-                return -1;
-
-            pthread_cond_wait(&conn->rx_cond, &conn->rx_lock);
-        }
-
-        pbuf_queue_pop(&conn->rx, &buf, 1);
-    }
+    if (pbuf_queue_pop_wait(&conn->rx, &buf, 1) < 0)
+        return -1;
 
     if (buf == NULL)
         return -1;
@@ -200,7 +190,10 @@ int udp_conn_recv(udp_conn_t *conn, udp_metadata_t *metadata, void *buffer, int
 
 EXPORT
 int udp_conn_sendto(udp_conn_t *conn, udp_metadata_t *metadata, void *buffer, int size) {
-    if (!conn->pcb)
+    if (atomic_load(&conn->closed))
+        return -1;
+
+    if (size < 0 || size > 0xffff - IP_HLEN - UDP_HLEN)
         return -1;
 
     struct pbuf *buf = pbuf_alloc(PBUF_TRANSPORT, size, PBUF_RAM);
@@ -217,15 +210,19 @@ int udp_conn_sendto(udp_conn_t *conn, udp_metadata_t *metadata, void *buffer, in
 
     pbuf_take(buf, metadata, sizeof(udp_metadata_t));
 
-    WITH_MUTEX_LOCKED(lock, &conn->tx_lock);
-
     pbuf_queue_append(&conn->tx, &buf, 1);
 
-    if (!conn->tx_polling) {
-        if (tcpip_try_callback(&udp_poll_tx, conn) == ERR_OK) {
-            conn->tx_polling = 1;
-        }
-    }
+    scheduler_kick(&conn->tx_source);
 
     return size;
 }
+
+EXPORT
+void udp_conn_set_queue_policy(udp_conn_t *conn, queue_direction_t direction, queue_policy_t policy, int limit, int timeout) {
+    pbuf_queue_configure(direction == QUEUE_RX ? &conn->rx : &conn->tx, policy, limit, timeout);
+}
+
+EXPORT
+void udp_conn_queue_stats(udp_conn_t *conn, queue_direction_t direction, queue_stats_t *stats) {
+    pbuf_queue_stats(direction == QUEUE_RX ? &conn->rx : &conn->tx, stats);
+}
@@ -18,3 +18,5 @@ EXPORT void udp_conn_close(udp_conn_t *conn);
 EXPORT void udp_conn_free(udp_conn_t *udp);
 EXPORT int udp_conn_recv(udp_conn_t *conn, udp_metadata_t *metadata, void *buffer, int size);
 EXPORT int udp_conn_sendto(udp_conn_t *conn, udp_metadata_t *metadata, void *buffer, int size);
+EXPORT void udp_conn_set_queue_policy(udp_conn_t *conn, queue_direction_t direction, queue_policy_t policy, int limit, int timeout);
+EXPORT void udp_conn_queue_stats(udp_conn_t *conn, queue_direction_t direction, queue_stats_t *stats);
@@ -2,6 +2,57 @@
 
 #include "lwip/tcpip.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+int event_fd_open(int fds[2]) {
+#ifdef __linux__
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    fds[0] = fd;
+    fds[1] = fd;
+#else
+    if (pipe(fds) < 0)
+        return -1;
+
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+
+    return 0;
+}
+
+void event_fd_signal(int fds[2]) {
+#ifdef __linux__
+    uint64_t value = 1;
+
+    write(fds[1], &value, sizeof(value));
+#else
+    write(fds[1], "", 1);
+#endif
+}
+
+void event_fd_drain(int fds[2]) {
+    uint8_t buffer[64];
+
+    while (read(fds[0], buffer, sizeof(buffer)) > 0);
+}
+
+void event_fd_close(int fds[2]) {
+    close(fds[0]);
+
+    if (fds[1] != fds[0])
+        close(fds[1]);
+}
+
 void scoped_mutex_acquire(pthread_mutex_t *mutex) {
     pthread_mutex_lock(mutex);
 }
@@ -1,10 +1,41 @@
 #pragma once
 
+#include <stdint.h>
 #include <pthread.h>
 
 #define CLEANUP(func) __attribute__((cleanup(func)))
 #define EXPORT __attribute__((visibility("default"), used))
 
+typedef struct segment_t {
+    void *data;
+    int length;
+} segment_t;
+
+typedef enum queue_direction_t {
+    QUEUE_RX,
+    QUEUE_TX,
+} queue_direction_t;
+
+typedef enum queue_policy_t {
+    QUEUE_POLICY_DROP_HEAD,
+    QUEUE_POLICY_DROP_TAIL,
+    QUEUE_POLICY_BLOCK,
+    QUEUE_POLICY_GROW,
+} queue_policy_t;
+
+typedef struct queue_stats_t {
+    uint64_t enqueued;
+    uint64_t dropped;
+    int length;
+    int limit;
+    int high_watermark;
+} queue_stats_t;
+
+int event_fd_open(int fds[2]);
+void event_fd_signal(int fds[2]);
+void event_fd_drain(int fds[2]);
+void event_fd_close(int fds[2]);
+
 void scoped_mutex_acquire(pthread_mutex_t *mutex);
 void scoped_mutex_release(pthread_mutex_t **mutex);
 
@@ -0,0 +1,203 @@
+#include "vnet.h"
+
+#include "lwip/def.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/prot/ip.h"
+#include "lwip/prot/ip4.h"
+#include "lwip/prot/tcp.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+// headers of an outgoing tcp packet, copied so the pbuf queued on the pcb is never written
+typedef struct vnet_header_pbuf_t {
+    struct pbuf_custom custom;
+    struct pbuf *packet;
+    uint8_t data[VNET_HDR_LEN + IP_HLEN_MAX + TCP_HLEN + 40];
+} vnet_header_pbuf_t;
+
+int vnet_input(const vnet_hdr_t *hdr, struct pbuf *p) {
+    switch (hdr->gso_type & ~VNET_HDR_GSO_ECN) {
+        case VNET_HDR_GSO_NONE:
+            break;
+        case VNET_HDR_GSO_TCPV4:
+            // a tcp super packet is taken as one large segment
+            if (pbuf_get_at(p, 9) != IP_PROTO_TCP)
+                return -1;
+
+            break;
+        default:
+            // udp and ipv6 segmentation are not supported
+            return -1;
+    }
+
+    if (!(hdr->flags & VNET_HDR_F_NEEDS_CSUM))
+        return 0;
+
+    // tcp checksum is never checked, complete the partial checksum for everything else
+    if (pbuf_get_at(p, 9) == IP_PROTO_TCP)
+        return 0;
+
+    uint16_t start = hdr->csum_start;
+    uint16_t offset = hdr->csum_offset;
+
+    if (start > p->len || start + offset + 2 > p->tot_len)
+        return -1;
+
+    pbuf_remove_header(p, start);
+
+    uint16_t sum = inet_chksum_pbuf(p);
+
+    pbuf_add_header(p, start);
+
+    if (sum == 0 && pbuf_get_at(p, 9) == IP_PROTO_UDP)
+        sum = 0xffff;
+
+    pbuf_take_at(p, &sum, sizeof(sum), start + offset);
+
+    return 0;
+}
+
+static uint16_t pseudo_header_sum(const uint8_t *iphdr, uint16_t length) {
+    uint32_t sum = 0;
+
+    for (int i = 12; i < 20; i += 2) {
+        sum += ((uint32_t) iphdr[i] << 8) | iphdr[i + 1];
+    }
+
+    sum += IP_PROTO_TCP;
+    sum += length;
+
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    return lwip_htons((uint16_t) sum);
+}
+
+static void vnet_header_free(struct pbuf *p) {
+    vnet_header_pbuf_t *header = (vnet_header_pbuf_t *) p;
+
+    if (header->packet != NULL)
+        pbuf_free(header->packet);
+
+    free(header);
+}
+
+// vnet header, copied ip and tcp headers, then the payload of p by reference
+static struct pbuf *vnet_output_tcp(struct pbuf *p, const vnet_hdr_t *hdr, const uint8_t *headers, uint16_t headers_len) {
+    if (p->len < headers_len)
+        return NULL;
+
+    vnet_header_pbuf_t *header = malloc(sizeof(vnet_header_pbuf_t));
+    if (header == NULL)
+        return NULL;
+
+    memcpy(header->data, hdr, VNET_HDR_LEN);
+    memcpy(header->data + VNET_HDR_LEN, headers, headers_len);
+
+    header->custom.custom_free_function = &vnet_header_free;
+    header->packet = p;
+
+    struct pbuf *head = pbuf_alloced_custom(PBUF_RAW, VNET_HDR_LEN + headers_len, PBUF_REF,
+                                            &header->custom, header->data, sizeof(header->data));
+    if (head == NULL) {
+        free(header);
+
+        return NULL;
+    }
+
+    if (p->len > headers_len) {
+        struct pbuf *rest = pbuf_alloc(PBUF_RAW, p->len - headers_len, PBUF_REF);
+        if (rest == NULL) {
+            header->packet = NULL;
+
+            pbuf_free(head);
+
+            return NULL;
+        }
+
+        rest->payload = (uint8_t *) p->payload + headers_len;
+
+        pbuf_cat(head, rest);
+    }
+
+    if (p->next != NULL)
+        pbuf_chain(head, p->next);
+
+    return head;
+}
+
+struct pbuf *vnet_output(struct pbuf *p) {
+    vnet_hdr_t hdr;
+    uint8_t headers[IP_HLEN_MAX + TCP_HLEN + 40];
+
+    memset(&hdr, 0, sizeof(hdr));
+
+    if (p->tot_len > VNET_MAX_PACKET - VNET_HDR_LEN) {
+        pbuf_free(p);
+
+        return NULL;
+    }
+
+    uint16_t copied = pbuf_copy_partial(p, headers, sizeof(headers), 0);
+
+    if (copied >= IP_HLEN && headers[9] == IP_PROTO_TCP) {
+        uint16_t ip_hlen = (headers[0] & 0x0f) * 4;
+
+        if (copied >= ip_hlen + TCP_HLEN) {
+            uint16_t tcp_hlen = (headers[ip_hlen + 12] >> 4) * 4;
+            uint16_t sum = pseudo_header_sum(headers, p->tot_len - ip_hlen);
+
+            if (tcp_hlen < TCP_HLEN || ip_hlen + tcp_hlen > copied) {
+                pbuf_free(p);
+
+                return NULL;
+            }
+
+            // tcp checksum generation is offloaded, leave the pseudo header sum for the device
+            hdr.flags = VNET_HDR_F_NEEDS_CSUM;
+            hdr.csum_start = ip_hlen;
+            hdr.csum_offset = 16;
+
+            memcpy(headers + ip_hlen + 16, &sum, sizeof(sum));
+
+#if LWIP_TCP_GSO
+            if (p->gso_size != 0) {
+                hdr.gso_type = VNET_HDR_GSO_TCPV4;
+                hdr.gso_size = p->gso_size;
+                hdr.hdr_len = ip_hlen + tcp_hlen;
+            }
+#endif
+
+            struct pbuf *head = vnet_output_tcp(p, &hdr, headers, ip_hlen + tcp_hlen);
+            if (head != NULL)
+                return head;
+
+            // headers split across pbufs or out of memory, write a private copy
+            struct pbuf *copy = pbuf_clone(PBUF_RAW, PBUF_RAM, p);
+
+            pbuf_free(p);
+
+            if (copy == NULL)
+                return NULL;
+
+            pbuf_take_at(copy, &sum, sizeof(sum), ip_hlen + 16);
+
+            p = copy;
+        }
+    }
+
+    // the vnet header always goes in front, the stack may still hold p
+    struct pbuf *header = pbuf_alloc(PBUF_RAW, VNET_HDR_LEN, PBUF_RAM);
+    if (header == NULL) {
+        pbuf_free(p);
+
+        return NULL;
+    }
+
+    memcpy(header->payload, &hdr, VNET_HDR_LEN);
+
+    pbuf_cat(header, p);
+
+    return header;
+}
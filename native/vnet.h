@@ -0,0 +1,29 @@
+#pragma once
+
+#include "lwip/pbuf.h"
+
+#include <stdint.h>
+
+#define VNET_HDR_F_NEEDS_CSUM 1
+#define VNET_HDR_F_DATA_VALID 2
+
+#define VNET_HDR_GSO_NONE 0
+#define VNET_HDR_GSO_TCPV4 1
+#define VNET_HDR_GSO_ECN 0x80
+
+#define VNET_HDR_LEN 10
+#define VNET_MAX_PACKET 65535
+
+typedef struct vnet_hdr_t {
+    uint8_t flags;
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+} vnet_hdr_t;
+
+_Static_assert(sizeof(vnet_hdr_t) == VNET_HDR_LEN, "invalid vnet_hdr_t");
+
+int vnet_input(const vnet_hdr_t *hdr, struct pbuf *p);
+struct pbuf *vnet_output(struct pbuf *p);
@@ -0,0 +1,60 @@
+package tun2socket
+
+/*
+#cgo CFLAGS: -Inative
+
+#include "utils.h"
+*/
+import "C"
+
+import "time"
+
+type QueueDirection int
+
+const (
+	// QueueRx holds packets leaving the stack.
+	QueueRx QueueDirection = C.QUEUE_RX
+	// QueueTx holds packets written into the stack.
+	QueueTx QueueDirection = C.QUEUE_TX
+)
+
+type QueuePolicy int
+
+const (
+	// QueueDropHead drops the oldest queued packet when the queue is full.
+	QueueDropHead QueuePolicy = C.QUEUE_POLICY_DROP_HEAD
+	// QueueDropTail drops the incoming packet when the queue is full.
+	QueueDropTail QueuePolicy = C.QUEUE_POLICY_DROP_TAIL
+	// QueueBlock blocks the producer until space is available or the timeout expires.
+	// The producer of QueueRx is the lwip thread, which must not wait, so
+	// QueueRx drops the incoming packet instead like QueueDropTail.
+	QueueBlock QueuePolicy = C.QUEUE_POLICY_BLOCK
+	// QueueGrow doubles the queue limit when full, up to the native capacity.
+	QueueGrow QueuePolicy = C.QUEUE_POLICY_GROW
+)
+
+type QueueStats struct {
+	Enqueued      uint64
+	Dropped       uint64
+	Length        int
+	Limit         int
+	HighWatermark int
+}
+
+func timeoutMillis(timeout time.Duration) C.int {
+	if timeout < 0 {
+		return -1
+	}
+
+	return C.int(timeout / time.Millisecond)
+}
+
+func newQueueStats(stats *C.queue_stats_t) QueueStats {
+	return QueueStats{
+		Enqueued:      uint64(stats.enqueued),
+		Dropped:       uint64(stats.dropped),
+		Length:        int(stats.length),
+		Limit:         int(stats.limit),
+		HighWatermark: int(stats.high_watermark),
+	}
+}
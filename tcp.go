@@ -11,13 +11,41 @@ import (
 	"errors"
 	"net"
 	"runtime"
+	"time"
 )
 
 var ErrUnacceptable = errors.New("unacceptable")
 var ErrIllegalState = errors.New("illegal state")
 
+// CongestionControl selects how lwIP grows and shrinks the congestion window
+// of connections toward the TUN.
+type CongestionControl int
+
+const (
+	CongestionReno      CongestionControl = C.TCP_CONGESTION_RENO
+	CongestionCubic     CongestionControl = C.TCP_CONGESTION_CUBIC
+	CongestionLocalLink CongestionControl = C.TCP_CONGESTION_LOCAL
+)
+
+// SetCongestionControl sets the congestion control of connections accepted
+// from now on. CongestionLocalLink skips slow start and never shrinks the
+// window, only the client's receive window limits data in flight.
+func SetCongestionControl(cc CongestionControl) {
+	C.tcp_set_congestion_control(C.tcp_congestion_t(cc))
+}
+
 type TCP interface {
 	Accept() (net.Conn, error)
+
+	// AcceptBatch waits for a connection and fills conns with it and every
+	// other connection already pending, returning how many it stored.
+	AcceptBatch(conns []net.Conn) (int, error)
+
+	// SetDeferAccept holds connections back from Accept until the client
+	// sends data or timeout passes, checked about once a second. 0 turns it
+	// off.
+	SetDeferAccept(timeout time.Duration)
+
 	Close() error
 }
 
@@ -35,6 +63,29 @@ func (l *tcp) Accept() (net.Conn, error) {
 	return newConn(context), nil
 }
 
+func (l *tcp) AcceptBatch(conns []net.Conn) (int, error) {
+	if len(conns) == 0 {
+		return 0, nil
+	}
+
+	contexts := make([]*C.tcp_conn_t, len(conns))
+
+	n := int(C.tcp_listener_accept_batch(l.context, &contexts[0], C.int(len(contexts))))
+	if n < 0 {
+		return 0, ErrUnacceptable
+	}
+
+	for i := 0; i < n; i++ {
+		conns[i] = newConn(contexts[i])
+	}
+
+	return n, nil
+}
+
+func (l *tcp) SetDeferAccept(timeout time.Duration) {
+	C.tcp_listener_set_defer_accept(l.context, C.int(timeout.Milliseconds()))
+}
+
 func (l *tcp) Close() error {
 	C.tcp_listener_close(l.context)
 
@@ -3,32 +3,197 @@ package tun2socket
 /*
 #cgo CFLAGS: -Inative
 
+#include <stdlib.h>
+
 #include "tcp.h"
 */
 import "C"
 
 import (
+	"io"
 	"net"
+	"os"
 	"runtime"
 	"time"
 	"unsafe"
 )
 
+const connLeaseSegments = 16
+
+type RelayStatus int
+
+const (
+	RelayClosed    RelayStatus = C.TCP_RELAY_CLOSED
+	RelayConnError RelayStatus = C.TCP_RELAY_CONN_ERROR
+	RelayFdError   RelayStatus = C.TCP_RELAY_FD_ERROR
+)
+
+type RelayResult struct {
+	Received uint64
+	Sent     uint64
+	Status   RelayStatus
+}
+
+// TCPStats is a snapshot of a connection's TCP state, taken at once.
+type TCPStats struct {
+	BytesReceived    uint64
+	BytesSent        uint64 // acknowledged by the client
+	SegmentsReceived uint32
+	SegmentsSent     uint32
+	Retransmits      uint32
+	SRTT             time.Duration
+	RTTVar           time.Duration
+	RTO              time.Duration
+	Cwnd             uint32
+	Ssthresh         uint32
+	SendWindow       uint32
+	ReceiveWindow    uint32
+	SendBuffer       uint32 // free space
+	UnsentBytes      uint32
+	UnackedBytes     uint32
+	QueuedSegments   uint32
+	ReceiveQueued    uint32 // received chunks not yet read
+}
+
+// Conn is the net.Conn returned by TCP.Accept.
+type Conn interface {
+	net.Conn
+
+	// ReadLease returns received payload in native memory without copying it.
+	// The leased bytes stay in the receive window until the lease is released.
+	ReadLease() (*Lease, error)
+
+	// Peek copies up to len(b) bytes of the payload Read would return next
+	// without consuming it. It waits only while nothing has been received.
+	Peek(b []byte) (int, error)
+
+	// WriteRef queues b without copying it. b must come from NewBuffer and
+	// stay untouched until Completed reports token, which happens exactly
+	// once, even when the write fails.
+	WriteRef(b []byte, token uint64) (int, error)
+
+	// Completed returns tokens of WriteRef buffers that are no longer
+	// referenced, waiting up to timeout while writes are outstanding.
+	Completed(tokens []uint64, timeout time.Duration) int
+
+	// Relay copies data between the connection and fd in native code until
+	// both directions are closed or either side fails.
+	Relay(fd int) (RelayResult, error)
+
+	// CloseRead shuts down the reading side, pending and later reads return io.EOF.
+	CloseRead() error
+
+	// CloseWrite sends FIN to the client while the connection stays readable.
+	CloseWrite() error
+
+	// SetCongestionControl switches the congestion control of this
+	// connection, which restarts from the initial window of cc.
+	SetCongestionControl(cc CongestionControl) error
+
+	// SetBuffers sizes the send buffer and the receive window, 0 keeps the
+	// current size. The receive window grows up to receiveMax while the
+	// reader keeps up with the client and all windows together stay within
+	// the stack's budget, a receiveMax below receive turns that off.
+	SetBuffers(send, receive, receiveMax int) error
+
+	// Stats returns counters and the current windows and queues of the
+	// connection. It fails once the connection is closed.
+	Stats() (TCPStats, error)
+}
+
+// NewBuffer allocates native memory usable with Conn.WriteRef.
+func NewBuffer(size int) []byte {
+	if size == 0 {
+		return nil
+	}
+
+	return unsafe.Slice((*byte)(C.malloc(C.size_t(size))), size)
+}
+
+func FreeBuffer(b []byte) {
+	if cap(b) == 0 {
+		return
+	}
+
+	C.free(unsafe.Pointer(&b[:cap(b)][0]))
+}
+
 type conn struct {
 	context *C.tcp_conn_t
 }
 
 func (c *conn) Read(b []byte) (int, error) {
+	if len(b) == 0 {
+		return 0, nil
+	}
+
 	n := int(C.tcp_conn_read(c.context, unsafe.Pointer(&b[:cap(b)][0]), C.int(len(b))))
-	if n < 0 {
+	if n == C.TCP_CONN_TIMEOUT {
+		return 0, os.ErrDeadlineExceeded
+	} else if n < 0 {
 		return 0, ErrNative
+	} else if n == 0 {
+		return 0, io.EOF
 	}
 
 	return n, nil
 }
 
+func (c *conn) Peek(b []byte) (int, error) {
+	if len(b) == 0 {
+		return 0, nil
+	}
+
+	n := int(C.tcp_conn_peek(c.context, unsafe.Pointer(&b[:cap(b)][0]), C.int(len(b))))
+	if n == C.TCP_CONN_TIMEOUT {
+		return 0, os.ErrDeadlineExceeded
+	} else if n < 0 {
+		return 0, ErrNative
+	} else if n == 0 {
+		return 0, io.EOF
+	}
+
+	return n, nil
+}
+
+func (c *conn) ReadLease() (*Lease, error) {
+	var segments [connLeaseSegments]C.segment_t
+	var context *C.tcp_lease_t
+
+	n := C.tcp_conn_recv_segments(c.context, &segments[0], C.int(len(segments)), &context)
+	if n == C.TCP_CONN_TIMEOUT {
+		return nil, os.ErrDeadlineExceeded
+	} else if n < 0 {
+		return nil, ErrNative
+	} else if n == 0 {
+		return nil, io.EOF
+	}
+
+	return newLease(segments[:n], func() {
+		C.tcp_conn_release(context)
+	}), nil
+}
+
 func (c *conn) Write(b []byte) (int, error) {
 	n := int(C.tcp_conn_write(c.context, unsafe.Pointer(&b[:cap(b)][0]), C.int(len(b))))
+	if n == C.TCP_CONN_TIMEOUT {
+		return 0, os.ErrDeadlineExceeded
+	} else if n < 0 {
+		return 0, ErrNative
+	} else if n < len(b) {
+		return n, os.ErrDeadlineExceeded
+	}
+
+	return n, nil
+}
+
+func (c *conn) WriteRef(b []byte, token uint64) (int, error) {
+	var data unsafe.Pointer
+	if cap(b) > 0 {
+		data = unsafe.Pointer(&b[:cap(b)][0])
+	}
+
+	n := int(C.tcp_conn_write_ref(c.context, data, C.int(len(b)), C.uint64_t(token)))
 	if n < 0 {
 		return 0, ErrNative
 	}
@@ -36,6 +201,88 @@ func (c *conn) Write(b []byte) (int, error) {
 	return n, nil
 }
 
+func (c *conn) Completed(tokens []uint64, timeout time.Duration) int {
+	if len(tokens) == 0 {
+		return 0
+	}
+
+	return int(C.tcp_conn_completed(c.context, (*C.uint64_t)(unsafe.Pointer(&tokens[0])), C.int(len(tokens)), timeoutMillis(timeout)))
+}
+
+func (c *conn) Relay(fd int) (RelayResult, error) {
+	result := C.tcp_relay_result_t{}
+
+	if C.tcp_conn_relay(c.context, C.int(fd), &result) < 0 {
+		return RelayResult{}, ErrNative
+	}
+
+	return RelayResult{
+		Received: uint64(result.received),
+		Sent:     uint64(result.sent),
+		Status:   RelayStatus(result.status),
+	}, nil
+}
+
+func (c *conn) CloseRead() error {
+	if C.tcp_conn_shutdown(c.context, 1, 0) < 0 {
+		return ErrNative
+	}
+
+	return nil
+}
+
+func (c *conn) CloseWrite() error {
+	if C.tcp_conn_shutdown(c.context, 0, 1) < 0 {
+		return ErrNative
+	}
+
+	return nil
+}
+
+func (c *conn) SetCongestionControl(cc CongestionControl) error {
+	if C.tcp_conn_set_congestion_control(c.context, C.tcp_congestion_t(cc)) < 0 {
+		return ErrNative
+	}
+
+	return nil
+}
+
+func (c *conn) SetBuffers(send, receive, receiveMax int) error {
+	if C.tcp_conn_set_buffers(c.context, C.int(send), C.int(receive), C.int(receiveMax)) < 0 {
+		return ErrNative
+	}
+
+	return nil
+}
+
+func (c *conn) Stats() (TCPStats, error) {
+	stats := C.tcp_conn_stats_t{}
+
+	if C.tcp_conn_stats(c.context, &stats) < 0 {
+		return TCPStats{}, ErrNative
+	}
+
+	return TCPStats{
+		BytesReceived:    uint64(stats.bytes_received),
+		BytesSent:        uint64(stats.bytes_sent),
+		SegmentsReceived: uint32(stats.segments_received),
+		SegmentsSent:     uint32(stats.segments_sent),
+		Retransmits:      uint32(stats.retransmits),
+		SRTT:             time.Duration(stats.srtt_ms) * time.Millisecond,
+		RTTVar:           time.Duration(stats.rttvar_ms) * time.Millisecond,
+		RTO:              time.Duration(stats.rto_ms) * time.Millisecond,
+		Cwnd:             uint32(stats.cwnd),
+		Ssthresh:         uint32(stats.ssthresh),
+		SendWindow:       uint32(stats.send_window),
+		ReceiveWindow:    uint32(stats.receive_window),
+		SendBuffer:       uint32(stats.send_buffer),
+		UnsentBytes:      uint32(stats.unsent_bytes),
+		UnackedBytes:     uint32(stats.unacked_bytes),
+		QueuedSegments:   uint32(stats.queued_segments),
+		ReceiveQueued:    uint32(stats.receive_queued),
+	}, nil
+}
+
 func (c *conn) Close() error {
 	C.tcp_conn_close(c.context)
 
@@ -73,15 +320,35 @@ func (c *conn) RemoteAddr() net.Addr {
 }
 
 func (c *conn) SetDeadline(t time.Time) error {
-	return c.Close()
+	C.tcp_conn_set_deadline(c.context, C.TCP_DEADLINE_READ|C.TCP_DEADLINE_WRITE, deadlineMillis(t))
+
+	return nil
 }
 
 func (c *conn) SetReadDeadline(t time.Time) error {
-	return c.SetDeadline(t)
+	C.tcp_conn_set_deadline(c.context, C.TCP_DEADLINE_READ, deadlineMillis(t))
+
+	return nil
 }
 
 func (c *conn) SetWriteDeadline(t time.Time) error {
-	return c.SetDeadline(t)
+	C.tcp_conn_set_deadline(c.context, C.TCP_DEADLINE_WRITE, deadlineMillis(t))
+
+	return nil
+}
+
+// deadlineMillis rounds up so calls never time out before t.
+func deadlineMillis(t time.Time) C.int64_t {
+	if t.IsZero() {
+		return -1
+	}
+
+	d := time.Until(t)
+	if d <= 0 {
+		return 0
+	}
+
+	return C.int64_t((d + time.Millisecond - 1) / time.Millisecond)
 }
 
 func newConn(context *C.tcp_conn_t) *conn {
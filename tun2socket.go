@@ -6,19 +6,24 @@ import (
 
 type Stack interface {
 	Link() Link
+	Links() []Link
 	TCP() TCP
 	UDP() UDP
 	Close() error
 }
 
 type stack struct {
-	link Link
-	tcp  TCP
-	udp  UDP
+	links []Link
+	tcp   TCP
+	udp   UDP
 }
 
 func (s *stack) Link() Link {
-	return s.link
+	return s.links[0]
+}
+
+func (s *stack) Links() []Link {
+	return s.links
 }
 
 func (s *stack) TCP() TCP {
@@ -30,7 +35,7 @@ func (s *stack) UDP() UDP {
 }
 
 func (s *stack) Close() error {
-	_ = s.link.Close()
+	closeLinks(s.links)
 	_ = s.tcp.Close()
 	_ = s.udp.Close()
 
@@ -43,24 +48,66 @@ func NewStack(mtu int) (Stack, error) {
 		return nil, errors.New("unable to attach link")
 	}
 
+	return newStack([]Link{link})
+}
+
+func NewStackWithFd(fd int, mtu int) (Stack, error) {
+	link, err := AttachLink(fd, mtu)
+	if err != nil {
+		return nil, errors.New("unable to attach link")
+	}
+
+	return newStack([]Link{link})
+}
+
+// NewStackWithFds attaches every queue of a multi-queue TUN device.
+// Outgoing packets are spread over the queues by flow hash.
+func NewStackWithFds(fds []int, mtu int) (Stack, error) {
+	if len(fds) == 0 {
+		return nil, errors.New("no link fd")
+	}
+
+	links := make([]Link, 0, len(fds))
+
+	for _, fd := range fds {
+		link, err := AttachLink(fd, mtu)
+		if err != nil {
+			closeLinks(links)
+
+			return nil, errors.New("unable to attach link")
+		}
+
+		links = append(links, link)
+	}
+
+	return newStack(links)
+}
+
+func newStack(links []Link) (Stack, error) {
 	tcp, err := ListenTCP()
 	if err != nil {
-		_ = link.Close()
+		closeLinks(links)
 
 		return nil, errors.New("unable to listen tcp")
 	}
 
 	udp, err := ListenUDP()
 	if err != nil {
-		_ = link.Close()
+		closeLinks(links)
 		_ = tcp.Close()
 
 		return nil, errors.New("unable to listen udp")
 	}
 
 	return &stack{
-		link: link,
-		tcp:  tcp,
-		udp:  udp,
+		links: links,
+		tcp:   tcp,
+		udp:   udp,
 	}, nil
 }
+
+func closeLinks(links []Link) {
+	for _, link := range links {
+		_ = link.Close()
+	}
+}
@@ -10,12 +10,15 @@ import "C"
 import (
 	"net"
 	"runtime"
+	"time"
 	"unsafe"
 )
 
 type UDP interface {
 	ReadFrom(b []byte) (n int, lAddr, rAddr net.Addr, err error)
 	WriteTo(b []byte, lAddr, rAddr net.Addr) (int, error)
+	SetQueuePolicy(direction QueueDirection, policy QueuePolicy, limit int, timeout time.Duration)
+	QueueStats(direction QueueDirection) QueueStats
 	Close() error
 }
 
@@ -97,6 +100,18 @@ func (p *udp) WriteTo(b []byte, lAddr, rAddr net.Addr) (int, error) {
 	return int(n), nil
 }
 
+func (p *udp) SetQueuePolicy(direction QueueDirection, policy QueuePolicy, limit int, timeout time.Duration) {
+	C.udp_conn_set_queue_policy(p.context, C.queue_direction_t(direction), C.queue_policy_t(policy), C.int(limit), timeoutMillis(timeout))
+}
+
+func (p *udp) QueueStats(direction QueueDirection) QueueStats {
+	stats := C.queue_stats_t{}
+
+	C.udp_conn_queue_stats(p.context, C.queue_direction_t(direction), &stats)
+
+	return newQueueStats(&stats)
+}
+
 func (p *udp) Close() error {
 	C.udp_conn_close(p.context)
 